@@ -0,0 +1,494 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <angles/angles.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ndt_2d/graph.hpp>
+#include <ndt_2d/likelihood_field.hpp>
+#include <ndt_2d/motion_model.hpp>
+#include <ndt_2d/particle_filter.hpp>
+#include <ndt_2d/scan_matcher.hpp>
+#include <pluginlib/class_loader.hpp>
+#include <rclcpp/rclcpp.hpp>
+#include "synthetic_world.hpp"
+
+/*
+ * Sweep scan matcher and pipeline parameters over a dataset, reporting the
+ * trajectory error against ground truth next to the CPU time per scan, and
+ * marking the configurations on the Pareto front. Usage:
+ *
+ *   ros2 run ndt_2d accuracy_benchmark [options] [name=value1,value2,...]...
+ *
+ * Options:
+ *   --map <file>         Use the scans and poses of a saved map as the dataset
+ *                        (and ground truth), default is a synthetic world.
+ *   --mode <mode>        "mapping" (local scan matching against a rolling
+ *                        window, default) or "localization" (particle filter
+ *                        against a global NDT of the ground truth scans).
+ *   --type <plugin>      Scan matcher plugin, default ndt_2d::ScanMatcherNDT.
+ *   --odom-noise <frac>  Odometry noise as a fraction of motion, default 0.05.
+ *   --output <file>      Also write the results as CSV to this file.
+ *
+ * Each name=values argument adds an axis to the grid. Pipeline parameters
+ * are rolling_depth, keyframe_min_novelty, min_particles, max_particles,
+ * kld_err, kld_z, measurement_model and the likelihood_field_* parameters,
+ * all other names are passed to the scan matcher. Values containing a decimal
+ * point are doubles, other numbers are integers.
+ */
+
+namespace
+{
+
+struct Dataset
+{
+  std::vector<ndt_2d::Pose2d> truth;
+  std::vector<ndt_2d::Pose2d> odom;
+  std::vector<std::vector<ndt_2d::Point>> points;
+};
+
+struct Result
+{
+  std::string config;
+  double ate;
+  double rpe_trans;
+  double rpe_rot;
+  double cpu_ms;
+  bool pareto;
+};
+
+// Pipeline parameters, all others are passed to the scan matcher
+const std::vector<std::string> PIPELINE_PARAMETERS =
+{
+  "rolling_depth", "keyframe_min_novelty", "min_particles", "max_particles",
+  "kld_err", "kld_z", "measurement_model", "likelihood_field_resolution",
+  "likelihood_field_sigma", "likelihood_field_z_rand", "likelihood_field_max_beams"
+};
+
+double cpuTime()
+{
+  // Process (not thread) time, so that multi-threaded matchers are fully counted
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/** @brief Motion from a to b, in the frame of a. */
+ndt_2d::Pose2d relative(const ndt_2d::Pose2d & a, const ndt_2d::Pose2d & b)
+{
+  double dx = b.x - a.x;
+  double dy = b.y - a.y;
+  double costh = cos(a.theta), sinth = sin(a.theta);
+  return ndt_2d::Pose2d(costh * dx + sinth * dy, -sinth * dx + costh * dy,
+                        angles::shortest_angular_distance(a.theta, b.theta));
+}
+
+/** @brief Apply motion d, in the frame of a. */
+ndt_2d::Pose2d compose(const ndt_2d::Pose2d & a, const ndt_2d::Pose2d & d)
+{
+  double costh = cos(a.theta), sinth = sin(a.theta);
+  return ndt_2d::Pose2d(a.x + costh * d.x - sinth * d.y, a.y + sinth * d.x + costh * d.y,
+                        angles::normalize_angle(a.theta + d.theta));
+}
+
+/** @brief Simulate odometry by adding noise proportional to motion. */
+void addOdometry(Dataset & dataset, double noise)
+{
+  std::mt19937 gen(42);
+  std::normal_distribution<double> dist(0.0, 1.0);
+
+  dataset.odom.clear();
+  dataset.odom.push_back(dataset.truth[0]);
+  for (size_t i = 1; i < dataset.truth.size(); ++i)
+  {
+    ndt_2d::Pose2d d = relative(dataset.truth[i - 1], dataset.truth[i]);
+    double trans = std::hypot(d.x, d.y);
+    d.x += dist(gen) * noise * trans;
+    d.y += dist(gen) * noise * trans;
+    d.theta += dist(gen) * noise * (std::fabs(d.theta) + trans);
+    dataset.odom.push_back(compose(dataset.odom.back(), d));
+  }
+}
+
+Dataset makeSyntheticDataset()
+{
+  ndt_2d::SyntheticWorld world;
+  Dataset dataset;
+  dataset.truth = ndt_2d::SyntheticWorld::makeTrajectory(0.25);
+  for (size_t i = 0; i < dataset.truth.size(); ++i)
+  {
+    dataset.points.push_back(world.simulate(dataset.truth[i], 360, 10.0, 0.01, i));
+  }
+  return dataset;
+}
+
+Dataset loadDataset(const std::string & filename)
+{
+  ndt_2d::Graph graph(false, filename);
+  Dataset dataset;
+  for (auto & scan : graph.scans)
+  {
+    dataset.truth.push_back(scan->getPose());
+    dataset.points.push_back(scan->getPoints());
+  }
+  return dataset;
+}
+
+rclcpp::Parameter parseParameter(const std::string & name, const std::string & value)
+{
+  char * end;
+  if (value.find('.') == std::string::npos)
+  {
+    long long i = std::strtoll(value.c_str(), &end, 10);
+    if (*end == '\0') return rclcpp::Parameter(name, static_cast<int64_t>(i));
+  }
+  double d = std::strtod(value.c_str(), &end);
+  if (*end == '\0') return rclcpp::Parameter(name, d);
+  return rclcpp::Parameter(name, value);
+}
+
+/** @brief Expand name=v1,v2 arguments into the cartesian product of configurations. */
+std::vector<std::vector<rclcpp::Parameter>> expandGrid(const std::vector<std::string> & axes,
+                                                       const std::string & matcher_name)
+{
+  std::vector<std::vector<rclcpp::Parameter>> configs(1);
+  for (auto & axis : axes)
+  {
+    size_t eq = axis.find('=');
+    std::string name = axis.substr(0, eq);
+    if (std::find(PIPELINE_PARAMETERS.begin(), PIPELINE_PARAMETERS.end(), name) ==
+        PIPELINE_PARAMETERS.end())
+    {
+      name = matcher_name + "." + name;
+    }
+
+    std::vector<std::vector<rclcpp::Parameter>> expanded;
+    std::stringstream values(axis.substr(eq + 1));
+    std::string value;
+    while (std::getline(values, value, ','))
+    {
+      for (auto config : configs)
+      {
+        config.push_back(parseParameter(name, value));
+        expanded.push_back(config);
+      }
+    }
+    configs = expanded;
+  }
+  return configs;
+}
+
+std::string describe(const std::vector<rclcpp::Parameter> & config)
+{
+  std::string s;
+  for (auto & param : config)
+  {
+    if (!s.empty()) s += " ";
+    std::string name = param.get_name();
+    s += name.substr(name.find('.') + 1) + "=" + param.value_to_string();
+  }
+  return s.empty() ? "defaults" : s;
+}
+
+/**
+ * @brief Mirror of the mapping front end in Mapper::laserCallback(): apply
+ *        odometry, then correct by matching against the rolling window.
+ *        Only novel scans are added to the rolling window.
+ */
+std::vector<ndt_2d::Pose2d> runMapping(const Dataset & dataset, rclcpp::Node * node,
+                                       const ndt_2d::ScanMatcherPtr & matcher, double & cpu)
+{
+  size_t rolling_depth = node->declare_parameter<int>("rolling_depth", 10);
+  double min_novelty = node->declare_parameter<double>("keyframe_min_novelty", 0.0);
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  std::vector<ndt_2d::Pose2d> estimate;
+  cpu = 0.0;
+  for (size_t i = 0; i < dataset.truth.size(); ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    scan->setPoints(dataset.points[i]);
+    if (scans.empty())
+    {
+      scan->setPose(dataset.truth[0]);
+      scans.push_back(scan);
+      estimate.push_back(scan->getPose());
+      continue;
+    }
+
+    ndt_2d::Pose2d odom_delta = relative(dataset.odom[i - 1], dataset.odom[i]);
+    scan->setPose(compose(estimate.back(), odom_delta));
+
+    double start = cpuTime();
+    size_t begin = (scans.size() <= rolling_depth) ? 0 : scans.size() - rolling_depth;
+    matcher->reset();
+    matcher->addScans(scans.begin() + begin, scans.end());
+    ndt_2d::Pose2d correction;
+    Eigen::Matrix3d covariance;
+    matcher->matchScan(scan, correction, covariance);
+
+    ndt_2d::Pose2d pose = scan->getPose();
+    scan->setPose(ndt_2d::Pose2d(pose.x + correction.x, pose.y + correction.y,
+                                 pose.theta + correction.theta));
+    if (matcher->novelty(scan) >= min_novelty)
+    {
+      scans.push_back(scan);
+    }
+    cpu += cpuTime() - start;
+    estimate.push_back(scan->getPose());
+  }
+
+  fprintf(stderr, "  %lu of %lu scans used as keyframes\n", scans.size(), dataset.truth.size());
+  return estimate;
+}
+
+/**
+ * @brief Mirror of particle filter localization in Mapper::laserCallback(),
+ *        against a global NDT built from the ground truth scans.
+ */
+std::vector<ndt_2d::Pose2d> runLocalization(const Dataset & dataset, rclcpp::Node * node,
+                                            const ndt_2d::ScanMatcherPtr & matcher, double & cpu)
+{
+  size_t min_p = node->declare_parameter<int>("min_particles", 100);
+  size_t max_p = node->declare_parameter<int>("max_particles", 500);
+  double kld_err = node->declare_parameter<double>("kld_err", 0.01);
+  double kld_z = node->declare_parameter<double>("kld_z", 2.3);
+  std::string measurement_model =
+    node->declare_parameter<std::string>("measurement_model", "ndt");
+  double field_resolution = node->declare_parameter<double>("likelihood_field_resolution", 0.05);
+  double field_sigma = node->declare_parameter<double>("likelihood_field_sigma", 0.1);
+  double field_z_rand = node->declare_parameter<double>("likelihood_field_z_rand", 0.05);
+  size_t field_max_beams = node->declare_parameter<int>("likelihood_field_max_beams", 100);
+
+  std::vector<ndt_2d::ScanPtr> map;
+  for (size_t i = 0; i < dataset.truth.size(); ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    scan->setPose(dataset.truth[i]);
+    scan->setPoints(dataset.points[i]);
+    map.push_back(scan);
+  }
+  matcher->addScans(map.begin(), map.end());
+  ndt_2d::LikelihoodField field(field_resolution, field_sigma, field_z_rand);
+  if (measurement_model == "likelihood_field")
+  {
+    field.build(map.begin(), map.end());
+  }
+
+  ndt_2d::MotionModelPtr model = std::make_shared<ndt_2d::MotionModel>(0.2, 0.2, 0.2, 0.2, 0.2);
+  ndt_2d::ParticleFilter filter(min_p, max_p, model);
+  const ndt_2d::Pose2d & start_pose = dataset.truth[0];
+  filter.init(start_pose.x, start_pose.y, start_pose.theta, 0.1, 0.1, 0.05);
+
+  std::vector<ndt_2d::Pose2d> estimate;
+  estimate.push_back(start_pose);
+  cpu = 0.0;
+  for (size_t i = 1; i < dataset.truth.size(); ++i)
+  {
+    ndt_2d::Pose2d odom_delta = relative(dataset.odom[i - 1], dataset.odom[i]);
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(dataset.truth.size() + i);
+    scan->setPoints(dataset.points[i]);
+
+    double start = cpuTime();
+    filter.update(odom_delta.x, odom_delta.y, odom_delta.theta);
+    if (measurement_model == "likelihood_field")
+    {
+      filter.measure(field, scan, field_max_beams);
+    }
+    else
+    {
+      filter.measure(matcher, scan);
+    }
+    filter.resample(kld_err, kld_z);
+    cpu += cpuTime() - start;
+
+    Eigen::Vector3d mean = filter.getMean();
+    estimate.emplace_back(mean(0), mean(1), mean(2));
+  }
+  return estimate;
+}
+
+/** @brief Compute absolute trajectory error and relative pose error (RMSE). */
+void computeErrors(const std::vector<ndt_2d::Pose2d> & truth,
+                   const std::vector<ndt_2d::Pose2d> & estimate, Result & result)
+{
+  // Trajectories start at the same pose, so no alignment is needed
+  double ate = 0.0, rpe_trans = 0.0, rpe_rot = 0.0;
+  for (size_t i = 0; i < truth.size(); ++i)
+  {
+    ate += std::pow(truth[i].x - estimate[i].x, 2) + std::pow(truth[i].y - estimate[i].y, 2);
+    if (i > 0)
+    {
+      ndt_2d::Pose2d t = relative(truth[i - 1], truth[i]);
+      ndt_2d::Pose2d e = relative(estimate[i - 1], estimate[i]);
+      rpe_trans += std::pow(t.x - e.x, 2) + std::pow(t.y - e.y, 2);
+      rpe_rot += std::pow(angles::shortest_angular_distance(t.theta, e.theta), 2);
+    }
+  }
+  result.ate = std::sqrt(ate / truth.size());
+  result.rpe_trans = std::sqrt(rpe_trans / std::max<size_t>(1, truth.size() - 1));
+  result.rpe_rot = std::sqrt(rpe_rot / std::max<size_t>(1, truth.size() - 1));
+}
+
+/** @brief A result is on the Pareto front if no other is at least as good in both. */
+void markPareto(std::vector<Result> & results)
+{
+  for (auto & r : results)
+  {
+    r.pareto = true;
+    for (auto & other : results)
+    {
+      if (other.ate <= r.ate && other.cpu_ms <= r.cpu_ms &&
+          (other.ate < r.ate || other.cpu_ms < r.cpu_ms))
+      {
+        r.pareto = false;
+        break;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char ** argv)
+{
+  std::vector<std::string> args = rclcpp::init_and_remove_ros_arguments(argc, argv);
+
+  std::string map_file, mode = "mapping", type = "ndt_2d::ScanMatcherNDT", output;
+  double odom_noise = 0.05;
+  std::vector<std::string> axes;
+  for (size_t i = 1; i < args.size(); ++i)
+  {
+    bool has_value = i + 1 < args.size();
+    if (args[i] == "--map" && has_value) map_file = args[++i];
+    else if (args[i] == "--mode" && has_value) mode = args[++i];
+    else if (args[i] == "--type" && has_value) type = args[++i];
+    else if (args[i] == "--odom-noise" && has_value) odom_noise = std::stod(args[++i]);
+    else if (args[i] == "--output" && has_value) output = args[++i];
+    else if (args[i].find('=') != std::string::npos) axes.push_back(args[i]);
+    else
+    {
+      fprintf(stderr, "usage: accuracy_benchmark [--map file] [--mode mapping|localization] "
+                      "[--type plugin] [--odom-noise frac] [--output file] "
+                      "[name=value1,value2,...]...\n");
+      return 1;
+    }
+  }
+  if (mode != "mapping" && mode != "localization")
+  {
+    fprintf(stderr, "Unknown mode %s\n", mode.c_str());
+    return 1;
+  }
+
+  Dataset dataset = map_file.empty() ? makeSyntheticDataset() : loadDataset(map_file);
+  if (dataset.truth.size() < 2)
+  {
+    fprintf(stderr, "Dataset needs at least two scans\n");
+    return 1;
+  }
+  addOdometry(dataset, odom_noise);
+
+  // Same namespaces as the mapper uses
+  std::string matcher_name = (mode == "mapping") ? "local_scan_matcher" : "global_scan_matcher";
+  auto configs = expandGrid(axes, matcher_name);
+  printf("Running %lu configurations of %s over %lu scans (%s)\n", configs.size(),
+         type.c_str(), dataset.truth.size(), map_file.empty() ? "synthetic" : map_file.c_str());
+
+  // Error of raw odometry, for reference
+  Result odometry;
+  computeErrors(dataset.truth, dataset.odom, odometry);
+  printf("Odometry only: ate %.4f m, rpe %.4f m / %.4f rad\n", odometry.ate,
+         odometry.rpe_trans, odometry.rpe_rot);
+
+  pluginlib::ClassLoader<ndt_2d::ScanMatcher> loader("ndt_2d", "ndt_2d::ScanMatcher");
+  std::vector<Result> results;
+  for (auto & config : configs)
+  {
+    auto node = std::make_shared<rclcpp::Node>("accuracy_benchmark",
+      rclcpp::NodeOptions().parameter_overrides(config));
+    ndt_2d::ScanMatcherPtr matcher = loader.createSharedInstance(type);
+    matcher->initialize(matcher_name, node.get(), 10.0);
+
+    Result result;
+    result.config = describe(config);
+    double cpu;
+    std::vector<ndt_2d::Pose2d> estimate = (mode == "mapping") ?
+      runMapping(dataset, node.get(), matcher, cpu) :
+      runLocalization(dataset, node.get(), matcher, cpu);
+    computeErrors(dataset.truth, estimate, result);
+    result.cpu_ms = 1000.0 * cpu / (dataset.truth.size() - 1);
+    results.push_back(result);
+
+    fprintf(stderr, "  %s: ate %.4f m, %.3f ms/scan\n", result.config.c_str(),
+            result.ate, result.cpu_ms);
+  }
+  markPareto(results);
+
+  // Sort by cpu, so the Pareto front reads as a curve
+  std::sort(results.begin(), results.end(),
+    [](const Result & a, const Result & b) { return a.cpu_ms < b.cpu_ms; });
+
+  FILE * csv = output.empty() ? nullptr : fopen(output.c_str(), "w");
+  if (!output.empty() && !csv)
+  {
+    fprintf(stderr, "Unable to write %s\n", output.c_str());
+  }
+  const char * header = "config, ate_m, rpe_trans_m, rpe_rot_rad, cpu_ms_per_scan, pareto\n";
+  printf("%s", header);
+  if (csv) fprintf(csv, "%s", header);
+  for (auto & r : results)
+  {
+    printf("%s, %f, %f, %f, %.3f, %d\n", r.config.c_str(), r.ate, r.rpe_trans,
+           r.rpe_rot, r.cpu_ms, r.pareto);
+    if (csv)
+    {
+      fprintf(csv, "%s, %f, %f, %f, %.3f, %d\n", r.config.c_str(), r.ate, r.rpe_trans,
+              r.rpe_rot, r.cpu_ms, r.pareto);
+    }
+  }
+  if (csv) fclose(csv);
+
+  printf("\nPareto front (accuracy vs cpu):\n");
+  for (auto & r : results)
+  {
+    if (r.pareto)
+    {
+      printf("  %8.3f ms/scan  ate %.4f m  %s\n", r.cpu_ms, r.ate, r.config.c_str());
+    }
+  }
+
+  rclcpp::shutdown();
+  return 0;
+}
@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <ndt_2d/ceres_solver.hpp>
+#include <ndt_2d/constraint.hpp>
+#include <ndt_2d/motion_model.hpp>
+#include <ndt_2d/ndt_model.hpp>
+#include <ndt_2d/occupancy_grid.hpp>
+#include <ndt_2d/particle_filter.hpp>
+#include <ndt_2d/scan_matcher_ndt.hpp>
+#include <rclcpp/rclcpp.hpp>
+#include "synthetic_world.hpp"
+
+/*
+ * Performance regression tests. Each scenario measures the throughput of a
+ * hot path and compares it against perf_baseline.json. A scenario fails when
+ * throughput drops by more than the tolerance. A scenario missing from the
+ * baseline, or whose baseline is zero (not yet recorded), fails, so that
+ * every scenario is gated.
+ * Environment variables:
+ *
+ *  - NDT_2D_PERF_BASELINE: baseline file to use, default is the checked-in one.
+ *  - NDT_2D_PERF_TOLERANCE: allowed fractional slowdown, overrides the baseline.
+ *  - NDT_2D_PERF_OUTPUT: where to write the JSON results (perf_results.json).
+ *  - NDT_2D_PERF_UPDATE_BASELINE: if set, update the baseline with the results,
+ *    scenarios that were not run keep their previous baseline.
+ */
+
+#ifndef NDT_2D_PERF_BASELINE_FILE
+#define NDT_2D_PERF_BASELINE_FILE "perf_baseline.json"
+#endif
+
+namespace
+{
+
+struct PerfResult
+{
+  std::string name;
+  std::string unit;
+  double throughput;
+  double baseline;
+  std::string status;
+};
+
+std::string getEnv(const char * name, const std::string & default_value)
+{
+  const char * value = std::getenv(name);
+  return value ? std::string(value) : default_value;
+}
+
+/**
+ * Minimal parser for the baseline file, which is a JSON object of
+ * numbers, strings and nested objects. Nested keys are flattened with a '.'
+ */
+class BaselineParser
+{
+public:
+  explicit BaselineParser(const std::string & text)
+  : text_(text), pos_(0)
+  {
+  }
+
+  bool parse(std::map<std::string, double> & values,
+             std::map<std::string, std::string> & strings)
+  {
+    return parseObject("", values, strings);
+  }
+
+private:
+  bool parseObject(const std::string & prefix, std::map<std::string, double> & values,
+                   std::map<std::string, std::string> & strings)
+  {
+    if (!consume('{')) return false;
+    if (consume('}')) return true;
+    do
+    {
+      std::string key;
+      if (!parseString(key) || !consume(':')) return false;
+      key = prefix + key;
+
+      skipWhitespace();
+      if (pos_ < text_.size() && text_[pos_] == '{')
+      {
+        if (!parseObject(key + ".", values, strings)) return false;
+      }
+      else if (pos_ < text_.size() && text_[pos_] == '"')
+      {
+        if (!parseString(strings[key])) return false;
+      }
+      else
+      {
+        const char * start = text_.c_str() + pos_;
+        char * end;
+        double value = std::strtod(start, &end);
+        if (end == start) return false;
+        pos_ += end - start;
+        values[key] = value;
+      }
+    }
+    while (consume(','));
+    return consume('}');
+  }
+
+  bool parseString(std::string & value)
+  {
+    if (!consume('"')) return false;
+    size_t end = text_.find('"', pos_);
+    if (end == std::string::npos) return false;
+    value = text_.substr(pos_, end - pos_);
+    pos_ = end + 1;
+    return true;
+  }
+
+  bool consume(char c)
+  {
+    skipWhitespace();
+    if (pos_ < text_.size() && text_[pos_] == c)
+    {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  void skipWhitespace()
+  {
+    while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_])))
+    {
+      ++pos_;
+    }
+  }
+
+  const std::string & text_;
+  size_t pos_;
+};
+
+class PerfEnvironment : public testing::Environment
+{
+public:
+  void SetUp() override
+  {
+    baseline_file_ = getEnv("NDT_2D_PERF_BASELINE", NDT_2D_PERF_BASELINE_FILE);
+    output_file_ = getEnv("NDT_2D_PERF_OUTPUT", "perf_results.json");
+
+    std::ifstream file(baseline_file_);
+    if (file)
+    {
+      std::stringstream buffer;
+      buffer << file.rdbuf();
+      std::string text = buffer.str();
+      if (!BaselineParser(text).parse(baseline_, baseline_units_))
+      {
+        ADD_FAILURE() << "Unable to parse baseline " << baseline_file_;
+        baseline_.clear();
+        baseline_units_.clear();
+      }
+    }
+    else
+    {
+      std::cerr << "No baseline found at " << baseline_file_ << std::endl;
+    }
+
+    tolerance_ = 0.25;
+    if (baseline_.count("tolerance"))
+    {
+      tolerance_ = baseline_["tolerance"];
+    }
+    tolerance_ = std::stod(getEnv("NDT_2D_PERF_TOLERANCE", std::to_string(tolerance_)));
+    update_baseline_ = std::getenv("NDT_2D_PERF_UPDATE_BASELINE") != nullptr;
+  }
+
+  void TearDown() override
+  {
+    writeResults(output_file_, false);
+    if (update_baseline_)
+    {
+      writeResults(baseline_file_, true);
+    }
+  }
+
+  /**
+   * @brief Check a measured throughput against the baseline.
+   * @returns False if throughput regressed by more than the tolerance.
+   */
+  bool check(const std::string & name, const std::string & unit, double throughput)
+  {
+    PerfResult result;
+    result.name = name;
+    result.unit = unit;
+    result.throughput = throughput;
+    result.baseline = 0.0;
+    result.status = "no_baseline";
+
+    auto baseline = baseline_.find("throughput." + name);
+    bool recorded = baseline != baseline_.end() && baseline->second > 0.0;
+    if (!recorded && !update_baseline_)
+    {
+      result.status = "missing";
+      ADD_FAILURE() << name << " has no recorded baseline in " << baseline_file_ <<
+        ", record one with NDT_2D_PERF_UPDATE_BASELINE";
+    }
+    else if (recorded)
+    {
+      result.baseline = baseline->second;
+      bool ok = throughput >= (1.0 - tolerance_) * result.baseline;
+      result.status = ok ? "pass" : "fail";
+    }
+    results_.push_back(result);
+
+    std::cout << name << ": " << throughput << " " << unit;
+    if (result.baseline > 0.0)
+    {
+      std::cout << " (baseline " << result.baseline << ", " <<
+        100.0 * throughput / result.baseline << "%)";
+    }
+    std::cout << std::endl;
+
+    testing::Test::RecordProperty(name, std::to_string(throughput));
+    return result.status != "fail" && result.status != "missing";
+  }
+
+  double tolerance() const { return tolerance_; }
+
+private:
+  // Write results as JSON, when writing a baseline only throughput is needed
+  void writeResults(const std::string & filename, bool baseline)
+  {
+    std::vector<PerfResult> results = results_;
+    if (baseline)
+    {
+      // Scenarios that were not run (filtered out, or not built) keep their baseline
+      for (auto & entry : baseline_)
+      {
+        const std::string prefix = "throughput.";
+        if (entry.first.compare(0, prefix.size(), prefix) != 0) continue;
+        PerfResult kept;
+        kept.name = entry.first.substr(prefix.size());
+        kept.throughput = entry.second;
+        kept.unit = baseline_units_["units." + kept.name];
+        bool measured = false;
+        for (auto & r : results_)
+        {
+          measured = measured || r.name == kept.name;
+        }
+        if (!measured) results.push_back(kept);
+      }
+    }
+
+    std::ofstream file(filename);
+    if (!file)
+    {
+      std::cerr << "Unable to write " << filename << std::endl;
+      return;
+    }
+
+    file << "{\n  \"tolerance\": " << tolerance_ << ",\n";
+    file << (baseline ? "  \"units\": {\n" : "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      auto & r = results[i];
+      if (baseline)
+      {
+        file << "    \"" << r.name << "\": \"" << r.unit << "\"";
+      }
+      else
+      {
+        file << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit <<
+          "\", \"throughput\": " << r.throughput << ", \"baseline\": " << r.baseline <<
+          ", \"status\": \"" << r.status << "\"}";
+      }
+      file << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << (baseline ? "  },\n" : "  ]\n");
+
+    if (baseline)
+    {
+      file << "  \"throughput\": {\n";
+      for (size_t i = 0; i < results.size(); ++i)
+      {
+        file << "    \"" << results[i].name << "\": " << results[i].throughput;
+        file << (i + 1 < results.size() ? ",\n" : "\n");
+      }
+      file << "  }\n";
+    }
+    file << "}\n";
+  }
+
+  std::string baseline_file_, output_file_;
+  std::map<std::string, double> baseline_;
+  std::map<std::string, std::string> baseline_units_;
+  double tolerance_;
+  bool update_baseline_;
+  std::vector<PerfResult> results_;
+};
+
+PerfEnvironment * environment = nullptr;
+
+/**
+ * @brief Measure throughput of a function.
+ * @param fn Function to benchmark, returns the amount of work done.
+ * @returns Best throughput (work per second) over several trials, the
+ *          best rather than mean is used since noise only slows things down.
+ */
+double measure(const std::function<double()> & fn)
+{
+  const double TRIAL_DURATION = 0.25;
+  const size_t TRIALS = 5;
+
+  // Warm up caches and allocations
+  fn();
+
+  double best = 0.0;
+  for (size_t trial = 0; trial < TRIALS; ++trial)
+  {
+    double work = 0.0;
+    std::chrono::duration<double> elapsed(0.0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < TRIAL_DURATION)
+    {
+      work += fn();
+      elapsed = std::chrono::steady_clock::now() - start;
+    }
+    best = std::max(best, work / elapsed.count());
+  }
+  return best;
+}
+
+// Shared data for all scenarios
+class PerfTests : public testing::Test
+{
+protected:
+  static void SetUpTestSuite()
+  {
+    world_ = std::make_unique<ndt_2d::SyntheticWorld>();
+    scans_ = world_->makeScans(ndt_2d::SyntheticWorld::makeTrajectory(0.25),
+                               360, RANGE_MAX, 0.01);
+  }
+
+  static void TearDownTestSuite()
+  {
+    scans_.clear();
+    world_.reset();
+  }
+
+  static ndt_2d::ScanPtr makeQuery(const ndt_2d::ScanPtr & scan)
+  {
+    ndt_2d::Pose2d pose = scan->getPose();
+    ndt_2d::ScanPtr query = std::make_shared<ndt_2d::Scan>(scans_.size());
+    query->setPoints(world_->simulate(pose, 360, RANGE_MAX, 0.01, 1234));
+    // Offset the pose, as odometry would
+    pose.x += 0.02;
+    pose.y -= 0.03;
+    pose.theta += 0.02;
+    query->setPose(pose);
+    return query;
+  }
+
+  static constexpr double RANGE_MAX = 10.0;
+  static std::unique_ptr<ndt_2d::SyntheticWorld> world_;
+  static std::vector<ndt_2d::ScanPtr> scans_;
+};
+
+constexpr double PerfTests::RANGE_MAX;
+std::unique_ptr<ndt_2d::SyntheticWorld> PerfTests::world_;
+std::vector<ndt_2d::ScanPtr> PerfTests::scans_;
+
+}  // namespace
+
+TEST_F(PerfTests, ndt_likelihood)
+{
+  ndt_2d::NDT ndt(0.25, 22.0, 14.0, -11.0, -7.0);
+  for (auto & scan : scans_)
+  {
+    ndt.addScan(scan);
+  }
+  ndt.compute();
+
+  // Query points in the map frame
+  std::vector<ndt_2d::Point> points;
+  for (size_t i = 0; i < scans_.size(); i += 10)
+  {
+    ndt_2d::Pose2d pose = scans_[i]->getPose();
+    double costh = cos(pose.theta), sinth = sin(pose.theta);
+    for (auto & p : scans_[i]->getPoints())
+    {
+      points.emplace_back(p.x * costh - p.y * sinth + pose.x,
+                          p.x * sinth + p.y * costh + pose.y);
+    }
+  }
+
+  double throughput = measure([&]()
+    {
+      volatile double score = ndt.likelihood(points);
+      (void)score;
+      return static_cast<double>(points.size());
+    });
+  EXPECT_TRUE(environment->check("ndt_likelihood", "points/s", throughput));
+}
+
+TEST_F(PerfTests, scan_matching)
+{
+  auto node = std::make_shared<rclcpp::Node>("perf_regression");
+  ndt_2d::ScanMatcherNDT matcher;
+  matcher.initialize("local_scan_matcher", node.get(), RANGE_MAX);
+
+  // Match against a rolling window, as the mapper does
+  const size_t DEPTH = 10;
+  size_t index = scans_.size() / 2;
+  matcher.addScans(scans_.begin() + index - DEPTH, scans_.begin() + index);
+  ndt_2d::ScanPtr query = makeQuery(scans_[index]);
+
+  double throughput = measure([&]()
+    {
+      ndt_2d::Pose2d correction;
+      Eigen::Matrix3d covariance;
+      matcher.matchScan(query, correction, covariance);
+      return 1.0;
+    });
+  EXPECT_TRUE(environment->check("scan_matching", "matches/s", throughput));
+}
+
+TEST_F(PerfTests, scan_matching_beams)
+{
+  // Matching cost for common beam counts
+  const size_t DEPTH = 10;
+  size_t index = scans_.size() / 2;
+  ndt_2d::ScanPtr query = makeQuery(scans_[index]);
+
+  for (int beams : {64, 100, 128})
+  {
+    auto node = std::make_shared<rclcpp::Node>("perf_regression",
+      rclcpp::NodeOptions().parameter_overrides({
+        rclcpp::Parameter("local_scan_matcher.laser_max_beams", beams)}));
+    ndt_2d::ScanMatcherNDT matcher;
+    matcher.initialize("local_scan_matcher", node.get(), RANGE_MAX);
+    matcher.addScans(scans_.begin() + index - DEPTH, scans_.begin() + index);
+
+    double throughput = measure([&]()
+      {
+        ndt_2d::Pose2d correction;
+        Eigen::Matrix3d covariance;
+        matcher.matchScan(query, correction, covariance);
+        return 1.0;
+      });
+    std::string name = "scan_matching_" + std::to_string(beams) + "_beams";
+    EXPECT_TRUE(environment->check(name, "matches/s", throughput));
+  }
+}
+
+TEST_F(PerfTests, particle_filter)
+{
+  auto node = std::make_shared<rclcpp::Node>("perf_regression");
+  ndt_2d::ScanMatcherPtr matcher = std::make_shared<ndt_2d::ScanMatcherNDT>();
+  matcher->initialize("global_scan_matcher", node.get(), RANGE_MAX);
+  matcher->addScans(scans_.begin(), scans_.end());
+
+  ndt_2d::MotionModelPtr model =
+    std::make_shared<ndt_2d::MotionModel>(0.2, 0.2, 0.2, 0.2, 0.0);
+  ndt_2d::ParticleFilter filter(250, 500, model);
+  ndt_2d::ScanPtr query = makeQuery(scans_[scans_.size() / 2]);
+  ndt_2d::Pose2d pose = query->getPose();
+
+  double throughput = measure([&]()
+    {
+      // Keep the filter from collapsing, so each iteration does the same work
+      filter.init(pose.x, pose.y, pose.theta, 0.1, 0.1, 0.1);
+      filter.update(0.1, 0.0, 0.0);
+      filter.measure(matcher, query);
+      filter.resample(0.01, 2.3);
+      return 1.0;
+    });
+  EXPECT_TRUE(environment->check("particle_filter", "updates/s", throughput));
+}
+
+TEST_F(PerfTests, map_rendering)
+{
+  ndt_2d::OccupancyGrid grid(0.05, 0.13);
+  nav_msgs::msg::OccupancyGrid msg;
+
+  double throughput = measure([&]()
+    {
+      grid.getMsg(scans_, msg);
+      return 1.0;
+    });
+  EXPECT_TRUE(environment->check("map_rendering", "maps/s", throughput));
+}
+
+TEST_F(PerfTests, graph_optimization)
+{
+  // Odometry constraints between sequential scans, plus loop closures
+  // wherever the trajectory revisits a location
+  Eigen::Matrix3d covariance = Eigen::Matrix3d::Identity() * 0.01;
+  std::vector<ndt_2d::ConstraintPtr> constraints;
+  for (size_t i = 1; i < scans_.size(); ++i)
+  {
+    constraints.push_back(ndt_2d::makeConstraint(scans_[i - 1], scans_[i], covariance));
+    for (size_t j = 0; j + 20 < i; ++j)
+    {
+      double dx = scans_[i]->getPose().x - scans_[j]->getPose().x;
+      double dy = scans_[i]->getPose().y - scans_[j]->getPose().y;
+      if (std::hypot(dx, dy) < 0.3)
+      {
+        constraints.push_back(ndt_2d::makeConstraint(scans_[j], scans_[i], covariance));
+      }
+    }
+  }
+
+  // Drift the poses, as odometry would
+  std::vector<ndt_2d::Pose2d> drifted;
+  for (size_t i = 0; i < scans_.size(); ++i)
+  {
+    ndt_2d::Pose2d pose = scans_[i]->getPose();
+    pose.x += 0.002 * i;
+    pose.theta += 0.0005 * i;
+    drifted.push_back(pose);
+  }
+
+  // Optimization modifies poses, so work on copies
+  std::vector<ndt_2d::ScanPtr> scans;
+  for (auto & scan : scans_)
+  {
+    scans.push_back(std::make_shared<ndt_2d::Scan>(scan->getId()));
+  }
+
+  double throughput = measure([&]()
+    {
+      for (size_t i = 0; i < scans.size(); ++i)
+      {
+        scans[i]->setPose(drifted[i]);
+      }
+      ndt_2d::CeresSolver solver;
+      solver.optimize(constraints, scans);
+      return 1.0;
+    });
+  EXPECT_TRUE(environment->check("graph_optimization", "optimizations/s", throughput));
+}
+
+int main(int argc, char** argv)
+{
+  rclcpp::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+  environment = new PerfEnvironment();
+  testing::AddGlobalTestEnvironment(environment);
+  int result = RUN_ALL_TESTS();
+  rclcpp::shutdown();
+  return result;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef BENCHMARK__SYNTHETIC_WORLD_HPP_
+#define BENCHMARK__SYNTHETIC_WORLD_HPP_
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+#include <ndt_2d/point.hpp>
+#include <ndt_2d/pose_2d.hpp>
+#include <ndt_2d/scan.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief A simple 2d world made of line segments, used to generate
+ *        repeatable laser scans for benchmarks without recorded data.
+ */
+class SyntheticWorld
+{
+public:
+  /**
+   * @brief Create the default world: a 20x12 meter room with an inner
+   *        wall and several pillars, so that scans have structure.
+   */
+  SyntheticWorld()
+  {
+    // Outer walls
+    addBox(-10.0, -6.0, 10.0, 6.0);
+    // Inner wall with a doorway
+    addSegment(0.0, -6.0, 0.0, -1.0);
+    addSegment(0.0, 1.0, 0.0, 6.0);
+    // Pillars
+    addBox(-6.0, 2.0, -5.5, 2.5);
+    addBox(-4.0, -3.5, -3.0, -3.0);
+    addBox(4.0, 3.0, 4.5, 4.0);
+    addBox(6.0, -3.0, 7.0, -2.5);
+  }
+
+  /** @brief Add a wall segment. */
+  void addSegment(double x0, double y0, double x1, double y1)
+  {
+    segments_.push_back({x0, y0, x1, y1});
+  }
+
+  /** @brief Add an axis-aligned box. */
+  void addBox(double min_x, double min_y, double max_x, double max_y)
+  {
+    addSegment(min_x, min_y, max_x, min_y);
+    addSegment(max_x, min_y, max_x, max_y);
+    addSegment(max_x, max_y, min_x, max_y);
+    addSegment(min_x, max_y, min_x, min_y);
+  }
+
+  /**
+   * @brief Simulate a laser scan.
+   * @param pose The pose of the laser in the world.
+   * @param num_beams Number of beams, evenly spaced over 360 degrees.
+   * @param range_max Beams that do not hit within this range are dropped.
+   * @param noise Standard deviation of range noise, in meters.
+   * @param seed Seed for the noise, so scans are repeatable.
+   * @returns The points, in the laser frame.
+   */
+  std::vector<Point> simulate(const Pose2d & pose, size_t num_beams, double range_max,
+                              double noise = 0.0, unsigned seed = 0) const
+  {
+    std::mt19937 gen(seed);
+    std::normal_distribution<double> dist(0.0, noise > 0.0 ? noise : 1.0);
+
+    std::vector<Point> points;
+    points.reserve(num_beams);
+    for (size_t i = 0; i < num_beams; ++i)
+    {
+      double angle = -M_PI + (2.0 * M_PI * i) / num_beams;
+      double range = raycast(pose, pose.theta + angle);
+      if (noise > 0.0)
+      {
+        range += dist(gen);
+      }
+      if (range < range_max)
+      {
+        points.emplace_back(range * cos(angle), range * sin(angle));
+      }
+    }
+    return points;
+  }
+
+  /**
+   * @brief Create scans along a trajectory.
+   * @param poses Ground truth poses of the scans.
+   * @param num_beams Number of beams per scan.
+   * @param range_max Maximum range of the laser.
+   * @param noise Standard deviation of range noise, in meters.
+   * @returns Scans with ids matching the index into poses.
+   */
+  std::vector<ScanPtr> makeScans(const std::vector<Pose2d> & poses, size_t num_beams,
+                                 double range_max, double noise = 0.0) const
+  {
+    std::vector<ScanPtr> scans;
+    for (size_t i = 0; i < poses.size(); ++i)
+    {
+      ScanPtr scan = std::make_shared<Scan>(i);
+      scan->setPose(poses[i]);
+      scan->setPoints(simulate(poses[i], num_beams, range_max, noise, i));
+      scans.push_back(scan);
+    }
+    return scans;
+  }
+
+  /**
+   * @brief A loop around the left half of the room, through the
+   *        doorway, around the right half and back to the start.
+   * @param step Distance between poses, in meters.
+   */
+  static std::vector<Pose2d> makeTrajectory(double step)
+  {
+    const std::vector<Pose2d> waypoints =
+    {
+      Pose2d(-2.0, 0.0, 0.0), Pose2d(2.0, 0.0, 0.0), Pose2d(8.0, 0.0, 0.0),
+      Pose2d(8.0, 4.5, 0.0), Pose2d(2.0, 4.5, 0.0), Pose2d(2.0, 0.0, 0.0),
+      Pose2d(-2.0, 0.0, 0.0), Pose2d(-8.0, 0.0, 0.0), Pose2d(-8.0, -4.5, 0.0),
+      Pose2d(-2.0, -4.5, 0.0), Pose2d(-2.0, 0.0, 0.0)
+    };
+
+    std::vector<Pose2d> poses;
+    for (size_t i = 0; i + 1 < waypoints.size(); ++i)
+    {
+      double dx = waypoints[i + 1].x - waypoints[i].x;
+      double dy = waypoints[i + 1].y - waypoints[i].y;
+      double heading = atan2(dy, dx);
+      size_t steps = std::ceil(std::hypot(dx, dy) / step);
+      for (size_t j = 0; j < steps; ++j)
+      {
+        double t = static_cast<double>(j) / steps;
+        poses.emplace_back(waypoints[i].x + t * dx, waypoints[i].y + t * dy, heading);
+      }
+    }
+    poses.push_back(waypoints.back());
+    return poses;
+  }
+
+private:
+  struct Segment
+  {
+    double x0, y0, x1, y1;
+  };
+
+  // Distance along a ray to the nearest segment
+  double raycast(const Pose2d & pose, double angle) const
+  {
+    double dx = cos(angle);
+    double dy = sin(angle);
+    double best = std::numeric_limits<double>::max();
+    for (auto & s : segments_)
+    {
+      double sx = s.x1 - s.x0;
+      double sy = s.y1 - s.y0;
+      double denom = dx * sy - dy * sx;
+      if (std::fabs(denom) < 1e-12)
+      {
+        // Parallel
+        continue;
+      }
+      double ox = s.x0 - pose.x;
+      double oy = s.y0 - pose.y;
+      // Distance along ray, fraction along segment
+      double t = (ox * sy - oy * sx) / denom;
+      double u = (ox * dy - oy * dx) / denom;
+      if (t > 0.0 && u >= 0.0 && u <= 1.0 && t < best)
+      {
+        best = t;
+      }
+    }
+    return best;
+  }
+
+  std::vector<Segment> segments_;
+};
+
+}  // namespace ndt_2d
+
+#endif  // BENCHMARK__SYNTHETIC_WORLD_HPP_
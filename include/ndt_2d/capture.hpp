@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__CAPTURE_HPP_
+#define NDT_2D__CAPTURE_HPP_
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <ndt_2d/scan.hpp>
+#include <rclcpp/rclcpp.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * Capture files record the exact inputs and outputs of a ScanMatcher so that
+ * calls can be replayed offline. The file is a header followed by a series
+ * of records, all binary in the byte order of the host that wrote it. The
+ * version check rejects a capture from a host of the other byte order:
+ *
+ *  - SCAN: the points of a scan, under a key unique within the capture.
+ *    Written once per scan object, since scan points never change after
+ *    creation (but poses do, e.g. after optimization). Scan ids can not be
+ *    used as the key, since they repeat after a map is reloaded.
+ *  - ADD_SCANS: the keys, ids and poses of scans passed to addScans().
+ *  - RESET: a call to reset().
+ *  - MATCH: the query scan id, pose and points passed to matchScan(), along
+ *    with the returned score, correction, covariance and the time taken.
+ *    Points are always stored inline, as query scans often share an id.
+ */
+
+struct CaptureHeader
+{
+  // Plugin type, e.g. "ndt_2d::ScanMatcherNDT"
+  std::string type;
+  // Name the matcher was initialized with
+  std::string name;
+  double range_max;
+  // All parameters under the name namespace
+  std::vector<rclcpp::Parameter> parameters;
+};
+
+struct CaptureRecord
+{
+  enum Type : uint8_t
+  {
+    SCAN = 1,
+    ADD_SCANS = 2,
+    RESET = 3,
+    MATCH = 4
+  };
+  Type type;
+
+  // SCAN: key of the scan within the capture
+  size_t key;
+  // MATCH: id of the scan
+  size_t id;
+  // SCAN and MATCH: points of the scan
+  std::vector<Point> points;
+  // ADD_SCANS: keys, ids and poses of the scans
+  struct AddedScan
+  {
+    size_t key;
+    size_t id;
+    Pose2d pose;
+  };
+  std::vector<AddedScan> scans;
+  // MATCH: initial pose of the query scan
+  Pose2d pose;
+  // MATCH: results returned by the scan matcher
+  double score;
+  Pose2d correction;
+  Eigen::Matrix3d covariance;
+  uint64_t duration_ns;
+};
+
+class CaptureWriter
+{
+public:
+  /**
+   * @brief Open a capture file for writing.
+   * @param filename Full path to the capture file.
+   * @param header Header to write at the start of the file.
+   * @returns True if file was opened.
+   */
+  bool open(const std::string & filename, const CaptureHeader & header);
+
+  /**
+   * @brief Write the points of a scan, if not already written.
+   * @returns The key of the scan within the capture.
+   */
+  uint64_t writeScan(const ScanPtr & scan);
+
+  /** @brief Write an addScans() call, including any new scan points. */
+  void writeAddScans(const std::vector<ScanPtr>::const_iterator & begin,
+                     const std::vector<ScanPtr>::const_iterator & end);
+
+  /** @brief Write a reset() call. */
+  void writeReset();
+
+  /** @brief Write a matchScan() call, including the query scan points. */
+  void writeMatch(const ScanPtr & scan, double score, const Pose2d & correction,
+                  const Eigen::Matrix3d & covariance, uint64_t duration_ns);
+
+private:
+  template <typename T>
+  void writeValue(const T & value)
+  {
+    file_.write(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+  void writeString(const std::string & value);
+  void writePose(const Pose2d & pose);
+  void writePoints(const std::vector<Point> & points);
+
+  std::ofstream file_;
+  // Scans already written, the weak_ptr detects a new scan at the same address
+  struct WrittenScan
+  {
+    std::weak_ptr<Scan> scan;
+    uint64_t key;
+  };
+  std::unordered_map<const Scan *, WrittenScan> written_scans_;
+  // Scans that no longer exist are erased when written_scans_ reaches this size
+  size_t prune_size_ = 64;
+  uint64_t next_key_ = 0;
+};
+
+class CaptureReader
+{
+public:
+  /**
+   * @brief Open a capture file for reading.
+   * @param filename Full path to the capture file.
+   * @param header The header read from the file.
+   * @returns True if file was opened and the header is valid.
+   */
+  bool open(const std::string & filename, CaptureHeader & header);
+
+  /**
+   * @brief Read the next record.
+   * @returns False when there are no more records.
+   */
+  bool read(CaptureRecord & record);
+
+private:
+  template <typename T>
+  bool readValue(T & value)
+  {
+    return static_cast<bool>(file_.read(reinterpret_cast<char *>(&value), sizeof(T)));
+  }
+  bool readString(std::string & value);
+  bool readPose(Pose2d & pose);
+  bool readPoints(std::vector<Point> & points);
+
+  std::ifstream file_;
+};
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__CAPTURE_HPP_
@@ -54,6 +54,12 @@ public:
   bool optimize(const std::vector<ConstraintPtr> & constraints,
                 std::vector<ScanPtr> & scans);
 
+  /**
+   * @brief Get the approximate memory used by the problem, in bytes. This
+   *        counts node poses and cost functions, but not ceres internals.
+   */
+  size_t memoryUsage() const;
+
 private:
   ceres::ResidualBlockId addConstraint(const ConstraintPtr & constraint,
                                        std::vector<ScanPtr> & scans);
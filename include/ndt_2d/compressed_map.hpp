@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__COMPRESSED_MAP_HPP_
+#define NDT_2D__COMPRESSED_MAP_HPP_
+
+#include <string>
+#include <vector>
+#include <ndt_2d/constraint.hpp>
+#include <ndt_2d/scan.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * Compressed map files store the scans and constraints of a map as a series
+ * of independently zstd compressed chunks:
+ *
+ *  - Scan points are quantized to POINT_RESOLUTION and delta encoded as
+ *    variable length integers, as neighboring beams are close together.
+ *  - Scan poses and constraints are stored at full precision.
+ *
+ * Chunks are read one at a time, and decoded in parallel, so loading uses
+ * all cores while only a few chunks are held in memory at once.
+ */
+class CompressedMap
+{
+public:
+  /** @brief Maps with filenames ending in this extension are compressed */
+  static constexpr const char * EXTENSION = ".ndtz";
+
+  /** @brief Resolution that scan points are stored at, in meters */
+  static constexpr double POINT_RESOLUTION = 0.001;
+
+  /** @brief Number of scans per chunk */
+  static constexpr size_t CHUNK_SCANS = 256;
+
+  /** @brief Number of constraints per chunk, these are much smaller than scans */
+  static constexpr size_t CHUNK_CONSTRAINTS = 4096;
+
+  /** @brief Is this filename for a compressed map (rather than a bag). */
+  static bool isCompressedMap(const std::string & filename);
+
+  /**
+   * @brief Write scans and constraints to a compressed map file.
+   * @param filename Full path to the map file, which is only replaced once
+   *        the new file has been completely written.
+   * @returns True if the file was written.
+   */
+  static bool write(const std::string & filename, const std::vector<ScanPtr> & scans,
+                    const std::vector<ConstraintPtr> & constraints);
+
+  /**
+   * @brief Read scans and constraints from a compressed map file.
+   * @param filename Full path to the map file.
+   * @param scans Scans read from the file are appended.
+   * @param constraints Constraints read from the file are appended.
+   * @param threads Number of chunks to decode in parallel, or 0 to use
+   *        one per core.
+   * @returns True if the whole file was read, false if missing or corrupt.
+   */
+  static bool read(const std::string & filename, std::vector<ScanPtr> & scans,
+                   std::vector<ConstraintPtr> & constraints, size_t threads = 0);
+};
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__COMPRESSED_MAP_HPP_
@@ -36,12 +36,28 @@
 #include <nanoflann.hpp>
 #include <ndt_2d/constraint.hpp>
 #include <ndt_2d/ndt_model.hpp>
+#include <ndt_2d/scan_descriptor.hpp>
 #include <rclcpp/rclcpp.hpp>
 #include <visualization_msgs/msg/marker_array.hpp>
 
 namespace ndt_2d
 {
 
+class SharedMap;
+
+/**
+ * @brief A scan that looks similar to a query scan.
+ */
+struct SimilarScan
+{
+  // Index of the scan within Graph::scans
+  size_t index;
+  // Descriptor distance, 0.0 (identical) to 1.0
+  double distance;
+  // Estimated pose of the query scan, assuming it was taken near this scan
+  Pose2d pose;
+};
+
 class Graph
 {
 public:
@@ -53,12 +69,21 @@ public:
 
   /**
    * @brief Create a graph by loading from a file
-   * @param filename Full path to the map file
+   * @param filename Full path to the map file, either a bag or a
+   *        compressed map (ending in CompressedMap::EXTENSION)
    */
   Graph(bool use_barycenter, const std::string & filename);
 
+  /**
+   * @brief Create a graph from the scans and constraints of a shared map
+   * @param map Shared map, the points are copied so it need not be kept open
+   */
+  Graph(bool use_barycenter, const SharedMap & map);
+
   /**
    * @brief Save all scans and constraints to a file
+   * @param filename Full path to the map file, maps are compressed if this
+   *        ends in CompressedMap::EXTENSION
    */
   bool save(const std::string & filename);
 
@@ -72,9 +97,46 @@ public:
                                   int limit_scan_index = -1);
 
   /**
-   * @brief Get a visualization msg for the graph
+   * @brief Find the scans which look most like this scan, regardless of pose.
+   * @param scan The query scan, only the points are used.
+   * @param k Maximum number of scans to return.
+   * @param max_distance Only return scans with a descriptor distance below this.
+   * @param limit_scan_index Limit of scans to search.
+   * @returns Up to k scans, most similar first.
+   */
+  std::vector<SimilarScan> findSimilar(const ScanPtr & scan, size_t k,
+                                       double max_distance = 1.0,
+                                       int limit_scan_index = -1);
+
+  /**
+   * @brief Find how far back the trajectory leading to a scan stays within
+   *        a distance, measured along the trajectory.
+   * @param index Index of the scan within scans.
+   * @param distance Distance along the trajectory, in meters.
+   * @returns Index limit, scans before it are at least distance away along
+   *          the trajectory. Zero if no scans are that far away.
+   */
+  size_t findTravelLimit(size_t index, double distance) const;
+
+  /**
+   * @brief Set the max range of points used in scan descriptors.
+   *        Descriptors are recomputed if this changes.
    */
-  void getMsg(visualization_msgs::msg::MarkerArray & msg, rclcpp::Time & t);
+  void setDescriptorRange(double range);
+
+  /**
+   * @brief Update a visualization msg for the graph. Nodes are a single
+   *        SPHERE_LIST marker, edges are one LINE_LIST marker per type.
+   * @param msg Message to update in place, pass the same message on every
+   *        call so that buffers are reused.
+   * @returns True if any node or edge has changed since the last update.
+   */
+  bool getMsg(visualization_msgs::msg::MarkerArray & msg, rclcpp::Time & t);
+
+  /**
+   * @brief Get the approximate memory used by scans and constraints, in bytes.
+   */
+  size_t memoryUsage();
 
   // Vector of scans used to build the map
   std::vector<ScanPtr> scans;
@@ -115,6 +177,10 @@ private:
     nanoflann::L2_Simple_Adaptor<double, GraphAdapter>, GraphAdapter, 2>;
 
   bool use_barycenter_;
+
+  // Descriptor index, descriptors_[i] is for scans[i], computed on demand
+  std::vector<ScanDescriptorPtr> descriptors_;
+  double descriptor_range_;
 };
 
 using GraphPtr = std::shared_ptr<Graph>;
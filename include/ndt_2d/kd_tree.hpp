@@ -128,6 +128,12 @@ public:
     leaf_count_ = 0;
   }
 
+  size_t memoryUsage() const
+  {
+    return sizeof(KDTree<T>) + nodes_.capacity() * sizeof(NodePtr) +
+           nodes_.size() * sizeof(Node);
+  }
+
 private:
   void _insert(NodePtr &  parent, NodePtr & node, int key[], T value)
   {
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__LIKELIHOOD_FIELD_HPP_
+#define NDT_2D__LIKELIHOOD_FIELD_HPP_
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <ndt_2d/point.hpp>
+#include <ndt_2d/pose_2d.hpp>
+#include <ndt_2d/scan.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief Precomputed likelihood of a point given the distance to the
+ *        nearest map point, as in the likelihood field model of AMCL.
+ *
+ * The field is built once from the distance transform of the map points
+ * and stored as one byte per cell, so scoring is a table lookup per point.
+ * After build() the field is read only, and may be shared between threads.
+ */
+class LikelihoodField
+{
+public:
+  /**
+   * @brief Create an empty likelihood field.
+   * @param resolution Size of the cells, in meters.
+   * @param sigma Standard deviation of the point to map distance, in meters.
+   * @param z_rand Fraction of beams expected to be random measurements, this
+   *        is the minimum likelihood of any beam in score().
+   */
+  LikelihoodField(double resolution, double sigma, double z_rand);
+
+  /**
+   * @brief Build the field from the points of scans.
+   * @param begin Starting iterator of scans.
+   * @param end Ending iterator of scans.
+   */
+  void build(const std::vector<ScanPtr>::const_iterator & begin,
+             const std::vector<ScanPtr>::const_iterator & end);
+
+  /**
+   * @brief Get the likelihood of a point.
+   * @param point The point, in the map frame.
+   * @returns Likelihood in range 0 to 1, 0 if outside the field.
+   */
+  double likelihood(const Eigen::Vector2d & point) const;
+
+  /**
+   * @brief Get the mean likelihood of a set of points, where each point is
+   *        a mix of the field (z_hit) and a random measurement (z_rand).
+   * @param points Points to score, in the frame of the pose.
+   * @param pose The pose of the points within the map.
+   * @param max_points Maximum number of points to use, evenly subsampled.
+   */
+  double score(const std::vector<Point> & points, const Pose2d & pose,
+               size_t max_points) const;
+
+  /**
+   * @brief Get the approximate memory used by the field, in bytes.
+   */
+  size_t memoryUsage() const;
+
+private:
+  double resolution_;
+  double sigma_;
+  double z_rand_;
+
+  size_t size_x_, size_y_;
+  double origin_x_, origin_y_;
+  // Likelihood scaled to 0-255
+  std::vector<uint8_t> cells_;
+};
+
+typedef std::shared_ptr<LikelihoodField> LikelihoodFieldPtr;
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__LIKELIHOOD_FIELD_HPP_
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__LOAD_SHEDDER_HPP_
+#define NDT_2D__LOAD_SHEDDER_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief Overload controller for scan processing.
+ *
+ * Tracks the lag between when each scan was taken and when it is processed.
+ * While the lag is above the limit and not improving, the degradation level
+ * is raised one step per scan, shedding progressively more work. Once the
+ * lag is below half the limit for a number of consecutive scans, the level
+ * is lowered again one step at a time. A late pose is worse than a slightly
+ * less accurate one.
+ *
+ * update() must be called from a single thread, level() may be read from any.
+ */
+class LoadShedder
+{
+public:
+  enum Level : uint8_t
+  {
+    // Full processing
+    NOMINAL = 0,
+    // Loop closure is deferred until load drops
+    SKIP_LOOP_CLOSURE = 1,
+    // Scans are matched with half of their beams
+    REDUCED_BEAMS = 2,
+    // Scan matching is skipped, pose is propagated by odometry
+    ODOMETRY_ONLY = 3
+  };
+
+  /**
+   * @brief Create a load shedder.
+   * @param max_lag Lag above which processing is degraded, zero disables. Units: seconds.
+   * @param recovery_scans Number of scans with low lag before recovering a level.
+   */
+  LoadShedder(double max_lag, size_t recovery_scans);
+
+  /**
+   * @brief Update the controller with the lag of a new scan.
+   * @param lag Time since the scan was taken. Units: seconds.
+   * @returns The degradation level to process this scan with.
+   */
+  Level update(double lag);
+
+  /** @brief Get the current degradation level. */
+  Level level() const;
+
+  /** @brief Get the number of scans processed while degraded, and reset it. */
+  uint64_t takeDegradedScans();
+
+private:
+  double max_lag_;
+  size_t recovery_scans_;
+
+  // Lag when the level was last raised
+  double escalation_lag_;
+  // Consecutive scans with low lag
+  size_t good_scans_;
+
+  std::atomic<uint8_t> level_;
+  std::atomic<uint64_t> degraded_scans_;
+};
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__LOAD_SHEDDER_HPP_
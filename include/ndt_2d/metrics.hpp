@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__METRICS_HPP_
+#define NDT_2D__METRICS_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief Lock-free latency histogram.
+ *
+ * Durations are binned into log-linear buckets (four buckets per power of
+ * two), so quantiles are accurate to within 25%. Recording is wait-free and
+ * may be called from any number of threads. Reading quantiles while another
+ * thread records gives an approximate (but never invalid) answer.
+ */
+class LatencyHistogram
+{
+public:
+  LatencyHistogram();
+
+  /**
+   * @brief Record a duration.
+   * @param nanoseconds The duration to record, in nanoseconds.
+   */
+  void record(uint64_t nanoseconds);
+
+  /** @brief Get the number of durations recorded since last reset. */
+  uint64_t count() const;
+
+  /**
+   * @brief Estimate a quantile of the recorded durations.
+   * @param q The quantile to compute, in range 0.0 to 1.0.
+   * @returns The upper bound of the bucket containing the quantile, in seconds.
+   */
+  double quantile(double q) const;
+
+  /** @brief Get the largest duration recorded, in seconds. */
+  double max() const;
+
+  /** @brief Clear all recorded durations. */
+  void reset();
+
+private:
+  static size_t getBucket(uint64_t nanoseconds);
+  static uint64_t getBucketUpperBound(size_t bucket);
+
+  static constexpr size_t SUB_BUCKETS = 4;
+  static constexpr size_t NUM_BUCKETS = 64 * SUB_BUCKETS;
+
+  std::array<std::atomic<uint64_t>, NUM_BUCKETS> buckets_;
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> max_;
+};
+
+/**
+ * @brief Records the lifetime of this object into a histogram.
+ */
+class ScopedTimer
+{
+public:
+  explicit ScopedTimer(LatencyHistogram & histogram)
+  : histogram_(histogram),
+    start_(std::chrono::steady_clock::now())
+  {
+  }
+
+  ~ScopedTimer()
+  {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    histogram_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+private:
+  LatencyHistogram & histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace ndt_2d
+
+// Timers are compiled out entirely unless NDT_2D_ENABLE_METRICS is defined
+#define NDT_2D_CONCAT_(a, b) a ## b
+#define NDT_2D_CONCAT(a, b) NDT_2D_CONCAT_(a, b)
+#ifdef NDT_2D_ENABLE_METRICS
+#define NDT_2D_SCOPED_TIMER(histogram) \
+  ndt_2d::ScopedTimer NDT_2D_CONCAT(ndt_2d_scoped_timer_, __LINE__)(histogram)
+#else
+#define NDT_2D_SCOPED_TIMER(histogram)
+#endif
+
+#endif  // NDT_2D__METRICS_HPP_
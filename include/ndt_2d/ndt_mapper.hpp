@@ -32,18 +32,27 @@
 #include <tf2_ros/buffer.h>
 #include <tf2_ros/transform_listener.h>
 #include <tf2_ros/transform_broadcaster.h>
+#include <array>
+#include <condition_variable>
 #include <memory>
+#include <map>
 #include <mutex>
+#include <set>
 #include <string>
 #include <rclcpp/rclcpp.hpp>
 #include <geometry_msgs/msg/pose_with_covariance_stamped.hpp>
 #include <nav_msgs/msg/occupancy_grid.hpp>
 #include <ndt_2d/ceres_solver.hpp>
 #include <ndt_2d/graph.hpp>
+#include <ndt_2d/load_shedder.hpp>
+#include <ndt_2d/metrics.hpp>
 #include <ndt_2d/occupancy_grid.hpp>
 #include <ndt_2d/particle_filter.hpp>
 #include <ndt_2d/scan_matcher.hpp>
+#include <ndt_2d/msg/memory_usage.hpp>
+#include <ndt_2d/msg/metrics.hpp>
 #include <ndt_2d/srv/configure.hpp>
+#include <ndt_2d/srv/get_memory_usage.hpp>
 #include <pluginlib/class_loader.hpp>
 #include <sensor_msgs/msg/laser_scan.hpp>
 #include <visualization_msgs/msg/marker_array.hpp>
@@ -65,8 +74,80 @@ protected:
   /** @brief ROS callback for initializing localization */
   void poseCallback(const geometry_msgs::msg::PoseWithCovarianceStamped::ConstSharedPtr& msg);
 
-  /** @brief ROS callback for new laser scan */
-  void laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& msg);
+  /**
+   * @brief ROS callback for new laser scan
+   * @note Takes ownership so that intra-process scans are delivered without a copy
+   */
+  void laserCallback(sensor_msgs::msg::LaserScan::UniquePtr msg);
+
+  /** @brief Process a scan of the first laser, scan_mutex_ must be held */
+  void handleScan(sensor_msgs::msg::LaserScan::UniquePtr msg);
+
+  /** @brief ROS callback for parameter changes, which are applied by laserCallback() */
+  rcl_interfaces::msg::SetParametersResult parametersCallback(
+    const std::vector<rclcpp::Parameter> & parameters);
+
+  /**
+   * @brief Apply parameter changes, rebuilding only what they affect. Whole
+   *        map models are rebuilt by rebuildThread(), and swapped in here
+   *        once ready.
+   */
+  void applyParameterChanges();
+
+  /**
+   * @brief Write the graph and global NDT to shared_map_file_, if set and
+   *        not attached to it
+   */
+  void writeSharedMap();
+
+  /** @brief Load and initialize a scan matcher plugin */
+  ScanMatcherPtr createScanMatcher(const std::string & name);
+
+  /**
+   * @brief Declare wide search window defaults for a scan matcher, for
+   *        verifying candidate poses that may be tenths of a meter off.
+   */
+  void declareWideSearchWindow(const std::string & name);
+
+  // A laser scanner, and the data needed to convert its scans
+  struct Laser
+  {
+    // Frame of the laser, empty until the transform has been found
+    std::string frame;
+    // Transform from robot_frame_->frame
+    Pose2d transform;
+    bool inverted = false;
+    // Beam directions in the robot frame, rebuilt if the scan geometry changes
+    double angle_min = 0.0, angle_increment = 0.0;
+    std::vector<double> cos_lut, sin_lut;
+    // Most recent scan, waiting to be merged into a scan of the first laser
+    sensor_msgs::msg::LaserScan::UniquePtr latest;
+    // Stamp of the most recent scan and time between scans, in seconds
+    double last_stamp = 0.0, period = 0.0;
+    rclcpp::Subscription<sensor_msgs::msg::LaserScan>::SharedPtr sub;
+  };
+
+  /** @brief ROS callback for new laser scan from any laser other than the first */
+  void secondaryLaserCallback(sensor_msgs::msg::LaserScan::UniquePtr msg, size_t index);
+
+  /** @brief Find the transform to the laser, if not already known */
+  bool initializeLaser(Laser & laser, const sensor_msgs::msg::LaserScan & msg);
+
+  /** @brief Convert ROS laser scan into points in the robot frame */
+  void convertScan(Laser & laser, const sensor_msgs::msg::LaserScan & msg,
+                   std::vector<Point> & points);
+
+  /**
+   * @brief Whether a scan of another laser that could be merged into this
+   *        scan of the first laser is expected, but has not yet arrived.
+   */
+  bool waitingForLasers(const sensor_msgs::msg::LaserScan & msg) const;
+
+  /**
+   * @brief Convert a scan of the first laser into points in the robot frame,
+   *        merging in the most recent scans of the other lasers.
+   */
+  void getScanPoints(const sensor_msgs::msg::LaserScan & msg, std::vector<Point> & points);
 
   // Thread for doing global loop closure
   void loopClosureThread();
@@ -78,15 +159,35 @@ protected:
   bool map_update_available_;
   std::unique_ptr<std::thread> map_publish_thread_;
 
+  // Thread for relocalizing when lost, or not yet localized
+  void relocalizationThread();
+  std::unique_ptr<std::thread> relocalization_thread_;
+
+  // Thread for rebuilding whole map models after a parameter change
+  void rebuildThread();
+  std::unique_ptr<std::thread> rebuild_thread_;
+
+  /** @brief Request relocalization using this scan, if not already in progress */
+  void requestRelocalization(const ScanPtr & scan, const Pose2d & odom_pose);
+
+  /** @brief Track how well localized scans match the map, relocalize if lost */
+  void checkLocalization(const ScanPtr & scan, double score, const Pose2d & odom_pose);
+
   // Mapping parameters
   double map_resolution_;
   double minimum_travel_distance_, minimum_travel_rotation_;
   size_t rolling_depth_;
-  std::string odom_frame_, robot_frame_, laser_frame_;
-  bool laser_inverted_;
+  // Scans less novel than this are used for tracking, but not added to the graph
+  double keyframe_min_novelty_;
+  std::string odom_frame_, robot_frame_;
   bool use_barycenter_;
   double global_search_size_;
   size_t global_search_limit_;
+  // Find loop closure candidates by appearance, rather than distance
+  bool appearance_search_;
+  // Appearance candidates must be at least this far back along the trajectory
+  double appearance_min_travel_;
+  double descriptor_range_, descriptor_threshold_;
   // How many nodes need to be added between optimization
   size_t optimization_node_limit_, optimization_last_;
   double transform_timeout_;
@@ -96,24 +197,49 @@ protected:
   bool use_particle_filter_;
   double kld_err_, kld_z_;
   std::shared_ptr<ParticleFilter> filter_;
+  // When set, the filter is weighted by this rather than the global scan matcher
+  LikelihoodFieldPtr likelihood_field_;
+  size_t likelihood_field_max_beams_;
 
   // Scan matchers
   // Used for loop closure when mapping, and localization
   ScanMatcherPtr global_scan_matcher_;
   // Used for odometric correction when mapping
   ScanMatcherPtr local_scan_matcher_;
+  // Wide window matcher used to verify appearance based loop closures
+  ScanMatcherPtr appearance_scan_matcher_;
+  // Wide window matcher used to verify relocalization candidates
+  ScanMatcherPtr relocalization_scan_matcher_;
   pluginlib::ClassLoader<ScanMatcher> scan_matcher_loader_;
+  // Held while loading plugins, which happens in the laser and parameter callbacks
+  std::mutex scan_matcher_loader_mutex_;
   std::string scan_matcher_type_;
+  // If set, scan matcher calls are captured to files with this prefix
+  std::string capture_prefix_;
+  // Number of captures started for each scan matcher name
+  std::map<std::string, size_t> capture_count_;
   double typical_matcher_response_;
 
   // ROS 2 interfaces
   rclcpp::Logger logger_;
+  // Laser and initial pose callbacks, along with memory reporting
+  rclcpp::CallbackGroup::SharedPtr scan_callback_group_;
+  // Configure service, which may block for a long time loading or saving maps
+  rclcpp::CallbackGroup::SharedPtr service_callback_group_;
+  // Held by the scan callbacks, and by configure while applying changes
+  std::mutex scan_mutex_;
   rclcpp::Publisher<nav_msgs::msg::OccupancyGrid>::SharedPtr map_pub_;
   rclcpp::Publisher<visualization_msgs::msg::MarkerArray>::SharedPtr graph_pub_;
+  // Last graph published, updated in place and published without a copy,
+  // only accessed by the map publish thread
+  visualization_msgs::msg::MarkerArray graph_msg_;
   rclcpp::Publisher<geometry_msgs::msg::PoseArray>::SharedPtr particle_pub_;
-  rclcpp::Subscription<sensor_msgs::msg::LaserScan>::SharedPtr laser_sub_;
   rclcpp::Subscription<geometry_msgs::msg::PoseWithCovarianceStamped>::SharedPtr pose_sub_;
   rclcpp::Service<ndt_2d::srv::Configure>::SharedPtr configure_srv_;
+  OnSetParametersCallbackHandle::SharedPtr parameters_callback_;
+  // Names of parameters changed at runtime, waiting to be applied
+  std::set<std::string> changed_parameters_;
+  std::mutex parameters_mutex_;
   std::shared_ptr<tf2_ros::Buffer> tf2_buffer_;
   std::shared_ptr<tf2_ros::TransformListener> tf2_listener_;
   std::shared_ptr<tf2_ros::TransformBroadcaster> tf2_broadcaster_;
@@ -128,14 +254,108 @@ protected:
   bool prev_odom_pose_is_initialized_;
   // The previous map->robot_frame_
   Pose2d prev_robot_pose_;
-  // Transform from robot_frame_->laser_frame_
-  Pose2d laser_transform_;
+
+  // Lasers, scans of the first one trigger processing
+  std::vector<Laser> lasers_;
+  // Scans of other lasers further than this in time from the first are not merged
+  double scan_sync_tolerance_;
+  // Scan of the first laser held until the other lasers catch up
+  sensor_msgs::msg::LaserScan::UniquePtr pending_scan_;
+  // Points of later lasers in a voxel of this size already holding points of
+  // an earlier laser are not merged
+  double scan_voxel_size_;
+  // Correct for robot motion during each scan, using odometry
+  bool deskew_;
+
+  // Relocalization parameters
+  bool relocalization_enabled_;
+  size_t relocalization_candidates_;
+  size_t relocalization_lost_scans_;
+  double relocalization_timeout_;
+  double relocalization_score_threshold_;
+  // Number of consecutive scans that scored worse than threshold
+  size_t lost_scans_;
+
+  // Relocalization state, protected by relocalization_mutex_
+  std::mutex relocalization_mutex_;
+  std::condition_variable relocalization_cv_;
+  // Scan (and odom pose at time of scan) waiting to be relocalized
+  ScanPtr relocalization_request_;
+  Pose2d relocalization_request_odom_;
+  bool relocalization_in_progress_;
+  // Result waiting to be applied by laserCallback()
+  bool relocalization_result_available_;
+  Pose2d relocalization_result_pose_, relocalization_result_odom_;
+  // Graph that the relocalization scan matcher was built from
+  GraphPtr relocalization_graph_;
+  // Graph that the global scan matcher was built from, when localizing
+  GraphPtr global_scan_matcher_graph_;
+
+  // Rebuild state, protected by rebuild_mutex_
+  std::mutex rebuild_mutex_;
+  std::condition_variable rebuild_cv_;
+  // Empty models waiting to be built from the graph
+  ScanMatcherPtr rebuild_matcher_request_;
+  LikelihoodFieldPtr rebuild_field_request_;
+  // Built models waiting to be swapped in by laserCallback()
+  ScanMatcherPtr rebuild_matcher_result_;
+  GraphPtr rebuild_matcher_graph_;
+  LikelihoodFieldPtr rebuild_field_result_;
 
   // Graph optimization
   std::shared_ptr<CeresSolver> solver_;
 
   // Map export
   OccupancyGridPtr grid_;
+  // If set, the map is written here for other processes to attach to
+  std::string shared_map_file_;
+  // Map was attached from shared_map_file_, written by another mapper
+  bool shared_map_attached_;
+  // Global NDT of the attached map, until the global scan matcher takes it
+  ScanMatcherModelPtr shared_map_model_;
+
+  // Latency metrics for each processing stage
+  enum Stage
+  {
+    TF_LOOKUP = 0,
+    SCAN_CONVERSION,
+    NDT_BUILD,
+    SCAN_MATCHING,
+    FILTER_UPDATE,
+    FILTER_MEASURE,
+    FILTER_RESAMPLE,
+    LOOP_CLOSURE_MATCHING,
+    OPTIMIZATION,
+    RENDERING,
+    RELOCALIZATION,
+    NUM_STAGES
+  };
+  std::array<LatencyHistogram, NUM_STAGES> latency_;
+  double metrics_publish_period_;
+  rclcpp::Publisher<ndt_2d::msg::Metrics>::SharedPtr metrics_pub_;
+
+  // Degrades scan processing when it falls behind the incoming scans
+  std::unique_ptr<LoadShedder> load_shedder_;
+
+  /** @brief Publish latency metrics, resets the histograms */
+  void publishMetrics();
+
+  // Memory accounting
+  size_t memory_budget_;
+  rclcpp::Publisher<ndt_2d::msg::MemoryUsage>::SharedPtr memory_pub_;
+  rclcpp::Service<ndt_2d::srv::GetMemoryUsage>::SharedPtr memory_srv_;
+  rclcpp::TimerBase::SharedPtr memory_timer_;
+
+  /** @brief Get the memory used by each component */
+  void getMemoryUsage(ndt_2d::msg::MemoryUsage & msg);
+
+  /** @brief Timer callback to publish memory usage */
+  void publishMemoryUsage();
+
+  /** @brief ROS callback for memory usage service */
+  void getMemoryUsageCallback(
+    const std::shared_ptr<ndt_2d::srv::GetMemoryUsage::Request> request,
+    std::shared_ptr<ndt_2d::srv::GetMemoryUsage::Response> response);
 };
 
 }  // namespace ndt_2d
@@ -51,7 +51,7 @@ struct Cell
   void compute();
 
   /** @brief Score a point */
-  double score(const Eigen::Vector2d & p);
+  double score(const Eigen::Vector2d & p) const;
 
   // Are mean/cov valid;
   bool valid;
@@ -64,6 +64,10 @@ struct Cell
   Eigen::Matrix2d information;
 };
 
+/**
+ * @brief Grid of Gaussian cells. Once compute() has been called, the const
+ *        queries may be called concurrently from any number of threads.
+ */
 class NDT
 {
 public:
@@ -77,8 +81,26 @@ public:
    */
   NDT(double cell_size, double size_x, double size_y, double origin_x, double origin_y);
 
+  /**
+   * @brief Create a read-only view of NDT cells stored elsewhere, such as
+   *        in a SharedMap. Scans cannot be added to a view.
+   * @param cell_size Size of NDT cells in meters.
+   * @param size_x Number of cells in X direction.
+   * @param size_y Number of cells in Y direction.
+   * @param origin_x Coordinate of lower left corner in meters.
+   * @param origin_y Coordinate of lower left corner in meters.
+   * @param cells The size_x * size_y cells, already computed.
+   * @param storage Keeps the cells valid for the lifetime of the view.
+   */
+  NDT(double cell_size, size_t size_x, size_t size_y, double origin_x, double origin_y,
+      const Cell * cells, const std::shared_ptr<const void> & storage);
+
   virtual ~NDT();
 
+  // Not copyable, cell_data_ may point into cells_
+  NDT(const NDT &) = delete;
+  NDT & operator=(const NDT &) = delete;
+
   /**
    * @brief Add a scan to the NDT.
    * @param scan The points from laser scanner to be added.
@@ -96,41 +118,81 @@ public:
    * @param point The point to score.
    * @returns The probability of the point.
    */
-  double likelihood(const Eigen::Vector2d & point);
+  double likelihood(const Eigen::Vector2d & point) const;
 
   /**
    * @brief Query the NDT for a given point.
    * @param point The point to score.
    * @returns The probability of the point.
    */
-  double likelihood(const Eigen::Vector3d & point);
+  double likelihood(const Eigen::Vector3d & point) const;
 
   /**
    * @brief Query the NDT.
    * @param points The vector of points to score.
    * @returns The probability of the points.
    */
-  double likelihood(const std::vector<Point> & points);
+  double likelihood(const std::vector<Point> & points) const;
 
   /**
    * @brief Query the NDT.
    * @param scan The scan to score. Note that scan->pose WILL be used.
    * @returns The probability of the scan.
    */
-  double likelihood(const ScanPtr & scan);
+  double likelihood(const ScanPtr & scan) const;
+
+  /**
+   * @brief Query the NDT for points given as separate x and y arrays, after
+   *        shifting them by (dx, dy). This is the inner loop of scan matching.
+   * @param x The x coordinates of the points.
+   * @param y The y coordinates of the points.
+   * @param size Number of points.
+   * @param dx Shift to apply in the x direction.
+   * @param dy Shift to apply in the y direction.
+   * @returns The probability of the points.
+   */
+  double likelihood(const double * x, const double * y, size_t size,
+                    double dx, double dy) const;
+
+  /**
+   * @brief Get the cell containing a point.
+   * @param point The point, in meters.
+   * @returns The cell, or nullptr if the point is outside the NDT.
+   */
+  const Cell * getCell(const Eigen::Vector2d & point) const;
+
+  /**
+   * @brief Get all cells of the NDT, including those without points.
+   * @returns Pointer to getNumCells() cells, in row major order.
+   */
+  const Cell * getCells() const;
+
+  /** @brief Get the number of cells in the NDT. */
+  size_t getNumCells() const;
+
+  /**
+   * @brief Get the approximate memory used by the NDT, in bytes. The cells
+   *        of a view are not counted, they belong to the storage.
+   */
+  size_t memoryUsage() const;
 
 private:
+  friend class SharedMap;
+
   /**
    * @brief Get the index of a cell within cells_
    * @param x The x coordinate (in meters).
    * @param y The y coordinate (in meters).
    */
-  int getIndex(double x, double y);
+  int getIndex(double x, double y) const;
 
   double cell_size_;
   size_t size_x_, size_y_;
   double origin_x_, origin_y_;
   std::vector<Cell> cells_;
+  // Points to cells_, or to the storage of a view
+  const Cell * cell_data_;
+  std::shared_ptr<const void> storage_;
 };
 
 }  // namespace ndt_2d
@@ -55,6 +55,13 @@ public:
   void getMsg(std::vector<ndt_2d::ScanPtr> & scans,
               nav_msgs::msg::OccupancyGrid & grid);
 
+  /**
+   * @brief Get the approximate memory used, in bytes. Working arrays are
+   *        allocated during each render, the size of the most recent
+   *        render is reported.
+   */
+  size_t memoryUsage() const;
+
 private:
   void updateBounds(std::vector<ndt_2d::ScanPtr>& scans);
 
@@ -63,6 +70,8 @@ private:
   // Bounds are recalculated when scan vector increases in size
   double min_x_, max_x_, min_y_, max_y_;
   size_t num_scans_;
+  // Number of cells in most recent render
+  size_t num_cells_;
 };
 
 typedef std::shared_ptr<OccupancyGrid> OccupancyGridPtr;
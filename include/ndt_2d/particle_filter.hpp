@@ -34,6 +34,7 @@
 #include <vector>
 #include <geometry_msgs/msg/pose_array.hpp>
 #include <ndt_2d/kd_tree.hpp>
+#include <ndt_2d/likelihood_field.hpp>
 #include <ndt_2d/motion_model.hpp>
 #include <ndt_2d/ndt_model.hpp>
 #include <ndt_2d/scan_matcher.hpp>
@@ -50,6 +51,19 @@ public:
   ParticleFilter(size_t min_particles, size_t max_particles,
                  MotionModelPtr & motion_model);
 
+  /**
+   * @brief Replace the motion model used for control updates.
+   * @param motion_model The new motion model.
+   */
+  void setMotionModel(MotionModelPtr & motion_model);
+
+  /**
+   * @brief Change the number of particles, takes effect at next resample.
+   * @param min_particles Minimum number of particles.
+   * @param max_particles Maximum number of particles.
+   */
+  void setParticleLimits(size_t min_particles, size_t max_particles);
+
   /**
    * @brief Initialize the particle filter to a pose with given variances.
    * @param x Mean of samples in X direction.
@@ -77,6 +91,14 @@ public:
    */
   void measure(const ScanMatcherPtr & matcher, const ScanPtr & scan);
 
+  /**
+   * @brief Apply a measurement update using a likelihood field.
+   * @param field Likelihood field of the map.
+   * @param scan The current scan data.
+   * @param max_beams Maximum number of beams to use per particle.
+   */
+  void measure(const LikelihoodField & field, const ScanPtr & scan, size_t max_beams);
+
   /**
    * @brief Resample particles, according to the current weights.
    * @param kld_err Maximum error between true distribution and estimated distribution.
@@ -93,6 +115,9 @@ public:
   /** @brief Get a visualization message of the particle poses. */
   void getMsg(geometry_msgs::msg::PoseArray & msg);
 
+  /** @brief Get the approximate memory used by the filter, in bytes. */
+  size_t memoryUsage() const;
+
 private:
   // Internal helper: normalize weights, compute mean and covariance
   void updateStatistics();
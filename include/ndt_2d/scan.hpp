@@ -77,6 +77,11 @@ public:
    */
   std::vector<Point> getPoints();
 
+  /**
+   * @brief Get the approximate memory used by this scan, in bytes.
+   */
+  size_t memoryUsage();
+
 private:
   void update();
 
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__SCAN_DESCRIPTOR_HPP_
+#define NDT_2D__SCAN_DESCRIPTOR_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <ndt_2d/point.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief Compact appearance descriptor of a scan, for place recognition.
+ *
+ * Points are binned into a polar grid of rings (range) and sectors (bearing),
+ * following Scan Context [5]. Each cell is occupied or not. The ring key is
+ * the fraction of occupied sectors in each ring, which does not change
+ * when the robot rotates, so it can be compared cheaply to find candidates.
+ * Candidates are then compared with the full grid, searching over sector
+ * shifts, which also gives the relative heading between the scans.
+ */
+class ScanDescriptor
+{
+public:
+  /**
+   * @brief Compute the descriptor of a scan.
+   * @param points The points of the scan, in the robot frame.
+   * @param max_range Points further than this are ignored, in meters.
+   * @param num_rings Number of range bins.
+   * @param num_sectors Number of bearing bins.
+   */
+  ScanDescriptor(const std::vector<Point> & points, double max_range,
+                 size_t num_rings = 20, size_t num_sectors = 90);
+
+  /** @brief Get the rotation invariant ring key. */
+  const std::vector<float> & getRingKey() const;
+
+  /**
+   * @brief Distance between ring keys, cheap to compute but not as
+   *        discriminative as distance().
+   */
+  double ringKeyDistance(const ScanDescriptor & other) const;
+
+  /**
+   * @brief Distance between two descriptors, searching over all rotations.
+   * @param other The descriptor to compare against.
+   * @param yaw The heading of this scan relative to the other.
+   * @returns Distance from 0.0 (identical) to 1.0 (nothing in common).
+   */
+  double distance(const ScanDescriptor & other, double & yaw) const;
+
+  /** @brief Get the approximate memory used by this descriptor, in bytes. */
+  size_t memoryUsage() const;
+
+private:
+  size_t num_rings_, num_sectors_;
+  // Fraction of occupied sectors, for each ring
+  std::vector<float> ring_key_;
+  // Occupancy of each cell, stored by sector then ring
+  std::vector<uint8_t> cells_;
+  // Number of occupied cells in each sector
+  std::vector<uint16_t> sector_counts_;
+};
+
+using ScanDescriptorPtr = std::shared_ptr<ScanDescriptor>;
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__SCAN_DESCRIPTOR_HPP_
@@ -30,6 +30,7 @@
 #define NDT_2D__SCAN_MATCHER_HPP_
 
 #include <Eigen/Core>
+#include <chrono>
 #include <memory>
 #include <string>
 #include <vector>
@@ -39,6 +40,30 @@
 namespace ndt_2d
 {
 
+/**
+ * @brief Model built by ScanMatcher::addScans(). Models are never modified
+ *        once built, so may be shared by any number of instances and threads.
+ */
+class ScanMatcherModel
+{
+public:
+  virtual ~ScanMatcherModel() = default;
+
+  /**
+   * @brief Get the approximate memory used by the model, in bytes.
+   */
+  virtual size_t memoryUsage() const = 0;
+};
+
+using ScanMatcherModelPtr = std::shared_ptr<const ScanMatcherModel>;
+
+/**
+ * The const methods (matchScan, scoreScan, scorePoints and novelty) may be
+ * called concurrently from any number of threads, including on instances
+ * that share a model. addScans(), reset() and setModel() replace the model
+ * of an instance, so must not run concurrently with calls on that instance,
+ * but do not affect other instances that share the previous model.
+ */
 class ScanMatcher
 {
 public:
@@ -71,6 +96,23 @@ public:
   virtual double matchScan(const ScanPtr & scan, Pose2d & pose,
                            Eigen::Matrix3d & covariance) const = 0;
 
+  /**
+   * @brief Match a scan against the internal map, giving up at a deadline.
+   * @param scan Scan to match against internal map.
+   * @param pose The corrected pose that best matches scan to map.
+   * @param covariance Covariance matrix for the match.
+   * @param deadline The search is checked against this periodically, and
+   *        abandoned once it has passed.
+   * @returns The score when scan is at corrected pose, NaN if abandoned.
+   *          The default implementation ignores the deadline.
+   */
+  virtual double matchScan(const ScanPtr & scan, Pose2d & pose,
+                           Eigen::Matrix3d & covariance,
+                           const std::chrono::steady_clock::time_point & /*deadline*/) const
+  {
+    return matchScan(scan, pose, covariance);
+  }
+
   /**
    * @brief Score a scan against the internal map.
    * @param scan Scan to score against internal map.
@@ -84,10 +126,94 @@ public:
    */
   virtual double scorePoints(const std::vector<Point> & points, const Pose2d & pose) const = 0;
 
+  /**
+   * @brief Score a set of points against the internal map, at many poses.
+   * @param points Points to score against internal map.
+   * @param poses The poses of the points within the internal map.
+   * @param scores The score at each pose, resized to match poses. The
+   *        default implementation calls scorePoints() for each pose.
+   */
+  virtual void scorePoints(const std::vector<Point> & points, const std::vector<Pose2d> & poses,
+                           std::vector<double> & scores) const
+  {
+    scores.resize(poses.size());
+    for (size_t i = 0; i < poses.size(); ++i)
+    {
+      scores[i] = scorePoints(points, poses[i]);
+    }
+  }
+
+  /**
+   * @brief Get how much of a scan is not explained by the internal map.
+   * @param scan Scan to check, at its current pose.
+   * @returns Novelty from 0.0 (fully explained) to 1.0. The default
+   *          implementation cannot tell, and treats every scan as novel.
+   */
+  virtual double novelty(const ScanPtr & /*scan*/) const
+  {
+    return 1.0;
+  }
+
   /**
    * @brief Reset the internal map, removing all scans.
    */
   virtual void reset() = 0;
+
+  /**
+   * @brief Get the approximate memory used by the internal map, in bytes.
+   */
+  virtual size_t memoryUsage() const
+  {
+    return 0;
+  }
+
+  /**
+   * @brief Get the model built by addScans(), to share with other instances.
+   * @returns The model, or nullptr if there is no model or the scan matcher
+   *          does not support sharing.
+   */
+  virtual ScanMatcherModelPtr getModel() const
+  {
+    return nullptr;
+  }
+
+  /**
+   * @brief Use a shared model rather than building one with addScans().
+   * @param model Model from getModel() of an instance of the same type. The
+   *        model was built with the parameters of that instance (e.g. the
+   *        resolution), matching uses the parameters of this instance.
+   * @returns False if the model is not supported, the instance is unchanged.
+   */
+  virtual bool setModel(const ScanMatcherModelPtr & /*model*/)
+  {
+    return false;
+  }
+
+  /**
+   * @brief Create a new instance with the same parameters, sharing the model.
+   *        This is much cheaper than initializing and adding scans.
+   * @returns The new instance, or nullptr if not supported.
+   */
+  virtual std::shared_ptr<ScanMatcher> clone() const
+  {
+    return nullptr;
+  }
+
+protected:
+  /**
+   * @brief Declare a parameter, or get the current value if already declared.
+   *        Allows initialize() to be called again after parameters change.
+   */
+  template <typename T>
+  static T declareParameter(rclcpp::Node * node, const std::string & name,
+                            const T & default_value)
+  {
+    if (node->has_parameter(name))
+    {
+      return node->get_parameter(name).get_value<T>();
+    }
+    return node->declare_parameter<T>(name, default_value);
+  }
 };
 
 using ScanMatcherPtr = std::shared_ptr<ScanMatcher>;
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__SCAN_MATCHER_CAPTURE_HPP_
+#define NDT_2D__SCAN_MATCHER_CAPTURE_HPP_
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <ndt_2d/capture.hpp>
+#include <ndt_2d/scan_matcher.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief Wraps another scan matcher, recording the inputs and outputs of
+ *        addScans(), reset() and matchScan() to a capture file. Calls to
+ *        scoreScan(), scorePoints(), novelty() and getModel() are forwarded
+ *        but not recorded. setModel() and clone() are not supported, since
+ *        the model would not be recorded.
+ */
+class ScanMatcherCapture : public ScanMatcher
+{
+public:
+  /**
+   * @brief Create a capturing scan matcher.
+   * @param matcher The scan matcher to wrap.
+   * @param type The plugin type of matcher, stored in the capture.
+   * @param filename Full path to the capture file to write.
+   */
+  ScanMatcherCapture(const ScanMatcherPtr & matcher, const std::string & type,
+                     const std::string & filename);
+  virtual ~ScanMatcherCapture() = default;
+
+  void initialize(const std::string & name,
+                  rclcpp::Node * node, double range_max);
+
+  void addScans(const std::vector<ScanPtr>::const_iterator & begin,
+                const std::vector<ScanPtr>::const_iterator & end);
+
+  double matchScan(const ScanPtr & scan, Pose2d & pose,
+                   Eigen::Matrix3d & covariance) const;
+
+  double matchScan(const ScanPtr & scan, Pose2d & pose, Eigen::Matrix3d & covariance,
+                   const std::chrono::steady_clock::time_point & deadline) const;
+
+  double scoreScan(const ScanPtr & scan) const;
+
+  double scorePoints(const std::vector<Point> & points, const Pose2d & pose) const;
+
+  void scorePoints(const std::vector<Point> & points, const std::vector<Pose2d> & poses,
+                   std::vector<double> & scores) const;
+
+  double novelty(const ScanPtr & scan) const;
+
+  void reset();
+
+  size_t memoryUsage() const;
+
+  ScanMatcherModelPtr getModel() const;
+
+private:
+  ScanMatcherPtr matcher_;
+  std::string type_, filename_;
+
+  // matchScan() is const, but still needs to write to the capture
+  mutable CaptureWriter writer_;
+  mutable std::mutex writer_mutex_;
+};
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__SCAN_MATCHER_CAPTURE_HPP_
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__SCAN_MATCHER_ICP_HPP_
+#define NDT_2D__SCAN_MATCHER_ICP_HPP_
+
+#include <Eigen/Core>
+#include <memory>
+#include <string>
+#include <vector>
+#include <nanoflann.hpp>
+#include <rclcpp/rclcpp.hpp>
+#include <ndt_2d/scan_matcher.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief Point-to-line ICP scan matcher.
+ *
+ * The map is the points of all added scans, stored in flat arrays along
+ * with a line normal for each point (from the principal axis of its
+ * neighbors) and indexed by a kd-tree, all built once in addScans().
+ * Matching is Gauss-Newton on the point-to-line distances, so it is fast
+ * but only converges for small corrections, such as local tracking.
+ */
+class ScanMatcherICP : public ScanMatcher
+{
+public:
+  virtual ~ScanMatcherICP() = default;
+
+  /**
+   * @brief Initialize an ICP scan matcher instance.
+   * @param name Name for ths scan matcher instance.
+   * @param node Node instance to use for getting parameters.
+   * @param range_max Maximum range of laser scanner.
+   */
+  void initialize(const std::string & name,
+                  rclcpp::Node * node, double range_max);
+
+  /**
+   * @brief Add scans to the internal map, building the kd-tree and normals.
+   * @param begin Starting iterator of scans for map building.
+   * @param end Ending iterator of scans for map building.
+   */
+  void addScans(const std::vector<ScanPtr>::const_iterator & begin,
+                const std::vector<ScanPtr>::const_iterator & end);
+
+  /**
+   * @brief Match a scan against the internal map.
+   * @param scan Scan to match against internal map.
+   * @param pose The corrected pose that best matches scan to map.
+   * @param covariance Covariance matrix for the match, from the Hessian.
+   * @returns The score when scan is at corrected pose.
+   */
+  double matchScan(const ScanPtr & scan, Pose2d & pose,
+                   Eigen::Matrix3d & covariance) const;
+
+  /**
+   * @brief Match a scan against the internal map, giving up at a deadline.
+   * @returns The score when scan is at corrected pose, NaN if abandoned.
+   */
+  double matchScan(const ScanPtr & scan, Pose2d & pose, Eigen::Matrix3d & covariance,
+                   const std::chrono::steady_clock::time_point & deadline) const;
+
+  /**
+   * @brief Score a scan against the internal map.
+   * @param scan Scan to score against internal map.
+   */
+  double scoreScan(const ScanPtr & scan) const;
+
+  /**
+   * @brief Score a set of points against the internal map.
+   * @param points Points to score against internal map.
+   * @param pose The pose of the points within the internal map.
+   */
+  double scorePoints(const std::vector<Point> & points, const Pose2d & pose) const;
+
+  // Use the default implementation for scoring many poses
+  using ScanMatcher::scorePoints;
+
+  /**
+   * @brief Get the fraction of scan points not explained by the internal map.
+   * @param scan Scan to check, at its current pose.
+   */
+  double novelty(const ScanPtr & scan) const;
+
+  /**
+   * @brief Reset the internal map, removing all scans.
+   */
+  void reset();
+
+  /**
+   * @brief Get the approximate memory used by the internal map, in bytes.
+   */
+  size_t memoryUsage() const;
+
+protected:
+  // Support for nanoflann, points are stored as flat x/y arrays
+  struct PointAdapter
+  {
+    explicit PointAdapter(const ScanMatcherICP * matcher)
+    : matcher_(matcher)
+    {
+    }
+
+    inline size_t kdtree_get_point_count() const { return matcher_->x_.size(); }
+
+    inline double kdtree_get_pt(const size_t idx, const size_t dim) const
+    {
+      if (dim == 0) return matcher_->x_[idx];
+      else return matcher_->y_[idx];
+    }
+
+    // Use the standard bounding-box computations
+    template <class BBOX>
+    bool kdtree_get_bbox(BBOX& /* bb */) const { return false; }
+
+    const ScanMatcherICP * matcher_;
+  };
+
+  using kd_tree_t = nanoflann::KDTreeSingleIndexAdaptor<
+    nanoflann::L2_Simple_Adaptor<double, PointAdapter>, PointAdapter, 2>;
+
+  /**
+   * @brief Find the closest map point with a valid normal.
+   * @returns Signed point-to-line distance, or NaN if no point is
+   *          within max_correspondence_distance.
+   */
+  double distance(double x, double y, size_t & index) const;
+
+  /** @brief Likelihood of a point-to-line distance, 0 to 1. */
+  double likelihood(double distance) const;
+
+  /** @brief Subsample points, then transform them by pose */
+  void transformPoints(const std::vector<Point> & points, const Pose2d & pose,
+                       std::vector<Eigen::Vector2d> & transformed) const;
+
+  // Parameters
+  size_t max_iterations_;
+  double max_correspondence_distance_;
+  size_t normal_neighbors_;
+  double point_sigma_;
+  size_t laser_max_beams_;
+
+  // Max range of laser scanner
+  double range_max_;
+
+  // Map points and their line normals
+  std::vector<double> x_, y_;
+  std::vector<double> normal_x_, normal_y_;
+
+  PointAdapter adapter_{this};
+  std::unique_ptr<kd_tree_t> tree_;
+};
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__SCAN_MATCHER_ICP_HPP_
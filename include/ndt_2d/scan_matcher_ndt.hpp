@@ -39,6 +39,25 @@
 namespace ndt_2d
 {
 
+/**
+ * @brief Shared model of ScanMatcherNDT.
+ */
+class ScanMatcherNDTModel : public ScanMatcherModel
+{
+public:
+  explicit ScanMatcherNDTModel(const std::shared_ptr<const NDT> & ndt)
+  : ndt(ndt)
+  {
+  }
+
+  size_t memoryUsage() const
+  {
+    return ndt->memoryUsage();
+  }
+
+  std::shared_ptr<const NDT> ndt;
+};
+
 class ScanMatcherNDT : public ScanMatcher
 {
 public:
@@ -71,6 +90,13 @@ public:
   double matchScan(const ScanPtr & scan, Pose2d & pose,
                    Eigen::Matrix3d & covariance) const;
 
+  /**
+   * @brief Match a scan against the internal map, giving up at a deadline.
+   * @returns The score when scan is at corrected pose, NaN if abandoned.
+   */
+  double matchScan(const ScanPtr & scan, Pose2d & pose, Eigen::Matrix3d & covariance,
+                   const std::chrono::steady_clock::time_point & deadline) const;
+
   /**
    * @brief Score a scan against the internal NDT map.
    * @param scan Scan to score against internal NDT map.
@@ -84,24 +110,97 @@ public:
    */
   double scorePoints(const std::vector<Point> & points, const Pose2d & pose) const;
 
+  /**
+   * @brief Score a set of points against the internal NDT map, at many poses.
+   * @param points Points to score against internal NDT map.
+   * @param poses The poses of the points within the internal NDT map.
+   * @param scores The score at each pose, identical to calling scorePoints()
+   *        for each pose.
+   */
+  void scorePoints(const std::vector<Point> & points, const std::vector<Pose2d> & poses,
+                   std::vector<double> & scores) const;
+
+  /**
+   * @brief Get the fraction of scan points not explained by the internal NDT map.
+   * @param scan Scan to check, at its current pose.
+   */
+  double novelty(const ScanPtr & scan) const;
+
   /**
    * @brief Reset the internal NDT map, removing all scans.
    */
   void reset();
 
+  /**
+   * @brief Get the approximate memory used by the internal NDT map, in bytes.
+   *        A shared NDT map is counted by every instance sharing it.
+   */
+  size_t memoryUsage() const;
+
+  /**
+   * @brief Get the internal NDT map, to share with other instances.
+   */
+  ScanMatcherModelPtr getModel() const;
+
+  /**
+   * @brief Use the NDT map of another ScanMatcherNDT.
+   * @param model Model from ScanMatcherNDT::getModel().
+   */
+  bool setModel(const ScanMatcherModelPtr & model);
+
+  /**
+   * @brief Create a new instance with the same parameters, sharing the NDT map.
+   */
+  ScanMatcherPtr clone() const;
+
 protected:
+  /**
+   * @brief Build an NDT of the scan, in the scan frame, and return the
+   *        means and covariances of the cells with enough points.
+   */
+  void getDistributions(const ScanPtr & scan, std::vector<Eigen::Vector2d> & means,
+                        std::vector<Eigen::Matrix2d> & covariances) const;
+
+  /**
+   * @brief Compute the D2D score of distributions against the NDT map.
+   * @param means Means of the distributions, in the scan frame.
+   * @param covariances Covariances of the distributions, in the scan frame.
+   * @param pose Pose (x, y, theta) of the scan within the NDT map.
+   * @param gradient If not null, the gradient of the score.
+   * @param hessian If not null, the Gauss-Newton approximation of the Hessian.
+   * @returns Negative sum of the likelihoods of the distributions.
+   */
+  double scoreDistributions(const std::vector<Eigen::Vector2d> & means,
+                            const std::vector<Eigen::Matrix2d> & covariances,
+                            const Eigen::Vector3d & pose,
+                            Eigen::Vector3d * gradient = nullptr,
+                            Eigen::Matrix3d * hessian = nullptr) const;
+
+  /** @brief matchScan() for the D2D mode */
+  double matchScanD2D(const ScanPtr & scan, Pose2d & pose, Eigen::Matrix3d & covariance,
+                      const std::chrono::steady_clock::time_point & deadline) const;
+
   // Resolution of the NDT map
   double resolution_;
 
+  // Match distributions (D2D) rather than points (P2D)
+  bool use_d2d_;
+  size_t max_iterations_;
+  // Resolution of the NDT built from each query scan
+  double d2d_resolution_;
+
   // Search parameters
   double angular_res_, angular_size_;
   double linear_res_, linear_size_;
   size_t laser_max_beams_;
+  // Number of threads to use when scoring many poses
+  size_t score_threads_;
 
   // Max range of laser scanner
   double range_max_;
 
-  std::unique_ptr<NDT> ndt_;
+  // Never modified once built, so may be shared with other instances
+  std::shared_ptr<const NDT> ndt_;
 };
 
 }  // namespace ndt_2d
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__SCAN_MATCHER_PSM_HPP_
+#define NDT_2D__SCAN_MATCHER_PSM_HPP_
+
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+#include <rclcpp/rclcpp.hpp>
+#include <ndt_2d/scan_matcher.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief Polar scan matcher, in the style of PSM (Diosi and Kleeman).
+ *
+ * Scans are compared as range images: the closest range in each bearing
+ * bin around the robot. The map is the points of all added scans, which
+ * are projected into a range image at each candidate translation. Since
+ * rotating the scan only shifts its range image, every rotation in the
+ * search window is scored by comparing the two images at a different
+ * index offset, without projecting again. The rotation resolution is the
+ * bin size, refined by parabolic interpolation of the best scores.
+ */
+class ScanMatcherPSM : public ScanMatcher
+{
+public:
+  virtual ~ScanMatcherPSM() = default;
+
+  /**
+   * @brief Initialize a PSM scan matcher instance.
+   * @param name Name for ths scan matcher instance.
+   * @param node Node instance to use for getting parameters.
+   * @param range_max Maximum range of laser scanner.
+   */
+  void initialize(const std::string & name,
+                  rclcpp::Node * node, double range_max);
+
+  /**
+   * @brief Add scans to the internal map.
+   * @param begin Starting iterator of scans for map building.
+   * @param end Ending iterator of scans for map building.
+   */
+  void addScans(const std::vector<ScanPtr>::const_iterator & begin,
+                const std::vector<ScanPtr>::const_iterator & end);
+
+  /**
+   * @brief Match a scan against the internal map.
+   * @param scan Scan to match against internal map.
+   * @param pose The corrected pose that best matches scan to map.
+   * @param covariance Covariance matrix for the match.
+   * @returns The score when scan is at corrected pose.
+   */
+  double matchScan(const ScanPtr & scan, Pose2d & pose,
+                   Eigen::Matrix3d & covariance) const;
+
+  /**
+   * @brief Match a scan against the internal map, giving up at a deadline.
+   * @returns The score when scan is at corrected pose, NaN if abandoned.
+   */
+  double matchScan(const ScanPtr & scan, Pose2d & pose, Eigen::Matrix3d & covariance,
+                   const std::chrono::steady_clock::time_point & deadline) const;
+
+  /**
+   * @brief Score a scan against the internal map.
+   * @param scan Scan to score against internal map.
+   */
+  double scoreScan(const ScanPtr & scan) const;
+
+  /**
+   * @brief Score a set of points against the internal map.
+   * @param points Points to score against internal map.
+   * @param pose The pose of the points within the internal map.
+   */
+  double scorePoints(const std::vector<Point> & points, const Pose2d & pose) const;
+
+  /**
+   * @brief Score a set of points against the internal map, at many poses.
+   *        The range image of the points is only computed once.
+   * @param points Points to score against internal map.
+   * @param poses The poses of the points within the internal map.
+   * @param scores The score at each pose, resized to match poses.
+   */
+  void scorePoints(const std::vector<Point> & points, const std::vector<Pose2d> & poses,
+                   std::vector<double> & scores) const;
+
+  /**
+   * @brief Get the fraction of range image bins not explained by the internal map.
+   * @param scan Scan to check, at its current pose.
+   */
+  double novelty(const ScanPtr & scan) const;
+
+  /**
+   * @brief Reset the internal map, removing all scans.
+   */
+  void reset();
+
+  /**
+   * @brief Get the approximate memory used by the internal map, in bytes.
+   */
+  size_t memoryUsage() const;
+
+protected:
+  /**
+   * @brief Project points into a range image.
+   * @param x The x coordinates of the points.
+   * @param y The y coordinates of the points.
+   * @param pose Origin and heading of the range image.
+   * @param ranges Closest range in each bin, infinity if no points.
+   */
+  void project(const std::vector<double> & x, const std::vector<double> & y,
+               const Pose2d & pose, std::vector<double> & ranges) const;
+
+  /** @brief Range image of points, in the scan frame */
+  void project(const std::vector<Point> & points, std::vector<double> & ranges) const;
+
+  /**
+   * @brief Compare two range images.
+   * @param query Range image of the scan.
+   * @param model Range image of the map.
+   * @param shift Rotation of the scan, in bins.
+   * @returns Sum of the likelihoods of the query ranges.
+   */
+  double compare(const std::vector<double> & query, const std::vector<double> & model,
+                 int shift) const;
+
+  /** @brief Likelihood of a range difference, 0 to 1. */
+  double likelihood(double difference) const;
+
+  /** @brief Grid cell of a coordinate, clamped to -1 to size. */
+  int getCell(double coordinate, double origin, int size) const;
+
+  /**
+   * @brief Get the map points within a distance of a pose.
+   * @param pose The center of the search.
+   * @param distance Maximum distance of points from the pose.
+   * @param x The x coordinates of the points found.
+   * @param y The y coordinates of the points found.
+   */
+  void getNearbyPoints(const Pose2d & pose, double distance,
+                       std::vector<double> & x, std::vector<double> & y) const;
+
+  // Parameters
+  double angular_res_, angular_size_;
+  double linear_res_, linear_size_;
+  double range_sigma_;
+
+  // Max range of laser scanner
+  double range_max_;
+
+  // Number of bins in a range image, and the actual size of each bin
+  size_t bins_;
+  double bin_size_;
+
+  // Map points, sorted by grid cell so that nearby points can be found
+  // without checking the whole map
+  std::vector<double> x_, y_;
+  // Points in cell i are cell_start_[i] to cell_start_[i + 1]
+  std::vector<size_t> cell_start_;
+  double cell_size_;
+  double origin_x_, origin_y_;
+  int size_x_, size_y_;
+};
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__SCAN_MATCHER_PSM_HPP_
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__SHARED_MAP_HPP_
+#define NDT_2D__SHARED_MAP_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ndt_2d/constraint.hpp>
+#include <ndt_2d/ndt_model.hpp>
+#include <ndt_2d/scan.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * A shared map is a file holding the scans, constraints and (optionally) the
+ * NDT of a map, laid out so that it can be memory mapped and used in place.
+ * Every reference within the file is an offset from the start, so it is
+ * valid at any address. Any number of processes may attach read-only, and
+ * share a single copy of the map in the page cache. Placing the file in
+ * /dev/shm keeps it in memory.
+ *
+ * The file is only portable between builds with the same layout of Cell,
+ * which is checked when attaching.
+ */
+class SharedMap : public std::enable_shared_from_this<SharedMap>
+{
+public:
+  ~SharedMap();
+
+  /**
+   * @brief Write a shared map file. The file is written under a temporary
+   *        name and renamed into place, so processes attached to a previous
+   *        version keep a valid (but stale) map.
+   * @param filename Full path to the shared map file.
+   * @param scans Scans of the map.
+   * @param constraints Constraints between the scans.
+   * @param ndt If not null, the NDT of the map, which must have been computed.
+   * @returns True if the file was written.
+   */
+  static bool write(const std::string & filename, const std::vector<ScanPtr> & scans,
+                    const std::vector<ConstraintPtr> & constraints, const NDT * ndt);
+
+  /**
+   * @brief Attach read-only to a shared map file.
+   * @param filename Full path to the shared map file.
+   * @returns The map, or nullptr if the file could not be mapped or is invalid.
+   */
+  static std::shared_ptr<const SharedMap> open(const std::string & filename);
+
+  /** @brief Get the number of scans in the map. */
+  size_t getNumScans() const;
+
+  /** @brief Get the id of a scan. */
+  size_t getScanId(size_t index) const;
+
+  /** @brief Get the pose of a scan. */
+  Pose2d getScanPose(size_t index) const;
+
+  /**
+   * @brief Get the points of a scan, in the scan frame.
+   * @param index Index of the scan.
+   * @param size Set to the number of points.
+   * @returns Pointer to the points, valid for the lifetime of the map.
+   */
+  const Point * getScanPoints(size_t index, size_t & size) const;
+
+  /** @brief Get the number of constraints in the map. */
+  size_t getNumConstraints() const;
+
+  /** @brief Get a copy of a constraint. */
+  Constraint getConstraint(size_t index) const;
+
+  /**
+   * @brief Get the NDT of the map, without copying the cells.
+   * @returns A view that keeps the map attached, or nullptr if the map has no NDT.
+   */
+  std::shared_ptr<const NDT> getNDT() const;
+
+  /** @brief Get the size of the mapping, which is shared by all attached processes. */
+  size_t size() const;
+
+private:
+  SharedMap(const uint8_t * data, size_t size);
+
+  template <typename T>
+  const T * at(uint64_t offset) const
+  {
+    return reinterpret_cast<const T *>(data_ + offset);
+  }
+
+  const uint8_t * data_;
+  size_t size_;
+};
+
+using SharedMapPtr = std::shared_ptr<const SharedMap>;
+
+}  // namespace ndt_2d
+
+#endif  // NDT_2D__SHARED_MAP_HPP_
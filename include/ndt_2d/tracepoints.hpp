@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef NDT_2D__TRACEPOINTS_HPP_
+#define NDT_2D__TRACEPOINTS_HPP_
+
+/*
+ * Static (USDT) tracepoints for system-level profiling.
+ *
+ * When built with NDT_2D_ENABLE_TRACEPOINTS, each tracepoint is a single
+ * nop instruction until a tracer (bpftrace, perf, SystemTap) attaches to it.
+ * Otherwise the tracepoints are compiled out entirely. All probes are in the
+ * "ndt_2d" provider. Probes about a single scan take its id first, so that
+ * its events can be correlated. scan_receive fires before the scan has an
+ * id, it takes the number of scans in the graph, which is the id the scan
+ * gets if it is added. Probes about the whole graph (optimize_start,
+ * optimize_end and map_publish) take the number of scans in the graph:
+ *
+ *   scan_receive(scan_id, stamp_ns)
+ *   match_start(scan_id)
+ *   match_end(scan_id)
+ *   graph_insert(scan_id, num_constraints)
+ *   loop_closure_candidate(scan_id, candidate_id, accepted)
+ *   optimize_start(num_scans)
+ *   optimize_end(num_scans, success)
+ *   map_publish(num_scans)
+ */
+
+#ifdef NDT_2D_ENABLE_TRACEPOINTS
+#include <sys/sdt.h>
+#define NDT_2D_TRACEPOINT(name, ...) STAP_PROBEV(ndt_2d, name, __VA_ARGS__)
+#else
+#define NDT_2D_TRACEPOINT(name, ...)
+#endif
+
+#endif  // NDT_2D__TRACEPOINTS_HPP_
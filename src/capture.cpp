@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <ndt_2d/capture.hpp>
+
+namespace ndt_2d
+{
+
+static const char CAPTURE_MAGIC[8] = {'N', 'D', 'T', '2', 'D', 'C', 'A', 'P'};
+static const uint32_t CAPTURE_VERSION = 2;
+
+bool CaptureWriter::open(const std::string & filename, const CaptureHeader & header)
+{
+  file_.open(filename, std::ios::binary | std::ios::trunc);
+  if (!file_.is_open())
+  {
+    return false;
+  }
+  written_scans_.clear();
+  prune_size_ = 64;
+  next_key_ = 0;
+
+  file_.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+  writeValue(CAPTURE_VERSION);
+  writeString(header.type);
+  writeString(header.name);
+  writeValue(header.range_max);
+
+  // Only the parameter types used by scan matchers are supported
+  std::vector<rclcpp::Parameter> parameters;
+  for (auto & param : header.parameters)
+  {
+    auto type = param.get_type();
+    if (type == rclcpp::ParameterType::PARAMETER_BOOL ||
+        type == rclcpp::ParameterType::PARAMETER_INTEGER ||
+        type == rclcpp::ParameterType::PARAMETER_DOUBLE ||
+        type == rclcpp::ParameterType::PARAMETER_STRING)
+    {
+      parameters.push_back(param);
+    }
+  }
+
+  writeValue(static_cast<uint32_t>(parameters.size()));
+  for (auto & param : parameters)
+  {
+    writeString(param.get_name());
+    writeValue(static_cast<uint8_t>(param.get_type()));
+    switch (param.get_type())
+    {
+      case rclcpp::ParameterType::PARAMETER_BOOL:
+        writeValue(static_cast<uint8_t>(param.as_bool()));
+        break;
+      case rclcpp::ParameterType::PARAMETER_INTEGER:
+        writeValue(static_cast<int64_t>(param.as_int()));
+        break;
+      case rclcpp::ParameterType::PARAMETER_DOUBLE:
+        writeValue(param.as_double());
+        break;
+      default:
+        writeString(param.as_string());
+        break;
+    }
+  }
+
+  return file_.good();
+}
+
+uint64_t CaptureWriter::writeScan(const ScanPtr & scan)
+{
+  auto written = written_scans_.find(scan.get());
+  if (written != written_scans_.end() && written->second.scan.lock() == scan)
+  {
+    // Already written
+    return written->second.key;
+  }
+
+  if (written_scans_.size() >= prune_size_)
+  {
+    // Erase scans that no longer exist, growing the limit with the live
+    // scans so that the cost of pruning stays constant per scan written
+    for (auto it = written_scans_.begin(); it != written_scans_.end();)
+    {
+      it = it->second.scan.expired() ? written_scans_.erase(it) : std::next(it);
+    }
+    prune_size_ = std::max(prune_size_, 2 * written_scans_.size());
+  }
+
+  uint64_t key = next_key_++;
+  written_scans_[scan.get()] = WrittenScan{scan, key};
+  writeValue(static_cast<uint8_t>(CaptureRecord::SCAN));
+  writeValue(key);
+  writePoints(scan->getPoints());
+  return key;
+}
+
+void CaptureWriter::writeAddScans(const std::vector<ScanPtr>::const_iterator & begin,
+                                  const std::vector<ScanPtr>::const_iterator & end)
+{
+  std::vector<uint64_t> keys;
+  for (auto scan = begin; scan != end; ++scan)
+  {
+    keys.push_back(writeScan(*scan));
+  }
+
+  writeValue(static_cast<uint8_t>(CaptureRecord::ADD_SCANS));
+  writeValue(static_cast<uint32_t>(keys.size()));
+  size_t i = 0;
+  for (auto scan = begin; scan != end; ++scan, ++i)
+  {
+    writeValue(keys[i]);
+    writeValue(static_cast<uint64_t>((*scan)->getId()));
+    writePose((*scan)->getPose());
+  }
+}
+
+void CaptureWriter::writeReset()
+{
+  writeValue(static_cast<uint8_t>(CaptureRecord::RESET));
+}
+
+void CaptureWriter::writeMatch(const ScanPtr & scan, double score, const Pose2d & correction,
+                               const Eigen::Matrix3d & covariance, uint64_t duration_ns)
+{
+  writeValue(static_cast<uint8_t>(CaptureRecord::MATCH));
+  writeValue(static_cast<uint64_t>(scan->getId()));
+  writePose(scan->getPose());
+  writePoints(scan->getPoints());
+  writeValue(score);
+  writePose(correction);
+  for (size_t i = 0; i < 9; ++i)
+  {
+    writeValue(covariance(i / 3, i % 3));
+  }
+  writeValue(duration_ns);
+  // Flush so that captures are usable even if the node crashes
+  file_.flush();
+}
+
+void CaptureWriter::writeString(const std::string & value)
+{
+  writeValue(static_cast<uint32_t>(value.size()));
+  file_.write(value.data(), value.size());
+}
+
+void CaptureWriter::writePoints(const std::vector<Point> & points)
+{
+  writeValue(static_cast<uint32_t>(points.size()));
+  for (auto & point : points)
+  {
+    writeValue(point.x);
+    writeValue(point.y);
+  }
+}
+
+void CaptureWriter::writePose(const Pose2d & pose)
+{
+  writeValue(pose.x);
+  writeValue(pose.y);
+  writeValue(pose.theta);
+}
+
+bool CaptureReader::open(const std::string & filename, CaptureHeader & header)
+{
+  file_.open(filename, std::ios::binary);
+  if (!file_.is_open())
+  {
+    return false;
+  }
+
+  char magic[sizeof(CAPTURE_MAGIC)];
+  uint32_t version;
+  if (!file_.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0 ||
+      !readValue(version) || version != CAPTURE_VERSION)
+  {
+    return false;
+  }
+
+  uint32_t num_parameters;
+  if (!readString(header.type) || !readString(header.name) ||
+      !readValue(header.range_max) || !readValue(num_parameters))
+  {
+    return false;
+  }
+
+  header.parameters.clear();
+  for (uint32_t i = 0; i < num_parameters; ++i)
+  {
+    std::string name;
+    uint8_t type;
+    if (!readString(name) || !readValue(type))
+    {
+      return false;
+    }
+
+    if (type == rclcpp::ParameterType::PARAMETER_BOOL)
+    {
+      uint8_t value;
+      if (!readValue(value)) return false;
+      header.parameters.emplace_back(name, static_cast<bool>(value));
+    }
+    else if (type == rclcpp::ParameterType::PARAMETER_INTEGER)
+    {
+      int64_t value;
+      if (!readValue(value)) return false;
+      header.parameters.emplace_back(name, value);
+    }
+    else if (type == rclcpp::ParameterType::PARAMETER_DOUBLE)
+    {
+      double value;
+      if (!readValue(value)) return false;
+      header.parameters.emplace_back(name, value);
+    }
+    else if (type == rclcpp::ParameterType::PARAMETER_STRING)
+    {
+      std::string value;
+      if (!readString(value)) return false;
+      header.parameters.emplace_back(name, value);
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool CaptureReader::read(CaptureRecord & record)
+{
+  uint8_t type;
+  if (!readValue(type))
+  {
+    return false;
+  }
+  record.type = static_cast<CaptureRecord::Type>(type);
+
+  uint64_t key, id;
+  uint32_t size;
+  switch (record.type)
+  {
+    case CaptureRecord::SCAN:
+      if (!readValue(key)) return false;
+      record.key = key;
+      return readPoints(record.points);
+    case CaptureRecord::ADD_SCANS:
+      if (!readValue(size)) return false;
+      record.scans.resize(size);
+      for (auto & scan : record.scans)
+      {
+        if (!readValue(key) || !readValue(id) || !readPose(scan.pose)) return false;
+        scan.key = key;
+        scan.id = id;
+      }
+      return true;
+    case CaptureRecord::RESET:
+      return true;
+    case CaptureRecord::MATCH:
+      if (!readValue(id) || !readPose(record.pose) || !readPoints(record.points) ||
+          !readValue(record.score) || !readPose(record.correction))
+      {
+        return false;
+      }
+      record.id = id;
+      for (size_t i = 0; i < 9; ++i)
+      {
+        if (!readValue(record.covariance(i / 3, i % 3))) return false;
+      }
+      return readValue(record.duration_ns);
+    default:
+      // Unknown record, file is corrupt
+      return false;
+  }
+}
+
+bool CaptureReader::readString(std::string & value)
+{
+  uint32_t size;
+  if (!readValue(size))
+  {
+    return false;
+  }
+  value.resize(size);
+  return static_cast<bool>(file_.read(&value[0], size));
+}
+
+bool CaptureReader::readPoints(std::vector<Point> & points)
+{
+  uint32_t size;
+  if (!readValue(size))
+  {
+    return false;
+  }
+  points.resize(size);
+  for (auto & point : points)
+  {
+    if (!readValue(point.x) || !readValue(point.y)) return false;
+  }
+  return true;
+}
+
+bool CaptureReader::readPose(Pose2d & pose)
+{
+  return readValue(pose.x) && readValue(pose.y) && readValue(pose.theta);
+}
+
+}  // namespace ndt_2d
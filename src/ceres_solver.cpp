@@ -119,6 +119,17 @@ bool CeresSolver::optimize(const std::vector<ConstraintPtr> & constraints,
   return true;
 }
 
+size_t CeresSolver::memoryUsage() const
+{
+  using CostFunction = ceres::AutoDiffCostFunction<PoseGraph2dErrorTerm, 3, 1, 1, 1, 1, 1, 1>;
+  size_t bytes = sizeof(CeresSolver);
+  // Each node is a hash map entry, plus bucket
+  bytes += nodes_.size() * sizeof(std::pair<const int, Eigen::Vector3d>);
+  bytes += nodes_.bucket_count() * sizeof(void *);
+  bytes += problem_->NumResidualBlocks() * (sizeof(CostFunction) + sizeof(PoseGraph2dErrorTerm));
+  return bytes;
+}
+
 ceres::ResidualBlockId CeresSolver::addConstraint(const ConstraintPtr & constraint,
                                                   std::vector<ScanPtr> & scans)
 {
@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <zstd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <thread>
+#include <ndt_2d/compressed_map.hpp>
+
+namespace ndt_2d
+{
+
+static const char COMPRESSED_MAP_MAGIC[8] = {'N', 'D', 'T', '2', 'D', 'M', 'A', 'P'};
+static const uint32_t COMPRESSED_MAP_VERSION = 1;
+static const int COMPRESSION_LEVEL = 3;
+
+enum ChunkType : uint8_t
+{
+  END = 0,
+  SCANS = 1,
+  CONSTRAINTS = 2
+};
+
+// Decoded contents of a chunk
+struct Chunk
+{
+  bool valid = false;
+  std::vector<ScanPtr> scans;
+  std::vector<ConstraintPtr> constraints;
+};
+
+// Appends little-endian values to a buffer
+class ChunkEncoder
+{
+public:
+  template <typename T>
+  void put(const T & value)
+  {
+    const char * bytes = reinterpret_cast<const char *>(&value);
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+  }
+
+  void putVarint(int64_t value)
+  {
+    // Zigzag encoding, so that small negative values are also short
+    uint64_t v = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    while (v >= 0x80)
+    {
+      data.push_back(static_cast<char>(v | 0x80));
+      v >>= 7;
+    }
+    data.push_back(static_cast<char>(v));
+  }
+
+  std::vector<char> data;
+};
+
+// Reads values written by ChunkEncoder, all reads are bounds checked
+class ChunkDecoder
+{
+public:
+  explicit ChunkDecoder(const std::vector<char> & data)
+  : data_(data),
+    pos_(0)
+  {
+  }
+
+  template <typename T>
+  bool get(T & value)
+  {
+    if (data_.size() - pos_ < sizeof(T)) return false;
+    std::memcpy(&value, &data_[pos_], sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+
+  bool getVarint(int64_t & value)
+  {
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+      if (pos_ >= data_.size()) return false;
+      uint8_t byte = data_[pos_++];
+      v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+      {
+        value = static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t remaining() const
+  {
+    return data_.size() - pos_;
+  }
+
+private:
+  const std::vector<char> & data_;
+  size_t pos_;
+};
+
+static std::vector<char> encodeScans(const std::vector<ScanPtr>::const_iterator & begin,
+                                     const std::vector<ScanPtr>::const_iterator & end)
+{
+  ChunkEncoder encoder;
+  for (auto it = begin; it != end; ++it)
+  {
+    const ScanPtr & scan = *it;
+    Pose2d pose = scan->getPose();
+    std::vector<Point> points = scan->getPoints();
+    encoder.put(static_cast<uint64_t>(scan->getId()));
+    encoder.put(pose.x);
+    encoder.put(pose.y);
+    encoder.put(pose.theta);
+    encoder.put(static_cast<uint32_t>(points.size()));
+
+    // Neighboring beams are close, so deltas are small
+    int64_t prev_x = 0, prev_y = 0;
+    for (auto & point : points)
+    {
+      int64_t x = std::llround(point.x / CompressedMap::POINT_RESOLUTION);
+      int64_t y = std::llround(point.y / CompressedMap::POINT_RESOLUTION);
+      encoder.putVarint(x - prev_x);
+      encoder.putVarint(y - prev_y);
+      prev_x = x;
+      prev_y = y;
+    }
+  }
+  return encoder.data;
+}
+
+static std::vector<char> encodeConstraints(
+  const std::vector<ConstraintPtr>::const_iterator & begin,
+  const std::vector<ConstraintPtr>::const_iterator & end)
+{
+  ChunkEncoder encoder;
+  for (auto it = begin; it != end; ++it)
+  {
+    const ConstraintPtr & constraint = *it;
+    encoder.put(static_cast<uint64_t>(constraint->begin));
+    encoder.put(static_cast<uint64_t>(constraint->end));
+    for (size_t i = 0; i < 3; ++i)
+    {
+      encoder.put(constraint->transform(i));
+    }
+    for (size_t i = 0; i < 9; ++i)
+    {
+      encoder.put(constraint->information(i / 3, i % 3));
+    }
+    encoder.put(static_cast<uint8_t>(constraint->switchable));
+  }
+  return encoder.data;
+}
+
+// Compress a chunk and add the frame header
+static std::vector<char> compressChunk(uint8_t type, uint32_t count, const std::vector<char> & raw)
+{
+  std::vector<char> compressed(ZSTD_compressBound(raw.size()));
+  size_t size = ZSTD_compress(compressed.data(), compressed.size(), raw.data(), raw.size(),
+                              COMPRESSION_LEVEL);
+  if (ZSTD_isError(size))
+  {
+    return std::vector<char>();
+  }
+  compressed.resize(size);
+
+  ChunkEncoder frame;
+  frame.put(type);
+  frame.put(count);
+  frame.put(static_cast<uint64_t>(raw.size()));
+  frame.put(static_cast<uint64_t>(size));
+  frame.data.insert(frame.data.end(), compressed.begin(), compressed.end());
+  return frame.data;
+}
+
+static Chunk decodeChunk(uint8_t type, uint32_t count, uint64_t raw_size,
+                         const std::vector<char> & compressed)
+{
+  Chunk chunk;
+
+  // Size is also in the zstd frame, a mismatch means the file is corrupt
+  if (ZSTD_getFrameContentSize(compressed.data(), compressed.size()) != raw_size)
+  {
+    return chunk;
+  }
+  std::vector<char> raw(raw_size);
+  size_t size = ZSTD_decompress(raw.data(), raw.size(), compressed.data(), compressed.size());
+  if (ZSTD_isError(size) || size != raw_size)
+  {
+    return chunk;
+  }
+
+  ChunkDecoder decoder(raw);
+  if (type == SCANS)
+  {
+    chunk.scans.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      uint64_t id;
+      Pose2d pose;
+      uint32_t num_points;
+      if (!decoder.get(id) || !decoder.get(pose.x) || !decoder.get(pose.y) ||
+          !decoder.get(pose.theta) || !decoder.get(num_points) ||
+          num_points > decoder.remaining() / 2)
+      {
+        return chunk;
+      }
+
+      std::vector<Point> points(num_points);
+      int64_t x = 0, y = 0;
+      for (auto & point : points)
+      {
+        int64_t dx, dy;
+        if (!decoder.getVarint(dx) || !decoder.getVarint(dy)) return chunk;
+        x += dx;
+        y += dy;
+        point.x = x * CompressedMap::POINT_RESOLUTION;
+        point.y = y * CompressedMap::POINT_RESOLUTION;
+      }
+
+      ScanPtr scan = std::make_shared<Scan>(id);
+      scan->setPose(pose);
+      scan->setPoints(points);
+      chunk.scans.push_back(scan);
+    }
+  }
+  else
+  {
+    chunk.constraints.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      uint64_t begin, end;
+      uint8_t switchable;
+      ConstraintPtr constraint = std::make_shared<Constraint>();
+      if (!decoder.get(begin) || !decoder.get(end)) return chunk;
+      for (size_t j = 0; j < 3; ++j)
+      {
+        if (!decoder.get(constraint->transform(j))) return chunk;
+      }
+      for (size_t j = 0; j < 9; ++j)
+      {
+        if (!decoder.get(constraint->information(j / 3, j % 3))) return chunk;
+      }
+      if (!decoder.get(switchable)) return chunk;
+      constraint->begin = begin;
+      constraint->end = end;
+      constraint->switchable = switchable != 0;
+      chunk.constraints.push_back(constraint);
+    }
+  }
+
+  chunk.valid = (decoder.remaining() == 0);
+  return chunk;
+}
+
+template <typename T>
+static bool readValue(std::ifstream & file, T & value)
+{
+  return static_cast<bool>(file.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+bool CompressedMap::isCompressedMap(const std::string & filename)
+{
+  const std::string extension(EXTENSION);
+  return filename.size() > extension.size() &&
+         filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+bool CompressedMap::write(const std::string & filename, const std::vector<ScanPtr> & scans,
+                          const std::vector<ConstraintPtr> & constraints)
+{
+  // Written aside and renamed, so that a failed save never replaces a good map
+  std::string tmp_filename = filename + ".tmp";
+  std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+  {
+    return false;
+  }
+
+  file.write(COMPRESSED_MAP_MAGIC, sizeof(COMPRESSED_MAP_MAGIC));
+  file.write(reinterpret_cast<const char *>(&COMPRESSED_MAP_VERSION),
+             sizeof(COMPRESSED_MAP_VERSION));
+
+  // Chunks are compressed in parallel, and written in order
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  std::deque<std::future<std::vector<char>>> pending;
+  bool valid = true;
+  auto writeNext = [&file, &pending, &valid]()
+  {
+    std::vector<char> frame = pending.front().get();
+    pending.pop_front();
+    valid = valid && !frame.empty();
+    file.write(frame.data(), frame.size());
+  };
+
+  for (size_t start = 0; start < scans.size(); start += CHUNK_SCANS)
+  {
+    auto begin = scans.begin() + start;
+    auto end = scans.begin() + std::min(start + CHUNK_SCANS, scans.size());
+    pending.push_back(std::async(std::launch::async, [begin, end]()
+    {
+      return compressChunk(SCANS, std::distance(begin, end), encodeScans(begin, end));
+    }));
+    if (pending.size() >= threads) writeNext();
+  }
+
+  for (size_t start = 0; start < constraints.size(); start += CHUNK_CONSTRAINTS)
+  {
+    auto begin = constraints.begin() + start;
+    auto end = constraints.begin() + std::min(start + CHUNK_CONSTRAINTS, constraints.size());
+    pending.push_back(std::async(std::launch::async, [begin, end]()
+    {
+      return compressChunk(CONSTRAINTS, std::distance(begin, end),
+                           encodeConstraints(begin, end));
+    }));
+    if (pending.size() >= threads) writeNext();
+  }
+
+  while (!pending.empty())
+  {
+    writeNext();
+  }
+
+  // Marks a complete file, so truncation at a chunk boundary is detected
+  file.put(END);
+  file.close();
+  if (!valid || !file)
+  {
+    std::remove(tmp_filename.c_str());
+    return false;
+  }
+
+  return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+bool CompressedMap::read(const std::string & filename, std::vector<ScanPtr> & scans,
+                         std::vector<ConstraintPtr> & constraints, size_t threads)
+{
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file.is_open())
+  {
+    return false;
+  }
+  uint64_t file_size = file.tellg();
+  file.seekg(0);
+
+  char magic[sizeof(COMPRESSED_MAP_MAGIC)];
+  uint32_t version;
+  if (!file.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, COMPRESSED_MAP_MAGIC, sizeof(magic)) != 0 ||
+      !readValue(file, version) || version != COMPRESSED_MAP_VERSION)
+  {
+    return false;
+  }
+
+  if (threads == 0)
+  {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Chunks are decoded in parallel as they are read, only a few are held
+  // in memory at once, results are appended in file order
+  std::deque<std::future<Chunk>> pending;
+  bool valid = true;
+  auto collectNext = [&]()
+  {
+    Chunk chunk = pending.front().get();
+    pending.pop_front();
+    valid = valid && chunk.valid;
+    scans.insert(scans.end(), chunk.scans.begin(), chunk.scans.end());
+    constraints.insert(constraints.end(), chunk.constraints.begin(), chunk.constraints.end());
+  };
+
+  bool complete = false;
+  while (valid)
+  {
+    uint8_t type;
+    if (!readValue(file, type))
+    {
+      break;
+    }
+    if (type == END)
+    {
+      complete = true;
+      break;
+    }
+
+    uint32_t count;
+    uint64_t raw_size, compressed_size;
+    if ((type != SCANS && type != CONSTRAINTS) ||
+        !readValue(file, count) || !readValue(file, raw_size) ||
+        !readValue(file, compressed_size) ||
+        compressed_size > file_size - static_cast<uint64_t>(file.tellg()))
+    {
+      break;
+    }
+
+    std::vector<char> compressed(compressed_size);
+    if (!file.read(compressed.data(), compressed_size))
+    {
+      break;
+    }
+    pending.push_back(std::async(std::launch::async, decodeChunk, type, count, raw_size,
+                                 std::move(compressed)));
+    if (pending.size() >= threads) collectNext();
+  }
+
+  while (!pending.empty())
+  {
+    collectNext();
+  }
+
+  return valid && complete;
+}
+
+}  // namespace ndt_2d
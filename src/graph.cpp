@@ -26,10 +26,16 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <angles/angles.h>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <stdexcept>
+#include <ndt_2d/compressed_map.hpp>
 #include <ndt_2d/graph.hpp>
 #include <ndt_2d/msg/scan.hpp>
 #include <ndt_2d/msg/constraint.hpp>
+#include <ndt_2d/shared_map.hpp>
 #include <rosbag2_cpp/reader.hpp>
 #include <rosbag2_cpp/writer.hpp>
 #include <rclcpp/serialization.hpp>
@@ -38,7 +44,8 @@ namespace ndt_2d
 {
 
 Graph::Graph(bool use_barycenter)
-: use_barycenter_(use_barycenter)
+: use_barycenter_(use_barycenter),
+  descriptor_range_(10.0)
 {
 }
 
@@ -47,8 +54,18 @@ Graph::~Graph()
 }
 
 Graph::Graph(bool use_barycenter, const std::string & filename)
-: use_barycenter_(use_barycenter)
+: use_barycenter_(use_barycenter),
+  descriptor_range_(10.0)
 {
+  if (CompressedMap::isCompressedMap(filename))
+  {
+    if (!CompressedMap::read(filename, scans, constraints))
+    {
+      throw std::runtime_error("Unable to read compressed map " + filename);
+    }
+    return;
+  }
+
   rosbag2_cpp::Reader reader;
   reader.open(filename);
 
@@ -104,8 +121,35 @@ Graph::Graph(bool use_barycenter, const std::string & filename)
   }
 }
 
+Graph::Graph(bool use_barycenter, const SharedMap & map)
+: use_barycenter_(use_barycenter),
+  descriptor_range_(10.0)
+{
+  scans.reserve(map.getNumScans());
+  for (size_t i = 0; i < map.getNumScans(); ++i)
+  {
+    ScanPtr scan = std::make_shared<Scan>(map.getScanId(i));
+    scan->setPose(map.getScanPose(i));
+    size_t size = 0;
+    const Point * points = map.getScanPoints(i, size);
+    scan->setPoints(std::vector<Point>(points, points + size));
+    scans.push_back(scan);
+  }
+
+  constraints.reserve(map.getNumConstraints());
+  for (size_t i = 0; i < map.getNumConstraints(); ++i)
+  {
+    constraints.push_back(std::make_shared<Constraint>(map.getConstraint(i)));
+  }
+}
+
 bool Graph::save(const std::string & filename)
 {
+  if (CompressedMap::isCompressedMap(filename))
+  {
+    return CompressedMap::write(filename, scans, constraints);
+  }
+
   // Open the graph file
   rosbag2_cpp::Writer writer;
   writer.open(filename);
@@ -188,71 +232,208 @@ std::vector<size_t> Graph::findNearest(const ScanPtr & scan, double dist, int li
   return indicies;
 }
 
-void Graph::getMsg(visualization_msgs::msg::MarkerArray & msg, rclcpp::Time & t)
+size_t Graph::findTravelLimit(size_t index, double distance) const
+{
+  if (scans.empty())
+  {
+    return 0;
+  }
+
+  size_t limit = std::min(index, scans.size() - 1);
+  double travel = 0.0;
+  while (limit > 0 && travel < distance)
+  {
+    const Pose2d & a = scans[limit]->getPose();
+    const Pose2d & b = scans[limit - 1]->getPose();
+    travel += std::hypot(a.x - b.x, a.y - b.y);
+    --limit;
+  }
+  return limit;
+}
+
+std::vector<SimilarScan> Graph::findSimilar(const ScanPtr & scan, size_t k,
+                                            double max_distance, int limit_scan_index)
+{
+  // Compute descriptors for any new scans
+  descriptors_.reserve(scans.size());
+  for (size_t i = descriptors_.size(); i < scans.size(); ++i)
+  {
+    descriptors_.push_back(
+      std::make_shared<ScanDescriptor>(scans[i]->getPoints(), descriptor_range_));
+  }
+
+  std::vector<Point> points = scan->getPoints();
+  ScanDescriptor query(points, descriptor_range_);
+  size_t limit = (limit_scan_index > 0) ? limit_scan_index : scans.size();
+  limit = std::min(limit, scans.size());
+
+  // First pass: rank by ring key, which is cheap to compare
+  std::vector<std::pair<double, size_t>> ranked;
+  ranked.reserve(limit);
+  for (size_t i = 0; i < limit; ++i)
+  {
+    ranked.emplace_back(query.ringKeyDistance(*descriptors_[i]), i);
+  }
+  size_t num_ranked = std::min(ranked.size(), 10 * k);
+  std::partial_sort(ranked.begin(), ranked.begin() + num_ranked, ranked.end());
+  ranked.resize(num_ranked);
+
+  // Centroid of query points, in the robot frame
+  Point centroid;
+  for (auto & point : points)
+  {
+    centroid.x += point.x / points.size();
+    centroid.y += point.y / points.size();
+  }
+
+  // Second pass: compare full descriptors of the best candidates
+  std::vector<SimilarScan> similar;
+  for (auto & candidate : ranked)
+  {
+    double yaw;
+    double distance = query.distance(*descriptors_[candidate.second], yaw);
+    if (distance >= max_distance) continue;
+
+    // Rotate the query to the candidate heading plus yaw, then align the
+    // centroids of the points, which is close when scans are from one place
+    const ScanPtr & match = scans[candidate.second];
+    Pose2d barycenter = match->getBarycenterPose();
+    double theta = angles::normalize_angle(match->getPose().theta + yaw);
+
+    SimilarScan s;
+    s.index = candidate.second;
+    s.distance = distance;
+    s.pose.x = barycenter.x - (cos(theta) * centroid.x - sin(theta) * centroid.y);
+    s.pose.y = barycenter.y - (sin(theta) * centroid.x + cos(theta) * centroid.y);
+    s.pose.theta = theta;
+    similar.push_back(s);
+  }
+
+  std::sort(similar.begin(), similar.end(),
+    [](const SimilarScan & a, const SimilarScan & b) { return a.distance < b.distance; });
+  if (similar.size() > k) similar.resize(k);
+  return similar;
+}
+
+void Graph::setDescriptorRange(double range)
+{
+  if (range != descriptor_range_)
+  {
+    descriptor_range_ = range;
+    descriptors_.clear();
+  }
+}
+
+// Set the fixed fields of a list marker
+static void initMarker(visualization_msgs::msg::Marker & m, const std::string & ns, int id,
+                       int type, double scale, double r, double g, double b)
 {
-  // Publish nodes in red
-  visualization_msgs::msg::Marker m;
   m.header.frame_id = "map";
-  m.header.stamp = t;
-  m.ns = "nodes";
-  m.type = visualization_msgs::msg::Marker::SPHERE;
+  m.ns = ns;
+  m.id = id;
+  m.type = type;
   m.action = visualization_msgs::msg::Marker::ADD;
-  m.scale.x = 0.08;
-  m.scale.y = 0.08;
-  m.scale.z = 0.08;
-  m.color.r = 1.0;
-  m.color.g = 0.0;
-  m.color.b = 0.0;
+  m.pose.orientation.w = 1.0;
+  m.scale.x = scale;
+  m.scale.y = scale;
+  m.scale.z = scale;
+  m.color.r = r;
+  m.color.g = g;
+  m.color.b = b;
   m.color.a = 1.0;
+}
 
-  for (auto & scan : scans)
+// Resize points of a marker, returns true if the size changed
+static bool resizePoints(visualization_msgs::msg::Marker & m, size_t size)
+{
+  if (m.points.size() == size)
   {
-    // Publish
-    m.id = scan->getId();
-    m.pose.position.x = scan->getPose().x;
-    m.pose.position.y = scan->getPose().y;
-    msg.markers.push_back(m);
+    return false;
   }
+  m.points.resize(size);
+  return true;
+}
 
-  // Publish odometry edges in blue
-  m.header.frame_id = "map";
-  m.header.stamp = t;
-  m.ns = "edges";
-  m.id = 0;
-  m.type = visualization_msgs::msg::Marker::LINE_STRIP;
-  m.action = visualization_msgs::msg::Marker::ADD;
-  m.pose.position.x = 0.0;
-  m.pose.position.y = 0.0;
-  m.scale.x = 0.04;
-  m.scale.y = 0.04;
-  m.scale.z = 0.04;
+// Update a point of a marker, returns true if it moved
+static bool updatePoint(geometry_msgs::msg::Point & point, const Pose2d & pose)
+{
+  if (point.x == pose.x && point.y == pose.y)
+  {
+    return false;
+  }
+  point.x = pose.x;
+  point.y = pose.y;
+  return true;
+}
+
+bool Graph::getMsg(visualization_msgs::msg::MarkerArray & msg, rclcpp::Time & t)
+{
+  bool changed = false;
+  if (msg.markers.size() != 3)
+  {
+    // Nodes in red, odometry edges in blue, switchable (loop closure) edges in green
+    msg.markers.resize(3);
+    initMarker(msg.markers[0], "nodes", 0, visualization_msgs::msg::Marker::SPHERE_LIST,
+               0.08, 1.0, 0.0, 0.0);
+    initMarker(msg.markers[1], "edges", 0, visualization_msgs::msg::Marker::LINE_LIST,
+               0.04, 0.0, 0.0, 1.0);
+    initMarker(msg.markers[2], "edges", 1, visualization_msgs::msg::Marker::LINE_LIST,
+               0.04, 0.0, 1.0, 0.0);
+    changed = true;
+  }
+
+  for (auto & m : msg.markers)
+  {
+    m.header.stamp = t;
+  }
 
+  // Points are updated in place, so buffers are only reallocated as the graph grows
+  visualization_msgs::msg::Marker & nodes = msg.markers[0];
+  changed |= resizePoints(nodes, scans.size());
+  for (size_t i = 0; i < scans.size(); ++i)
+  {
+    changed |= updatePoint(nodes.points[i], scans[i]->getPose());
+  }
+
+  size_t num_switchable = 0;
   for (auto & constraint : constraints)
   {
-    auto & begin = scans[constraint->begin];
-    auto & end = scans[constraint->end];
-    m.points.resize(2);
-    m.points[0].x = begin->getPose().x;
-    m.points[0].y = begin->getPose().y;
-    m.points[1].x = end->getPose().x;
-    m.points[1].y = end->getPose().y;
-    if (constraint->switchable)
-    {
-      m.color.r = 0.0;
-      m.color.g = 1.0;
-      m.color.b = 0.0;
-      m.color.a = 1.0;
-    }
-    else
-    {
-      m.color.r = 0.0;
-      m.color.g = 0.0;
-      m.color.b = 1.0;
-      m.color.a = 1.0;
-    }
-    msg.markers.push_back(m);
-    ++m.id;
+    if (constraint->switchable) ++num_switchable;
+  }
+
+  visualization_msgs::msg::Marker & edges = msg.markers[1];
+  visualization_msgs::msg::Marker & switchable_edges = msg.markers[2];
+  changed |= resizePoints(edges, 2 * (constraints.size() - num_switchable));
+  changed |= resizePoints(switchable_edges, 2 * num_switchable);
+
+  size_t edge_index = 0, switchable_index = 0;
+  for (auto & constraint : constraints)
+  {
+    auto & points = constraint->switchable ? switchable_edges.points : edges.points;
+    size_t & index = constraint->switchable ? switchable_index : edge_index;
+    changed |= updatePoint(points[index++], scans[constraint->begin]->getPose());
+    changed |= updatePoint(points[index++], scans[constraint->end]->getPose());
+  }
+
+  return changed;
+}
+
+size_t Graph::memoryUsage()
+{
+  size_t bytes = sizeof(Graph);
+  bytes += scans.capacity() * sizeof(ScanPtr);
+  for (auto & scan : scans)
+  {
+    bytes += scan->memoryUsage();
+  }
+  bytes += constraints.capacity() * sizeof(ConstraintPtr);
+  bytes += constraints.size() * sizeof(Constraint);
+  bytes += descriptors_.capacity() * sizeof(ScanDescriptorPtr);
+  for (auto & descriptor : descriptors_)
+  {
+    bytes += descriptor->memoryUsage();
   }
+  return bytes;
 }
 
 }  // namespace ndt_2d
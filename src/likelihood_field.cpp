@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ndt_2d/likelihood_field.hpp>
+
+namespace ndt_2d
+{
+
+/**
+ * @brief Exact 1D squared distance transform (Felzenszwalb and Huttenlocher).
+ * @param f Squared distances to transform, replaced by the result.
+ * @param stride Spacing of the values within f.
+ * @param n Number of values.
+ */
+static void distanceTransform(float * f, size_t stride, size_t n,
+                              std::vector<float> & d, std::vector<int> & v, std::vector<float> & z)
+{
+  const float inf = std::numeric_limits<float>::infinity();
+  d.resize(n);
+  v.resize(n);
+  z.resize(n + 1);
+
+  // Lower envelope of the parabolas rooted at each value
+  int k = -1;
+  for (int q = 0; q < static_cast<int>(n); ++q)
+  {
+    float fq = f[q * stride];
+    if (fq == inf) continue;
+    float s = -inf;
+    while (k >= 0)
+    {
+      float fv = f[v[k] * stride];
+      s = ((fq + q * q) - (fv + v[k] * v[k])) / (2.0f * (q - v[k]));
+      if (s > z[k]) break;
+      --k;
+    }
+    ++k;
+    v[k] = q;
+    z[k] = (k == 0) ? -inf : s;
+    z[k + 1] = inf;
+  }
+
+  // No points on this line
+  if (k < 0) return;
+
+  int j = 0;
+  for (int q = 0; q < static_cast<int>(n); ++q)
+  {
+    while (z[j + 1] < q) ++j;
+    float dq = q - v[j];
+    d[q] = dq * dq + f[v[j] * stride];
+  }
+  for (size_t q = 0; q < n; ++q)
+  {
+    f[q * stride] = d[q];
+  }
+}
+
+LikelihoodField::LikelihoodField(double resolution, double sigma, double z_rand)
+: resolution_(resolution),
+  sigma_(sigma),
+  z_rand_(z_rand),
+  size_x_(0),
+  size_y_(0),
+  origin_x_(0.0),
+  origin_y_(0.0)
+{
+}
+
+void LikelihoodField::build(const std::vector<ScanPtr>::const_iterator & begin,
+                            const std::vector<ScanPtr>::const_iterator & end)
+{
+  // Transform all points into the map frame
+  std::vector<Eigen::Vector2d> points;
+  for (auto scan = begin; scan != end; ++scan)
+  {
+    Pose2d pose = (*scan)->getPose();
+    double cos_th = cos(pose.theta);
+    double sin_th = sin(pose.theta);
+    for (auto & point : (*scan)->getPoints())
+    {
+      points.emplace_back(pose.x + point.x * cos_th - point.y * sin_th,
+                          pose.y + point.x * sin_th + point.y * cos_th);
+    }
+  }
+
+  cells_.clear();
+  if (points.empty())
+  {
+    size_x_ = size_y_ = 0;
+    return;
+  }
+
+  // Bounding box of the points, padded so the likelihood falls to zero
+  const double padding = 3.0 * sigma_;
+  double min_x = points[0](0), max_x = points[0](0);
+  double min_y = points[0](1), max_y = points[0](1);
+  for (auto & point : points)
+  {
+    min_x = std::min(point(0), min_x);
+    max_x = std::max(point(0), max_x);
+    min_y = std::min(point(1), min_y);
+    max_y = std::max(point(1), max_y);
+  }
+  origin_x_ = min_x - padding;
+  origin_y_ = min_y - padding;
+  size_x_ = static_cast<size_t>((max_x - min_x + 2 * padding) / resolution_) + 1;
+  size_y_ = static_cast<size_t>((max_y - min_y + 2 * padding) / resolution_) + 1;
+
+  // Squared distance, in cells, to the nearest occupied cell
+  std::vector<float> distance(size_x_ * size_y_, std::numeric_limits<float>::infinity());
+  for (auto & point : points)
+  {
+    size_t x = (point(0) - origin_x_) / resolution_;
+    size_t y = (point(1) - origin_y_) / resolution_;
+    distance[y * size_x_ + x] = 0.0f;
+  }
+
+  // 2D transform is a 1D transform of the columns, then of the rows
+  std::vector<float> d, z;
+  std::vector<int> v;
+  for (size_t x = 0; x < size_x_; ++x)
+  {
+    distanceTransform(&distance[x], size_x_, size_y_, d, v, z);
+  }
+  for (size_t y = 0; y < size_y_; ++y)
+  {
+    distanceTransform(&distance[y * size_x_], 1, size_x_, d, v, z);
+  }
+
+  // Gaussian of the distance, quantized to a byte
+  const double scale = resolution_ * resolution_ / (2.0 * sigma_ * sigma_);
+  cells_.resize(size_x_ * size_y_);
+  for (size_t i = 0; i < cells_.size(); ++i)
+  {
+    cells_[i] = static_cast<uint8_t>(std::lround(255.0 * std::exp(-distance[i] * scale)));
+  }
+}
+
+double LikelihoodField::likelihood(const Eigen::Vector2d & point) const
+{
+  if (point(0) < origin_x_ || point(1) < origin_y_)
+  {
+    return 0.0;
+  }
+
+  size_t x = (point(0) - origin_x_) / resolution_;
+  size_t y = (point(1) - origin_y_) / resolution_;
+  if (x >= size_x_ || y >= size_y_)
+  {
+    return 0.0;
+  }
+
+  return cells_[y * size_x_ + x] * (1.0 / 255.0);
+}
+
+double LikelihoodField::score(const std::vector<Point> & points, const Pose2d & pose,
+                              size_t max_points) const
+{
+  if (points.empty() || max_points == 0) return 0.0;
+
+  // Subsample the scan
+  size_t points_to_use = std::min(max_points, points.size());
+  double step = static_cast<double>(points.size()) / points_to_use;
+
+  double cos_th = cos(pose.theta);
+  double sin_th = sin(pose.theta);
+
+  double score = 0.0;
+  for (size_t i = 0; i < points_to_use; ++i)
+  {
+    const Point & point = points[static_cast<size_t>(i * step)];
+    Eigen::Vector2d p(pose.x + point.x * cos_th - point.y * sin_th,
+                      pose.y + point.x * sin_th + point.y * cos_th);
+    score += likelihood(p);
+  }
+
+  // Beams far from the map (or outside the field) still have the z_rand
+  // likelihood, so a pose where every beam misses is unlikely, not impossible
+  return (1.0 - z_rand_) * score / points_to_use + z_rand_;
+}
+
+size_t LikelihoodField::memoryUsage() const
+{
+  return sizeof(LikelihoodField) + cells_.capacity() * sizeof(uint8_t);
+}
+
+}  // namespace ndt_2d
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ndt_2d/load_shedder.hpp>
+
+namespace ndt_2d
+{
+
+LoadShedder::LoadShedder(double max_lag, size_t recovery_scans)
+: max_lag_(max_lag),
+  recovery_scans_(recovery_scans),
+  escalation_lag_(0.0),
+  good_scans_(0),
+  level_(NOMINAL),
+  degraded_scans_(0)
+{
+}
+
+LoadShedder::Level LoadShedder::update(double lag)
+{
+  if (max_lag_ <= 0.0)
+  {
+    return NOMINAL;
+  }
+
+  uint8_t level = level_.load(std::memory_order_relaxed);
+  if (lag > max_lag_)
+  {
+    good_scans_ = 0;
+    // Falling lag means the current level is catching up, give it time
+    if (lag > escalation_lag_ && level < ODOMETRY_ONLY)
+    {
+      ++level;
+      escalation_lag_ = lag;
+    }
+  }
+  else if (lag < 0.5 * max_lag_)
+  {
+    escalation_lag_ = 0.0;
+    if (level > NOMINAL && ++good_scans_ >= recovery_scans_)
+    {
+      --level;
+      good_scans_ = 0;
+    }
+  }
+  else
+  {
+    // Between thresholds, hold the current level
+    good_scans_ = 0;
+  }
+
+  level_.store(level, std::memory_order_relaxed);
+  if (level > NOMINAL)
+  {
+    degraded_scans_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return static_cast<Level>(level);
+}
+
+LoadShedder::Level LoadShedder::level() const
+{
+  return static_cast<Level>(level_.load(std::memory_order_relaxed));
+}
+
+uint64_t LoadShedder::takeDegradedScans()
+{
+  return degraded_scans_.exchange(0, std::memory_order_relaxed);
+}
+
+}  // namespace ndt_2d
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <ndt_2d/metrics.hpp>
+
+namespace ndt_2d
+{
+
+LatencyHistogram::LatencyHistogram()
+{
+  reset();
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+  buckets_[getBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+
+  // Update max with compare-and-swap
+  uint64_t prev = max_.load(std::memory_order_relaxed);
+  while (nanoseconds > prev &&
+         !max_.compare_exchange_weak(prev, nanoseconds, std::memory_order_relaxed))
+  {
+  }
+}
+
+uint64_t LatencyHistogram::count() const
+{
+  return count_.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::quantile(double q) const
+{
+  // Sum the buckets rather than using count_, they may be momentarily out of sync
+  uint64_t total = 0;
+  for (auto & bucket : buckets_)
+  {
+    total += bucket.load(std::memory_order_relaxed);
+  }
+  if (total == 0)
+  {
+    return 0.0;
+  }
+
+  uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(q * total + 0.5));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < NUM_BUCKETS; ++i)
+  {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= target)
+    {
+      // Upper bound of the bucket can exceed the largest recorded value
+      uint64_t ns = std::min(getBucketUpperBound(i), max_.load(std::memory_order_relaxed));
+      return ns * 1e-9;
+    }
+  }
+  return max();
+}
+
+double LatencyHistogram::max() const
+{
+  return max_.load(std::memory_order_relaxed) * 1e-9;
+}
+
+void LatencyHistogram::reset()
+{
+  for (auto & bucket : buckets_)
+  {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  count_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+size_t LatencyHistogram::getBucket(uint64_t nanoseconds)
+{
+  if (nanoseconds < SUB_BUCKETS)
+  {
+    return nanoseconds;
+  }
+
+  // Index of most significant bit, at least 2 here
+  size_t msb = 63 - __builtin_clzll(nanoseconds);
+  // Next two bits select the sub bucket
+  size_t sub = (nanoseconds >> (msb - 2)) & (SUB_BUCKETS - 1);
+  return (msb - 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t LatencyHistogram::getBucketUpperBound(size_t bucket)
+{
+  if (bucket < SUB_BUCKETS)
+  {
+    return bucket;
+  }
+
+  size_t msb = bucket / SUB_BUCKETS + 1;
+  uint64_t sub = bucket % SUB_BUCKETS;
+  return ((SUB_BUCKETS + sub + 1) << (msb - 2)) - 1;
+}
+
+}  // namespace ndt_2d
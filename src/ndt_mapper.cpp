@@ -31,12 +31,18 @@
 #include <Eigen/Geometry>
 #include <cmath>
 #include <chrono>
+#include <future>
 #include <iostream>
 #include <thread>
+#include <unordered_set>
 #include <ndt_2d/conversions.hpp>
 #include <ndt_2d/ndt_model.hpp>
 #include <ndt_2d/ndt_mapper.hpp>
 #include <ndt_2d/occupancy_grid.hpp>
+#include <ndt_2d/scan_matcher_capture.hpp>
+#include <ndt_2d/scan_matcher_ndt.hpp>
+#include <ndt_2d/shared_map.hpp>
+#include <ndt_2d/tracepoints.hpp>
 #include <geometry_msgs/msg/pose_stamped.hpp>
 #include <geometry_msgs/msg/transform_stamped.hpp>
 #include <tf2_eigen/tf2_eigen.hpp>
@@ -45,27 +51,70 @@
 namespace ndt_2d
 {
 
+/**
+ * @brief Publish a message without copying it where possible.
+ *
+ * The message is loaned from the middleware if supported, otherwise it is
+ * allocated here and ownership passed to the publisher, so intra-process
+ * subscribers receive it without a copy.
+ */
+template <typename MessageT, typename FillT>
+static void publishMessage(const std::shared_ptr<rclcpp::Publisher<MessageT>> & pub, FillT fill)
+{
+  if (pub->can_loan_messages())
+  {
+    auto msg = pub->borrow_loaned_message();
+    fill(msg.get());
+    pub->publish(std::move(msg));
+  }
+  else
+  {
+    auto msg = std::make_unique<MessageT>();
+    fill(*msg);
+    pub->publish(std::move(msg));
+  }
+}
+
 Mapper::Mapper(const rclcpp::NodeOptions & options)
 : rclcpp::Node("ndt_2d_mapper", options),
   global_scans_processed_(0),
   map_update_available_(false),
-  laser_inverted_(false),
   optimization_last_(0),
   scan_matcher_loader_("ndt_2d", "ndt_2d::ScanMatcher"),
   typical_matcher_response_(-0.5),
   logger_(rclcpp::get_logger("ndt_2d_mapper")),
-  prev_odom_pose_is_initialized_(true)
+  prev_odom_pose_is_initialized_(true),
+  lost_scans_(0),
+  relocalization_in_progress_(false),
+  relocalization_result_available_(false)
 {
   map_resolution_ = this->declare_parameter<double>("resolution", 0.05);
   minimum_travel_distance_ = this->declare_parameter<double>("minimum_travel_distance", 0.1);
   minimum_travel_rotation_ = this->declare_parameter<double>("minimum_travel_rotation", 1.0);
   rolling_depth_ = this->declare_parameter<int>("rolling_depth", 10);
+  keyframe_min_novelty_ = this->declare_parameter<double>("keyframe_min_novelty", 0.0);
   robot_frame_ = this->declare_parameter<std::string>("robot_frame", "base_link");
   odom_frame_ = this->declare_parameter<std::string>("odom_frame", "odom");
   transform_timeout_ = this->declare_parameter<double>("transform_timeout", 0.2);
   use_barycenter_ = this->declare_parameter<bool>("use_barycenter", true);
   global_search_size_ = this->declare_parameter<double>("global_search_size", 0.2);
   global_search_limit_ = this->declare_parameter<int>("global_search_limit", 3);
+  std::string loop_closure_search =
+    this->declare_parameter<std::string>("loop_closure_search", "distance");
+  appearance_search_ = (loop_closure_search == "appearance");
+  if (!appearance_search_ && loop_closure_search != "distance")
+  {
+    RCLCPP_WARN(logger_, "Unknown loop_closure_search %s, using distance",
+                loop_closure_search.c_str());
+  }
+  appearance_min_travel_ = this->declare_parameter<double>("appearance_min_travel", 5.0);
+  if (appearance_search_)
+  {
+    // Candidate poses come from aligning centroids, which is only rough
+    declareWideSearchWindow("appearance_scan_matcher");
+  }
+  descriptor_range_ = this->declare_parameter<double>("descriptor_range", 10.0);
+  descriptor_threshold_ = this->declare_parameter<double>("descriptor_threshold", 0.4);
   optimization_node_limit_ = this->declare_parameter<int>("optimization_node_limit", 25);
 
   use_particle_filter_ = this->declare_parameter<bool>("use_particle_filter", false);
@@ -85,11 +134,41 @@ Mapper::Mapper(const rclcpp::NodeOptions & options)
     kld_z_ = this->declare_parameter<double>("kld_z", 2.3);
 
     filter_ = std::make_shared<ParticleFilter>(min_p, max_p, model);
+
+    std::string measurement_model =
+      this->declare_parameter<std::string>("measurement_model", "ndt");
+    if (measurement_model == "likelihood_field")
+    {
+      double resolution = this->declare_parameter<double>("likelihood_field_resolution", 0.05);
+      double sigma = this->declare_parameter<double>("likelihood_field_sigma", 0.1);
+      double z_rand = this->declare_parameter<double>("likelihood_field_z_rand", 0.05);
+      likelihood_field_max_beams_ =
+        this->declare_parameter<int>("likelihood_field_max_beams", 100);
+      likelihood_field_ = std::make_shared<LikelihoodField>(resolution, sigma, z_rand);
+    }
+    else if (measurement_model != "ndt")
+    {
+      RCLCPP_WARN(logger_, "Unknown measurement_model %s, using ndt",
+                  measurement_model.c_str());
+    }
   }
 
   enable_mapping_ = this->declare_parameter<bool>("enable_mapping", true);
   scan_matcher_type_ = this->declare_parameter<std::string>("scan_matcher_type",
                                                             "ndt_2d::ScanMatcherNDT");
+  capture_prefix_ = this->declare_parameter<std::string>("scan_matcher_capture_prefix", "");
+
+  relocalization_enabled_ = this->declare_parameter<bool>("enable_relocalization", true);
+  if (relocalization_enabled_)
+  {
+    // Candidate poses come from scan descriptors, which are only rough
+    declareWideSearchWindow("relocalization_scan_matcher");
+  }
+  relocalization_candidates_ = this->declare_parameter<int>("relocalization_candidates", 5);
+  relocalization_lost_scans_ = this->declare_parameter<int>("relocalization_lost_scans", 10);
+  relocalization_timeout_ = this->declare_parameter<double>("relocalization_timeout", 2.0);
+  relocalization_score_threshold_ =
+    this->declare_parameter<double>("relocalization_score_threshold", -0.25);
 
   solver_ = std::make_shared<CeresSolver>();
 
@@ -104,7 +183,40 @@ Mapper::Mapper(const rclcpp::NodeOptions & options)
   grid_ = std::make_shared<OccupancyGrid>(map_resolution_, occ_thresh);
 
   std::string map_file = this->declare_parameter<std::string>("map_file", "");
-  if (map_file.empty())
+  shared_map_file_ = this->declare_parameter<std::string>("shared_map_file", "");
+  shared_map_attached_ = false;
+  SharedMapPtr shared_map;
+  if (this->declare_parameter<bool>("attach_shared_map", false))
+  {
+    if (shared_map_file_.empty() || (enable_mapping_ && !use_particle_filter_))
+    {
+      RCLCPP_ERROR(logger_, "attach_shared_map requires localizing, and a shared_map_file");
+    }
+    else
+    {
+      shared_map = SharedMap::open(shared_map_file_);
+      if (!shared_map)
+      {
+        RCLCPP_ERROR(logger_, "Unable to attach to shared map %s", shared_map_file_.c_str());
+      }
+    }
+  }
+
+  if (shared_map)
+  {
+    // The NDT is used in place, only the scans and constraints are copied
+    RCLCPP_INFO(logger_, "Attached to shared map %s", shared_map_file_.c_str());
+    graph_ = std::make_shared<Graph>(use_barycenter_, *shared_map);
+    std::shared_ptr<const NDT> ndt = shared_map->getNDT();
+    if (ndt)
+    {
+      shared_map_model_ = std::make_shared<ScanMatcherNDTModel>(ndt);
+    }
+    shared_map_attached_ = true;
+    prev_odom_pose_is_initialized_ = false;
+    map_update_available_ = true;
+  }
+  else if (map_file.empty())
   {
     graph_ = std::make_shared<Graph>(use_barycenter_);
   }
@@ -114,23 +226,73 @@ Mapper::Mapper(const rclcpp::NodeOptions & options)
     prev_odom_pose_is_initialized_ = false;
     map_update_available_ = true;
   }
+  graph_->setDescriptorRange(descriptor_range_);
+
+  // Scan processing and anything that touches its state are serialized in one
+  // group, services that may be slow (such as loading a map) run in another
+  scan_callback_group_ = this->create_callback_group(
+    rclcpp::CallbackGroupType::MutuallyExclusive);
+  service_callback_group_ = this->create_callback_group(
+    rclcpp::CallbackGroupType::MutuallyExclusive);
+  rclcpp::SubscriptionOptions scan_sub_options;
+  scan_sub_options.callback_group = scan_callback_group_;
 
   configure_srv_ = this->create_service<ndt_2d::srv::Configure>("configure",
-    std::bind(&Mapper::configure, this, std::placeholders::_1, std::placeholders::_2));
+    std::bind(&Mapper::configure, this, std::placeholders::_1, std::placeholders::_2),
+    rmw_qos_profile_services_default, service_callback_group_);
 
+  // Intra-process communication does not support transient local durability
+  rclcpp::PublisherOptions map_pub_options;
+  map_pub_options.use_intra_process_comm = rclcpp::IntraProcessSetting::Disable;
   map_pub_ = this->create_publisher<nav_msgs::msg::OccupancyGrid>(
-    "map", rclcpp::QoS(rclcpp::KeepLast(1)).transient_local().reliable());
+    "map", rclcpp::QoS(rclcpp::KeepLast(1)).transient_local().reliable(), map_pub_options);
 
+  // Graph is only published when it changes, so late subscribers need the last one
   graph_pub_ = this->create_publisher<visualization_msgs::msg::MarkerArray>(
-    "graph", rclcpp::SystemDefaultsQoS());
+    "graph", rclcpp::QoS(rclcpp::KeepLast(1)).transient_local().reliable(), map_pub_options);
 
   pose_sub_ = this->create_subscription<geometry_msgs::msg::PoseWithCovarianceStamped>(
     "initialpose", rclcpp::SystemDefaultsQoS(),
-    std::bind(&Mapper::poseCallback, this, std::placeholders::_1));
+    std::bind(&Mapper::poseCallback, this, std::placeholders::_1), scan_sub_options);
+
+  rclcpp::QoS scan_qos(this->declare_parameter<int>("scan_qos_depth", 10));
+  std::string scan_qos_reliability =
+    this->declare_parameter<std::string>("scan_qos_reliability", "reliable");
+  if (scan_qos_reliability == "best_effort")
+  {
+    scan_qos.best_effort();
+  }
+  else if (scan_qos_reliability != "reliable")
+  {
+    RCLCPP_WARN(logger_, "Unknown scan_qos_reliability %s, using reliable",
+                scan_qos_reliability.c_str());
+  }
 
-  laser_sub_ = this->create_subscription<sensor_msgs::msg::LaserScan>(
-    "scan", rclcpp::SystemDefaultsQoS(),
-    std::bind(&Mapper::laserCallback, this, std::placeholders::_1));
+  // Scans from all lasers are merged into one scan per update
+  std::vector<std::string> scan_topics =
+    this->declare_parameter<std::vector<std::string>>("scan_topics", {"scan"});
+  scan_sync_tolerance_ = this->declare_parameter<double>("scan_sync_tolerance", 0.05);
+  scan_voxel_size_ = this->declare_parameter<double>("scan_voxel_size", 0.05);
+  deskew_ = this->declare_parameter<bool>("deskew", false);
+  if (scan_topics.empty())
+  {
+    RCLCPP_WARN(logger_, "No scan_topics, using scan");
+    scan_topics.push_back("scan");
+  }
+  lasers_.resize(scan_topics.size());
+  lasers_[0].sub = this->create_subscription<sensor_msgs::msg::LaserScan>(
+    scan_topics[0], scan_qos,
+    std::bind(&Mapper::laserCallback, this, std::placeholders::_1), scan_sub_options);
+  for (size_t i = 1; i < scan_topics.size(); ++i)
+  {
+    lasers_[i].sub = this->create_subscription<sensor_msgs::msg::LaserScan>(
+      scan_topics[i], scan_qos,
+      [this, i](sensor_msgs::msg::LaserScan::UniquePtr msg)
+      {
+        secondaryLaserCallback(std::move(msg), i);
+      },
+      scan_sub_options);
+  }
 
   if (use_particle_filter_)
   {
@@ -138,8 +300,42 @@ Mapper::Mapper(const rclcpp::NodeOptions & options)
       "particlecloud", rclcpp::SystemDefaultsQoS());
   }
 
+  double overload_max_lag = this->declare_parameter<double>("overload_max_lag", 0.5);
+  int overload_recovery_scans = this->declare_parameter<int>("overload_recovery_scans", 10);
+  load_shedder_ = std::make_unique<LoadShedder>(overload_max_lag, overload_recovery_scans);
+
+  metrics_publish_period_ = this->declare_parameter<double>("metrics_publish_period", 5.0);
+#ifdef NDT_2D_ENABLE_METRICS
+  metrics_pub_ = this->create_publisher<ndt_2d::msg::Metrics>(
+    "metrics", rclcpp::SystemDefaultsQoS());
+#endif
+
+  // Memory usage is published from a timer (rather than the publish thread)
+  // in the scan callback group, so that it is serialized with laserCallback(),
+  // which owns the particle filter and local scan matcher
+  double memory_publish_period = this->declare_parameter<double>("memory_publish_period", 10.0);
+  memory_budget_ = this->declare_parameter<int>("memory_budget", 0);
+  memory_pub_ = this->create_publisher<ndt_2d::msg::MemoryUsage>(
+    "memory_usage", rclcpp::SystemDefaultsQoS());
+  memory_srv_ = this->create_service<ndt_2d::srv::GetMemoryUsage>("get_memory_usage",
+    std::bind(&Mapper::getMemoryUsageCallback, this,
+              std::placeholders::_1, std::placeholders::_2),
+    rmw_qos_profile_services_default, scan_callback_group_);
+  if (memory_publish_period > 0.0)
+  {
+    memory_timer_ = this->create_wall_timer(
+      std::chrono::duration<double>(memory_publish_period),
+      std::bind(&Mapper::publishMemoryUsage, this), scan_callback_group_);
+  }
+
+  // Changes are applied by the next laserCallback(), without reloading the map
+  parameters_callback_ = this->add_on_set_parameters_callback(
+    std::bind(&Mapper::parametersCallback, this, std::placeholders::_1));
+
   map_publish_thread_ = std::make_unique<std::thread>(&Mapper::mapPublishThread, this);
   loop_closure_thread_ = std::make_unique<std::thread>(&Mapper::loopClosureThread, this);
+  relocalization_thread_ = std::make_unique<std::thread>(&Mapper::relocalizationThread, this);
+  rebuild_thread_ = std::make_unique<std::thread>(&Mapper::rebuildThread, this);
 }
 
 Mapper::~Mapper()
@@ -147,14 +343,29 @@ Mapper::~Mapper()
   // Shut down threads
   map_publish_thread_->join();
   loop_closure_thread_->join();
+  relocalization_thread_->join();
+  rebuild_thread_->join();
   // Clean these up to avoid pluginlib errors
   local_scan_matcher_.reset();
   global_scan_matcher_.reset();
+  appearance_scan_matcher_.reset();
+  relocalization_scan_matcher_.reset();
 }
 
 void Mapper::configure(const std::shared_ptr<srv::Configure::Request> request,
                        std::shared_ptr<srv::Configure::Response>)
 {
+  // Load the map before locking, so scans are processed in the meantime
+  GraphPtr graph;
+  if (request->action & srv::Configure::Request::LOAD_FROM_FILE)
+  {
+    RCLCPP_INFO(logger_, "Loading map from %s", request->filename.c_str());
+    graph = std::make_shared<Graph>(use_barycenter_, request->filename);
+    graph->setDescriptorRange(descriptor_range_);
+  }
+
+  std::lock_guard<std::mutex> scan_lock(scan_mutex_);
+
   // Enable/disable
   if (request->action & srv::Configure::Request::ENABLE_MAPPING)
   {
@@ -169,11 +380,10 @@ void Mapper::configure(const std::shared_ptr<srv::Configure::Request> request,
     prev_odom_pose_is_initialized_ = false;
   }
 
-  if (request->action & srv::Configure::Request::LOAD_FROM_FILE)
+  if (graph)
   {
-    RCLCPP_INFO(logger_, "Loading map from %s", request->filename.c_str());
     std::lock_guard<std::mutex> lock(graph_mutex_);
-    graph_ = std::make_shared<Graph>(use_barycenter_, request->filename);
+    graph_ = graph;
     map_update_available_ = true;
     prev_odom_pose_is_initialized_ = false;
   }
@@ -187,6 +397,8 @@ void Mapper::configure(const std::shared_ptr<srv::Configure::Request> request,
 
 void Mapper::poseCallback(const geometry_msgs::msg::PoseWithCovarianceStamped::ConstSharedPtr& msg)
 {
+  std::lock_guard<std::mutex> scan_lock(scan_mutex_);
+
   if (enable_mapping_ && prev_odom_pose_is_initialized_)
   {
     RCLCPP_WARN(logger_, "Ignoring initial pose, already mapping");
@@ -222,11 +434,12 @@ void Mapper::poseCallback(const geometry_msgs::msg::PoseWithCovarianceStamped::C
                   sqrt(msg->pose.covariance[7]),
                   sqrt(msg->pose.covariance[35]));
     // Publish visualization
-    geometry_msgs::msg::PoseArray msg;
-    msg.header.frame_id = "map";
-    msg.header.stamp = this->now();
-    filter_->getMsg(msg);
-    particle_pub_->publish(msg);
+    publishMessage(particle_pub_, [this](geometry_msgs::msg::PoseArray & msg)
+    {
+      msg.header.frame_id = "map";
+      msg.header.stamp = this->now();
+      filter_->getMsg(msg);
+    });
   }
   else if (enable_mapping_)
   {
@@ -264,61 +477,123 @@ void Mapper::poseCallback(const geometry_msgs::msg::PoseWithCovarianceStamped::C
               prev_robot_pose_.y, prev_robot_pose_.theta);
 }
 
-void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& msg)
+void Mapper::laserCallback(sensor_msgs::msg::LaserScan::UniquePtr msg)
+{
+  std::lock_guard<std::mutex> scan_lock(scan_mutex_);
+
+  // A held scan is processed with whatever has arrived once the next one comes
+  if (pending_scan_)
+  {
+    handleScan(std::move(pending_scan_));
+  }
+
+  // Scans of the other lasers may arrive shortly after this one
+  if (waitingForLasers(*msg))
+  {
+    pending_scan_ = std::move(msg);
+    return;
+  }
+
+  handleScan(std::move(msg));
+}
+
+void Mapper::handleScan(sensor_msgs::msg::LaserScan::UniquePtr msg)
 {
+  NDT_2D_TRACEPOINT(scan_receive, graph_->scans.size(),
+                    rclcpp::Time(msg->header.stamp).nanoseconds());
+
   // Save data from laser scan message
   if (range_max_ < 0) range_max_ = msg->range_max;
-  if (laser_frame_ == "")
+  if (lasers_[0].frame.empty())
   {
-    try
-    {
-      // Determine pose of laser relative to base
-      auto t = tf2_buffer_->lookupTransform(robot_frame_, msg->header.frame_id, tf2::TimePointZero);
-      laser_transform_ = fromMsg(t);
-      if (std::fabs(t.transform.rotation.x) > 0.02 ||
-          std::fabs(t.transform.rotation.y) > 0.02)
-      {
-        RCLCPP_WARN(logger_, "Treating laser as inverted");
-        laser_inverted_ = true;
-      }
-      RCLCPP_INFO(logger_, "Robot -> laser transform: %f, %f, %f",
-                           laser_transform_.x, laser_transform_.y, laser_transform_.theta);
-    }
-    catch (const tf2::TransformException& ex)
+    if (!initializeLaser(lasers_[0], *msg))
     {
-      RCLCPP_ERROR(logger_, "Could not transform %s to %s frame.",
-                   robot_frame_.c_str(), msg->header.frame_id.c_str());
       return;
     }
-    laser_frame_ = msg->header.frame_id;
 
     // range_max_ must be set before building the global scan matcher NDT
     if (use_particle_filter_ || !enable_mapping_)
     {
       // When localizing, global scan matcher uses ALL scans
-      global_scan_matcher_ = scan_matcher_loader_.createSharedInstance(scan_matcher_type_);
-      global_scan_matcher_->initialize("global_scan_matcher", this, range_max_);
-      // Note: no need to lock graph here, since this thread is the only one that adds scans
-      global_scan_matcher_->addScans(graph_->scans.begin(), graph_->scans.end());
+      global_scan_matcher_ = createScanMatcher("global_scan_matcher");
+      // Use the NDT of an attached map if the matcher can, otherwise build one
+      if (!shared_map_model_ || !global_scan_matcher_->setModel(shared_map_model_))
+      {
+        // Note: no need to lock graph here, since this thread is the only one that adds scans
+        global_scan_matcher_->addScans(graph_->scans.begin(), graph_->scans.end());
+      }
+      shared_map_model_.reset();
+      global_scan_matcher_graph_ = graph_;
+      if (likelihood_field_)
+      {
+        likelihood_field_->build(graph_->scans.begin(), graph_->scans.end());
+      }
+      writeSharedMap();
     }
     else
     {
       // When map building, global scan matcher is just for loop closures
-      global_scan_matcher_ = scan_matcher_loader_.createSharedInstance(scan_matcher_type_);
-      global_scan_matcher_->initialize("global_scan_matcher", this, range_max_);
+      global_scan_matcher_ = createScanMatcher("global_scan_matcher");
+    }
+
+    if (appearance_search_)
+    {
+      appearance_scan_matcher_ = createScanMatcher("appearance_scan_matcher");
     }
 
-    local_scan_matcher_ = scan_matcher_loader_.createSharedInstance(scan_matcher_type_);
-    local_scan_matcher_->initialize("local_scan_matcher", this, range_max_);
+    local_scan_matcher_ = createScanMatcher("local_scan_matcher");
+
+    if (relocalization_enabled_)
+    {
+      // Scans are added by the relocalization thread, when first needed
+      relocalization_scan_matcher_ = createScanMatcher("relocalization_scan_matcher");
+    }
+  }
+
+  applyParameterChanges();
+
+  // Only relocalize automatically when localizing in an existing map
+  bool localizing = use_particle_filter_ || !enable_mapping_;
+  bool can_relocalize = relocalization_enabled_ && localizing && !graph_->scans.empty();
+
+  // Apply the result of a completed relocalization
+  {
+    std::lock_guard<std::mutex> lock(relocalization_mutex_);
+    if (relocalization_result_available_ && localizing)
+    {
+      const Pose2d & pose = relocalization_result_pose_;
+      if (use_particle_filter_)
+      {
+        filter_->init(pose.x, pose.y, pose.theta, 0.1, 0.1, 0.05);
+      }
+
+      std::lock_guard<std::mutex> pose_lock(prev_pose_mutex_);
+      prev_robot_pose_ = pose;
+      prev_odom_pose_ = relocalization_result_odom_;
+      prev_odom_pose_is_initialized_ = true;
+      lost_scans_ = 0;
+      RCLCPP_INFO(logger_, "Relocalized to %f, %f, %f", pose.x, pose.y, pose.theta);
+    }
+    relocalization_result_available_ = false;
   }
 
   // If we have loaded a previous map, need to localize first
-  if (!prev_odom_pose_is_initialized_)
+  if (!prev_odom_pose_is_initialized_ && !can_relocalize)
   {
     RCLCPP_WARN(logger_, "Can not handle scan, not localized within map");
     return;
   }
 
+  // Shed load if we are falling behind the incoming scans
+  double lag = (this->now() - rclcpp::Time(msg->header.stamp)).seconds();
+  LoadShedder::Level prev_level = load_shedder_->level();
+  LoadShedder::Level level = load_shedder_->update(lag);
+  if (level != prev_level)
+  {
+    RCLCPP_WARN(logger_, "Scan processing lag %f, degradation level %d -> %d",
+                lag, prev_level, level);
+  }
+
   // Find pose of the robot in odometry frame
   geometry_msgs::msg::PoseStamped odom_pose_tf;
   odom_pose_tf.header.stamp = msg->header.stamp;
@@ -326,6 +601,7 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
   odom_pose_tf.pose.orientation.w = 1.0;
   try
   {
+    NDT_2D_SCOPED_TIMER(latency_[TF_LOOKUP]);
     tf2_buffer_->transform(odom_pose_tf, odom_pose_tf, odom_frame_,
                            tf2::durationFromSec(transform_timeout_));
   }
@@ -340,6 +616,18 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
   Pose2d odom_pose = fromMsg(odom_pose_tf);
   Pose2d robot_pose;
 
+  if (!prev_odom_pose_is_initialized_)
+  {
+    // Poses are initialized once the relocalization thread finds a match
+    ScanPtr scan = std::make_shared<Scan>(graph_->scans.size());
+    std::vector<Point> points;
+    getScanPoints(*msg, points);
+    scan->setPoints(points);
+    requestRelocalization(scan, odom_pose);
+    RCLCPP_WARN(logger_, "Can not handle scan, relocalizing within map");
+    return;
+  }
+
   // Make sure we have traveled far enough
   if (!graph_->scans.empty())
   {
@@ -361,54 +649,38 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
     robot_pose.x = prev_robot_pose_.x + (dx * cos(heading)) - (dy * sin(heading));
     robot_pose.y = prev_robot_pose_.y + (dx * sin(heading)) + (dy * cos(heading));
     robot_pose.theta = angles::normalize_angle(prev_robot_pose_.theta + dth);
+
+    // Under heavy overload, skip scan matching and just propagate odometry
+    // (the particle filter still needs the motion update, handled below)
+    if (level == LoadShedder::ODOMETRY_ONLY && !use_particle_filter_)
+    {
+      std::lock_guard<std::mutex> lock(prev_pose_mutex_);
+      prev_odom_pose_ = odom_pose;
+      prev_robot_pose_ = robot_pose;
+      return;
+    }
   }
 
   // Need to convert the scan into an ndt_2d style
   ScanPtr scan = std::make_shared<Scan>(graph_->scans.size());
   scan->setPose(robot_pose);
   std::vector<Point> points;
-  points.reserve(msg->ranges.size());
-
-  // Minor optimization
-  double cos_lt = cos(laser_transform_.theta);
-  double sin_lt = sin(laser_transform_.theta);
+  getScanPoints(*msg, points);
+  scan->setPoints(points);
 
-  // Using this scan, convert ROS msg into ndt_2d style scan
-  if (laser_inverted_)
-  {
-    for (size_t i = msg->ranges.size() - 1; i > 0; --i)
-    {
-      // Filter out NANs and scans beyond max range
-      if (std::isnan(msg->ranges[i]) || msg->ranges[i] > range_max_) continue;
-      // Project point in laser frame
-      double angle = -(msg->angle_min + i * msg->angle_increment);
-      Point lp(cos(angle) * msg->ranges[i],
-               sin(angle) * msg->ranges[i]);
-      // Transform to robot frame
-      Point point(cos_lt * lp.x - sin_lt * lp.y + laser_transform_.x,
-                  sin_lt * lp.x + cos_lt * lp.y + laser_transform_.y);
-      // Add point to scan
-      points.push_back(point);
-    }
-  }
-  else
+  // Under load, match with every other beam, but keyframes keep all points
+  ScanPtr match_scan = scan;
+  if (level >= LoadShedder::REDUCED_BEAMS)
   {
-    for (size_t i = 0; i < msg->ranges.size(); ++i)
+    for (size_t i = 1; 2 * i < points.size(); ++i)
     {
-      // Filter out NANs and scans beyond max range
-      if (std::isnan(msg->ranges[i]) || msg->ranges[i] > range_max_) continue;
-      // Project point in laser frame
-      double angle = (msg->angle_min + i * msg->angle_increment);
-      Point lp(cos(angle) * msg->ranges[i],
-               sin(angle) * msg->ranges[i]);
-      // Transform to robot frame
-      Point point(cos_lt * lp.x - sin_lt * lp.y + laser_transform_.x,
-                  sin_lt * lp.x + cos_lt * lp.y + laser_transform_.y);
-      // Add point to scan
-      points.push_back(point);
+      points[i] = points[2 * i];
     }
+    points.resize((points.size() + 1) / 2);
+    match_scan = std::make_shared<Scan>(scan->getId());
+    match_scan->setPose(scan->getPose());
+    match_scan->setPoints(points);
   }
-  scan->setPoints(points);
 
   if (use_particle_filter_)
   {
@@ -428,24 +700,52 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
     RCLCPP_INFO(logger_, "Updating filter with control %f %f %f", robot_delta(0),
                          robot_delta(1), robot_delta(2));
 
-    filter_->update(robot_delta(0), robot_delta(1), robot_delta(2));
-    filter_->measure(global_scan_matcher_, scan);
-    filter_->resample(kld_err_, kld_z_);
+    {
+      NDT_2D_SCOPED_TIMER(latency_[FILTER_UPDATE]);
+      filter_->update(robot_delta(0), robot_delta(1), robot_delta(2));
+    }
+    // Under heavy overload, particles are only moved by odometry
+    if (level < LoadShedder::ODOMETRY_ONLY)
+    {
+      {
+        NDT_2D_SCOPED_TIMER(latency_[FILTER_MEASURE]);
+        NDT_2D_TRACEPOINT(match_start, scan->getId());
+        if (likelihood_field_)
+        {
+          filter_->measure(*likelihood_field_, match_scan, likelihood_field_max_beams_);
+        }
+        else
+        {
+          filter_->measure(global_scan_matcher_, match_scan);
+        }
+        NDT_2D_TRACEPOINT(match_end, scan->getId());
+      }
+      {
+        NDT_2D_SCOPED_TIMER(latency_[FILTER_RESAMPLE]);
+        filter_->resample(kld_err_, kld_z_);
+      }
+    }
 
     auto mean = filter_->getMean();
     Pose2d mean_pose(mean(0), mean(1), mean(2));
     scan->setPose(mean_pose);
 
     // Publish visualization
-    geometry_msgs::msg::PoseArray msg;
-    msg.header.frame_id = "map";
-    msg.header.stamp = this->now();
-    filter_->getMsg(msg);
-    particle_pub_->publish(msg);
+    publishMessage(particle_pub_, [this](geometry_msgs::msg::PoseArray & msg)
+    {
+      msg.header.frame_id = "map";
+      msg.header.stamp = this->now();
+      filter_->getMsg(msg);
+    });
 
     RCLCPP_INFO(logger_, "New pose: %f, %f, %f",
                 scan->getPose().x, scan->getPose().y, scan->getPose().theta);
 
+    if (can_relocalize && relocalization_lost_scans_ > 0 && level < LoadShedder::ODOMETRY_ONLY)
+    {
+      checkLocalization(scan, global_scan_matcher_->scoreScan(scan), odom_pose);
+    }
+
     std::lock_guard<std::mutex> lock(prev_pose_mutex_);
     prev_odom_pose_ = odom_pose;
     prev_robot_pose_ = scan->getPose();
@@ -459,18 +759,27 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
     if (!graph_->scans.empty())
     {
       // Determine rolling window
-      size_t start = (graph_->scans.size() <= rolling_depth_) ? 0 : graph_->scans.size() - 10;
+      size_t start = (graph_->scans.size() <= rolling_depth_) ?
+                     0 : graph_->scans.size() - rolling_depth_;
       auto rolling = graph_->scans.begin() + start;
 
       // Create scan matcher with rolling window scans
-      local_scan_matcher_->reset();
-      local_scan_matcher_->addScans(rolling, graph_->scans.end());
+      {
+        NDT_2D_SCOPED_TIMER(latency_[NDT_BUILD]);
+        local_scan_matcher_->reset();
+        local_scan_matcher_->addScans(rolling, graph_->scans.end());
+      }
 
       // Local consistency - match new scan against last 10 scans
       Pose2d correction;
       Eigen::Matrix3d covariance;
-      double uncorrected_score = local_scan_matcher_->scoreScan(scan);
-      matched_score = local_scan_matcher_->matchScan(scan, correction, covariance);
+      double uncorrected_score = local_scan_matcher_->scoreScan(match_scan);
+      {
+        NDT_2D_SCOPED_TIMER(latency_[SCAN_MATCHING]);
+        NDT_2D_TRACEPOINT(match_start, scan->getId());
+        matched_score = local_scan_matcher_->matchScan(match_scan, correction, covariance);
+        NDT_2D_TRACEPOINT(match_end, scan->getId());
+      }
       RCLCPP_INFO(logger_, "           %f, %f, %f (%f -> %f)",
                   correction.x, correction.y, correction.theta, uncorrected_score, matched_score);
       typical_matcher_response_ = 0.95 * typical_matcher_response_ + 0.05 * matched_score;
@@ -480,6 +789,18 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
       correction.y += scan->getPose().y;
       correction.theta += scan->getPose().theta;
       scan->setPose(correction);
+      match_scan->setPose(correction);
+
+      // Scans that add little to the local map are only used for tracking
+      double novelty = local_scan_matcher_->novelty(match_scan);
+      if (novelty < keyframe_min_novelty_)
+      {
+        RCLCPP_INFO(logger_, "Not adding scan, novelty %f", novelty);
+        std::lock_guard<std::mutex> lock(prev_pose_mutex_);
+        prev_odom_pose_ = odom_pose;
+        prev_robot_pose_ = scan->getPose();
+        return;
+      }
 
       // Add odom constraint to the graph
       ConstraintPtr constraint = makeConstraint(graph_->scans.back(), scan, covariance);
@@ -494,6 +815,7 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
     {
       std::lock_guard<std::mutex> lock(graph_mutex_);
       graph_->scans.push_back(scan);
+      NDT_2D_TRACEPOINT(graph_insert, scan->getId(), graph_->constraints.size());
     }
 
     // Update previous pose tracking (under lock)
@@ -507,8 +829,14 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
     // Not using particle filter, nor mapping, just track motion of robot
     Pose2d correction;
     Eigen::Matrix3d covariance;
-    double uncorrected_score = global_scan_matcher_->scoreScan(scan);
-    double score = global_scan_matcher_->matchScan(scan, correction, covariance);
+    double uncorrected_score = global_scan_matcher_->scoreScan(match_scan);
+    double score;
+    {
+      NDT_2D_SCOPED_TIMER(latency_[SCAN_MATCHING]);
+      NDT_2D_TRACEPOINT(match_start, scan->getId());
+      score = global_scan_matcher_->matchScan(match_scan, correction, covariance);
+      NDT_2D_TRACEPOINT(match_end, scan->getId());
+    }
     RCLCPP_INFO(logger_, "           %f, %f, %f (%f -> %f)",
                 correction.x, correction.y, correction.theta, uncorrected_score, score);
 
@@ -518,103 +846,791 @@ void Mapper::laserCallback(const sensor_msgs::msg::LaserScan::ConstSharedPtr& ms
     correction.theta += scan->getPose().theta;
     scan->setPose(correction);
 
+    if (can_relocalize && relocalization_lost_scans_ > 0)
+    {
+      checkLocalization(scan, score, odom_pose);
+    }
+
     std::lock_guard<std::mutex> lock(prev_pose_mutex_);
     prev_odom_pose_ = odom_pose;
     prev_robot_pose_ = scan->getPose();
   }
 }
 
-void Mapper::loopClosureThread()
+void Mapper::requestRelocalization(const ScanPtr & scan, const Pose2d & odom_pose)
 {
-  while (rclcpp::ok())
+  std::lock_guard<std::mutex> lock(relocalization_mutex_);
+  if (relocalization_in_progress_)
   {
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    return;
+  }
 
-    // Only do loop closure if we are mapping
-    if (!enable_mapping_)
+  // Copy the scan, the caller may continue to update its pose
+  relocalization_request_ = std::make_shared<Scan>(scan->getId());
+  relocalization_request_->setPoints(scan->getPoints());
+  relocalization_request_odom_ = odom_pose;
+  relocalization_in_progress_ = true;
+  relocalization_cv_.notify_one();
+}
+
+void Mapper::checkLocalization(const ScanPtr & scan, double score, const Pose2d & odom_pose)
+{
+  // Score is negative, larger values are worse
+  if (!std::isfinite(score) || score > relocalization_score_threshold_)
+  {
+    ++lost_scans_;
+  }
+  else
+  {
+    lost_scans_ = 0;
+  }
+
+  if (lost_scans_ >= relocalization_lost_scans_)
+  {
+    // Keep tracking while the relocalization thread searches
+    RCLCPP_WARN(logger_, "Scans no longer match map, relocalizing (score %f)", score);
+    requestRelocalization(scan, odom_pose);
+    lost_scans_ = 0;
+  }
+}
+
+rcl_interfaces::msg::SetParametersResult Mapper::parametersCallback(
+  const std::vector<rclcpp::Parameter> & parameters)
+{
+  // Parameters that can be changed without restarting
+  static const std::set<std::string> reconfigurable =
+  {
+    "kld_err", "kld_z", "keyframe_min_novelty", "likelihood_field_max_beams",
+    "likelihood_field_resolution", "likelihood_field_sigma", "likelihood_field_z_rand",
+    "max_particles",
+    "min_particles", "minimum_travel_distance", "minimum_travel_rotation",
+    "occupancy_threshold", "odom_alpha1", "odom_alpha2", "odom_alpha3", "odom_alpha4",
+    "odom_alpha5", "resolution", "scan_matcher_type"
+  };
+  static const std::vector<std::string> reconfigurable_prefixes =
+  {
+    "appearance_scan_matcher.", "global_scan_matcher.", "local_scan_matcher.",
+    "relocalization_scan_matcher."
+  };
+
+  // Limits of numeric parameters, only checked when they are changed
+  static const std::map<std::string, std::pair<double, double>> limits =
+  {
+    {"kld_err", {1e-9, 1.0}}, {"kld_z", {1e-9, 100.0}}, {"keyframe_min_novelty", {0.0, 1.0}},
+    {"likelihood_field_max_beams", {1.0, 1e9}}, {"likelihood_field_resolution", {1e-3, 1e3}},
+    {"likelihood_field_sigma", {1e-3, 1e3}}, {"likelihood_field_z_rand", {0.0, 1.0}},
+    {"max_particles", {1.0, 1e9}},
+    {"min_particles", {1.0, 1e9}}, {"minimum_travel_distance", {0.0, 1e9}},
+    {"minimum_travel_rotation", {0.0, 1e9}}, {"occupancy_threshold", {0.0, 1.0}},
+    {"odom_alpha1", {0.0, 1e9}}, {"odom_alpha2", {0.0, 1e9}}, {"odom_alpha3", {0.0, 1e9}},
+    {"odom_alpha4", {0.0, 1e9}}, {"odom_alpha5", {0.0, 1e9}}, {"resolution", {1e-3, 1e3}}
+  };
+
+  rcl_interfaces::msg::SetParametersResult result;
+  result.successful = true;
+  auto reject = [&result](const std::string & reason)
+  {
+    result.successful = false;
+    result.reason = reason;
+    return result;
+  };
+
+  // Value after this change, for checks involving more than one parameter
+  auto value = [this, &parameters](const std::string & name)
+  {
+    for (auto & param : parameters)
+    {
+      if (param.get_name() == name) return param;
+    }
+    return this->get_parameter(name);
+  };
+
+  std::lock_guard<std::mutex> lock(parameters_mutex_);
+  std::vector<std::string> changed;
+  for (auto & param : parameters)
+  {
+    const std::string & name = param.get_name();
+    if (!this->has_parameter(name))
     {
+      // Parameter is being declared, not changed
       continue;
     }
 
-    // Determine number of scans (under lock)
-    size_t num_scans;
+    bool valid = reconfigurable.count(name) > 0;
+    for (auto & prefix : reconfigurable_prefixes)
     {
-      std::lock_guard<std::mutex> lock(graph_mutex_);
-      num_scans = graph_->scans.size();
+      valid = valid || name.compare(0, prefix.size(), prefix) == 0;
+    }
+    if (!valid)
+    {
+      return reject(name + " can not be changed at runtime, restart the node to change it");
     }
 
-    // Can't do a global search until we have at least enough scans
-    if (num_scans <= rolling_depth_)
+    if (param.get_type() != this->get_parameter(name).get_type())
     {
-      continue;
+      return reject(name + " must be a " + rclcpp::to_string(this->get_parameter(name).get_type()));
     }
 
-    // We don't process the initial rolling window for loop closure
-    if (global_scans_processed_ <= rolling_depth_)
+    auto limit = limits.find(name);
+    if (limit != limits.end())
     {
-      global_scans_processed_ = rolling_depth_ + 1;
+      double number = (param.get_type() == rclcpp::ParameterType::PARAMETER_INTEGER) ?
+                      param.as_int() : param.as_double();
+      if (!(number >= limit->second.first && number <= limit->second.second))
+      {
+        return reject(name + " must be between " + std::to_string(limit->second.first) +
+                      " and " + std::to_string(limit->second.second));
+      }
     }
 
-    bool new_matches = false;
-    if (num_scans > global_scans_processed_)
+    if (name == "scan_matcher_type")
     {
-      // We have new scans to process
-      for (; global_scans_processed_ < num_scans; ++global_scans_processed_)
+      // Try loading the plugin, so that a bad type does not fail later in laserCallback()
+      try
       {
-        // Determine where rolling window starts
-        size_t rolling = global_scans_processed_ - rolling_depth_;
+        std::lock_guard<std::mutex> loader_lock(scan_matcher_loader_mutex_);
+        scan_matcher_loader_.createSharedInstance(param.as_string());
+      }
+      catch (const pluginlib::PluginlibException & e)
+      {
+        return reject("Unable to load scan matcher " + param.as_string() + ": " + e.what());
+      }
+    }
 
-        // Grab a reference to the scan we are loop closing for and find nearest scan
-        ScanPtr scan;
-        std::vector<size_t> scans;
-        {
-          std::lock_guard<std::mutex> lock(graph_mutex_);
-          scan = graph_->scans[global_scans_processed_];
-          scans = graph_->findNearest(scan, global_search_size_, rolling);
-        }
+    changed.push_back(name);
+  }
 
-        // Now do global loop closure scan matching
-        size_t num_scans_to_check = global_search_limit_;
-        for (auto i : scans)
-        {
-          // Lock graph to access scans
-          std::unique_lock<std::mutex> lock(graph_mutex_);
-          const auto candidate = graph_->scans[i];
-          if (candidate->getPoints().empty()) continue;
+  // Only declared when using the particle filter
+  if (this->has_parameter("min_particles") &&
+      value("min_particles").as_int() > value("max_particles").as_int())
+  {
+    return reject("min_particles must not be greater than max_particles");
+  }
 
-          // Take one additional scan on either side of candidate
-          size_t begin_idx = (i > 0) ? i - 1: i;
-          size_t end_idx = (i < rolling) ? i + 1 : i;
-          auto begin = graph_->scans.begin() + begin_idx;
-          auto end = graph_->scans.begin() + end_idx;
+  changed_parameters_.insert(changed.begin(), changed.end());
+  return result;
+}
 
-          // Build NDT of candidate region
-          global_scan_matcher_->reset();
-          global_scan_matcher_->addScans(begin, end);
+void Mapper::applyParameterChanges()
+{
+  // Swap in models rebuilt since the last scan
+  ScanMatcherPtr rebuilt_matcher;
+  GraphPtr rebuilt_graph;
+  LikelihoodFieldPtr rebuilt_field;
+  {
+    std::lock_guard<std::mutex> lock(rebuild_mutex_);
+    rebuilt_matcher.swap(rebuild_matcher_result_);
+    rebuilt_graph.swap(rebuild_matcher_graph_);
+    rebuilt_field.swap(rebuild_field_result_);
+  }
 
-          // Can unlock graph now before we do the (slow) scan matching
-          lock.unlock();
+  if (rebuilt_matcher)
+  {
+    std::lock_guard<std::mutex> lock(graph_mutex_);
+    global_scan_matcher_ = rebuilt_matcher;
+    global_scan_matcher_graph_ = rebuilt_graph;
+    writeSharedMap();
+  }
 
-          // Try to match scans
-          Pose2d correction;
-          Eigen::Matrix3d covariance;
-          double score = global_scan_matcher_->matchScan(scan, correction, covariance);
+  if (rebuilt_field)
+  {
+    likelihood_field_ = rebuilt_field;
+  }
 
-          if (std::isfinite(score) && (score < typical_matcher_response_))
-          {
-            new_matches = true;
-            RCLCPP_INFO(logger_, "***Adding loop closure from %lu to %lu (score %f)",
-                                 candidate->getId(), scan->getId(), score);
+  std::set<std::string> changed;
+  {
+    std::lock_guard<std::mutex> lock(parameters_mutex_);
+    changed.swap(changed_parameters_);
+  }
 
-            // Correct pose
-            correction.x += scan->getPose().x;
-            correction.y += scan->getPose().y;
-            correction.theta += scan->getPose().theta;
-            scan->setPose(correction);
+  if (changed.empty())
+  {
+    return;
+  }
+  RCLCPP_INFO(logger_, "Applying %lu parameter changes", changed.size());
 
-            // Add constraint to the graph
-            ConstraintPtr constraint = makeConstraint(candidate, scan, covariance);
-            constraint->switchable = true;
+  // Names are sorted, so any with prefix start at lower_bound()
+  auto changedPrefix = [&changed](const std::string & prefix)
+  {
+    auto it = changed.lower_bound(prefix);
+    return it != changed.end() && it->compare(0, prefix.size(), prefix) == 0;
+  };
+
+  // Scan matchers are replaced, the map and other matchers are unaffected
+  bool type_changed = changed.count("scan_matcher_type") > 0;
+  if (type_changed)
+  {
+    scan_matcher_type_ = this->get_parameter("scan_matcher_type").as_string();
+  }
+
+  if (type_changed || changedPrefix("local_scan_matcher."))
+  {
+    // Rebuilt from the rolling window for every scan, so nothing to rebuild
+    local_scan_matcher_ = createScanMatcher("local_scan_matcher");
+  }
+
+  // Whole map models take too long to build between scans, the current ones
+  // are used until the rebuild thread has replaced them
+  ScanMatcherPtr rebuild_matcher;
+  LikelihoodFieldPtr rebuild_field;
+
+  if (type_changed || changedPrefix("global_scan_matcher."))
+  {
+    ScanMatcherPtr matcher = createScanMatcher("global_scan_matcher");
+    if (use_particle_filter_ || !enable_mapping_)
+    {
+      // When localizing, global scan matcher uses ALL scans
+      rebuild_matcher = matcher;
+    }
+    else
+    {
+      // Built from the candidate region for each loop closure, nothing to rebuild
+      std::lock_guard<std::mutex> lock(graph_mutex_);
+      global_scan_matcher_ = matcher;
+    }
+  }
+
+  if (appearance_search_ && (type_changed || changedPrefix("appearance_scan_matcher.")))
+  {
+    // Built from the candidate region for each loop closure, nothing to rebuild
+    ScanMatcherPtr matcher = createScanMatcher("appearance_scan_matcher");
+    std::lock_guard<std::mutex> lock(graph_mutex_);
+    appearance_scan_matcher_ = matcher;
+  }
+
+  if (relocalization_enabled_ &&
+      (type_changed || changedPrefix("relocalization_scan_matcher.")))
+  {
+    ScanMatcherPtr matcher = createScanMatcher("relocalization_scan_matcher");
+    std::lock_guard<std::mutex> lock(graph_mutex_);
+    relocalization_scan_matcher_ = matcher;
+    // Scans are added by the relocalization thread, when next needed
+    relocalization_graph_.reset();
+  }
+
+  // Particle filter keeps its particles, only the models and limits change
+  if (filter_)
+  {
+    if (changedPrefix("odom_alpha"))
+    {
+      MotionModelPtr model = std::make_shared<MotionModel>(
+        this->get_parameter("odom_alpha1").as_double(),
+        this->get_parameter("odom_alpha2").as_double(),
+        this->get_parameter("odom_alpha3").as_double(),
+        this->get_parameter("odom_alpha4").as_double(),
+        this->get_parameter("odom_alpha5").as_double());
+      filter_->setMotionModel(model);
+    }
+
+    if (changed.count("min_particles") || changed.count("max_particles"))
+    {
+      filter_->setParticleLimits(this->get_parameter("min_particles").as_int(),
+                                 this->get_parameter("max_particles").as_int());
+    }
+
+    kld_err_ = this->get_parameter("kld_err").as_double();
+    kld_z_ = this->get_parameter("kld_z").as_double();
+  }
+
+  if (likelihood_field_)
+  {
+    likelihood_field_max_beams_ = this->get_parameter("likelihood_field_max_beams").as_int();
+    if (changed.count("likelihood_field_resolution") || changed.count("likelihood_field_sigma") ||
+        changed.count("likelihood_field_z_rand"))
+    {
+      rebuild_field = std::make_shared<LikelihoodField>(
+        this->get_parameter("likelihood_field_resolution").as_double(),
+        this->get_parameter("likelihood_field_sigma").as_double(),
+        this->get_parameter("likelihood_field_z_rand").as_double());
+    }
+  }
+
+  if (rebuild_matcher || rebuild_field)
+  {
+    // Replaces any request not yet started
+    std::lock_guard<std::mutex> lock(rebuild_mutex_);
+    if (rebuild_matcher) rebuild_matcher_request_ = rebuild_matcher;
+    if (rebuild_field) rebuild_field_request_ = rebuild_field;
+    rebuild_cv_.notify_one();
+  }
+
+  if (changed.count("resolution") || changed.count("occupancy_threshold"))
+  {
+    map_resolution_ = this->get_parameter("resolution").as_double();
+    OccupancyGridPtr grid = std::make_shared<OccupancyGrid>(
+      map_resolution_, this->get_parameter("occupancy_threshold").as_double());
+    std::lock_guard<std::mutex> lock(graph_mutex_);
+    grid_ = grid;
+    map_update_available_ = true;
+  }
+
+  minimum_travel_distance_ = this->get_parameter("minimum_travel_distance").as_double();
+  minimum_travel_rotation_ = this->get_parameter("minimum_travel_rotation").as_double();
+  keyframe_min_novelty_ = this->get_parameter("keyframe_min_novelty").as_double();
+}
+
+void Mapper::writeSharedMap()
+{
+  if (shared_map_file_.empty() || shared_map_attached_)
+  {
+    return;
+  }
+
+  // Only the NDT scan matcher has a model that can be stored
+  auto model = std::dynamic_pointer_cast<const ScanMatcherNDTModel>(
+    global_scan_matcher_->getModel());
+  const NDT * ndt = model ? model->ndt.get() : nullptr;
+  if (SharedMap::write(shared_map_file_, graph_->scans, graph_->constraints, ndt))
+  {
+    RCLCPP_INFO(logger_, "Wrote shared map to %s", shared_map_file_.c_str());
+  }
+  else
+  {
+    RCLCPP_ERROR(logger_, "Failed to write shared map to %s", shared_map_file_.c_str());
+  }
+}
+
+void Mapper::declareWideSearchWindow(const std::string & name)
+{
+  // Declared before the scan matcher is initialized, so these become its
+  // defaults. Names are those of ndt_2d::ScanMatcherNDT (which PSM shares),
+  // other scan matchers ignore them
+  const std::vector<std::pair<std::string, double>> defaults =
+  {
+    {".search_linear_size", 0.5}, {".search_linear_resolution", 0.02},
+    {".search_angular_size", 0.3}, {".search_angular_resolution", 0.01}
+  };
+  for (auto & d : defaults)
+  {
+    if (!this->has_parameter(name + d.first))
+    {
+      this->declare_parameter<double>(name + d.first, d.second);
+    }
+  }
+}
+
+ScanMatcherPtr Mapper::createScanMatcher(const std::string & name)
+{
+  ScanMatcherPtr matcher;
+  {
+    std::lock_guard<std::mutex> lock(scan_matcher_loader_mutex_);
+    matcher = scan_matcher_loader_.createSharedInstance(scan_matcher_type_);
+  }
+  if (!capture_prefix_.empty())
+  {
+    // Record matcher inputs and outputs for offline replay, matchers that
+    // are recreated (when parameters change) are numbered, rather than
+    // overwriting the capture so far
+    size_t count = capture_count_[name]++;
+    std::string filename = capture_prefix_ + "_" + name +
+                           (count > 0 ? "_" + std::to_string(count) : "") + ".ndtcap";
+    RCLCPP_INFO(logger_, "Capturing %s to %s", name.c_str(), filename.c_str());
+    matcher = std::make_shared<ScanMatcherCapture>(matcher, scan_matcher_type_, filename);
+  }
+  matcher->initialize(name, this, range_max_);
+  return matcher;
+}
+
+void Mapper::secondaryLaserCallback(sensor_msgs::msg::LaserScan::UniquePtr msg, size_t index)
+{
+  std::lock_guard<std::mutex> scan_lock(scan_mutex_);
+
+  // Lasers are only merged once the first one is running
+  Laser & laser = lasers_[index];
+  if (lasers_[0].frame.empty() || !initializeLaser(laser, *msg))
+  {
+    return;
+  }
+
+  double stamp = rclcpp::Time(msg->header.stamp).seconds();
+  if (laser.last_stamp > 0.0 && stamp > laser.last_stamp)
+  {
+    laser.period = stamp - laser.last_stamp;
+  }
+  laser.last_stamp = stamp;
+  laser.latest = std::move(msg);
+
+  // Scan of the first laser may have been waiting for this one
+  if (pending_scan_ && !waitingForLasers(*pending_scan_))
+  {
+    handleScan(std::move(pending_scan_));
+  }
+}
+
+bool Mapper::waitingForLasers(const sensor_msgs::msg::LaserScan & msg) const
+{
+  double stamp = rclcpp::Time(msg.header.stamp).seconds();
+  for (size_t i = 1; i < lasers_.size(); ++i)
+  {
+    const Laser & laser = lasers_[i];
+    if (laser.period <= 0.0 || laser.last_stamp >= stamp)
+    {
+      // Rate not yet known, or no later scan will be closer to this one
+      continue;
+    }
+    if (laser.latest &&
+        std::fabs(rclcpp::Time(laser.latest->header.stamp).seconds() - stamp) <=
+        scan_sync_tolerance_)
+    {
+      continue;
+    }
+    // Only wait if the next scan is due in time to be merged, so that a laser
+    // that stops publishing does not delay every scan
+    if (std::fabs(laser.last_stamp + laser.period - stamp) <= scan_sync_tolerance_)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Mapper::initializeLaser(Laser & laser, const sensor_msgs::msg::LaserScan & msg)
+{
+  if (!laser.frame.empty())
+  {
+    return true;
+  }
+
+  try
+  {
+    // Determine pose of laser relative to base
+    auto t = tf2_buffer_->lookupTransform(robot_frame_, msg.header.frame_id, tf2::TimePointZero);
+    laser.transform = fromMsg(t);
+    if (std::fabs(t.transform.rotation.x) > 0.02 ||
+        std::fabs(t.transform.rotation.y) > 0.02)
+    {
+      RCLCPP_WARN(logger_, "Treating laser %s as inverted", msg.header.frame_id.c_str());
+      laser.inverted = true;
+    }
+    RCLCPP_INFO(logger_, "Robot -> %s transform: %f, %f, %f", msg.header.frame_id.c_str(),
+                laser.transform.x, laser.transform.y, laser.transform.theta);
+  }
+  catch (const tf2::TransformException& ex)
+  {
+    RCLCPP_ERROR(logger_, "Could not transform %s to %s frame.",
+                 robot_frame_.c_str(), msg.header.frame_id.c_str());
+    return false;
+  }
+  laser.frame = msg.header.frame_id;
+  return true;
+}
+
+void Mapper::convertScan(Laser & laser, const sensor_msgs::msg::LaserScan & msg,
+                         std::vector<Point> & points)
+{
+  NDT_2D_SCOPED_TIMER(latency_[SCAN_CONVERSION]);
+  points.clear();
+  points.reserve(msg.ranges.size());
+
+  // Beam directions only change if the laser is reconfigured
+  if (laser.cos_lut.size() != msg.ranges.size() ||
+      laser.angle_min != msg.angle_min ||
+      laser.angle_increment != msg.angle_increment)
+  {
+    laser.angle_min = msg.angle_min;
+    laser.angle_increment = msg.angle_increment;
+    laser.cos_lut.resize(msg.ranges.size());
+    laser.sin_lut.resize(msg.ranges.size());
+    for (size_t i = 0; i < msg.ranges.size(); ++i)
+    {
+      // Project beam in laser frame, then rotate into robot frame
+      double angle = (msg.angle_min + i * msg.angle_increment);
+      if (laser.inverted) angle = -angle;
+      laser.cos_lut[i] = cos(angle + laser.transform.theta);
+      laser.sin_lut[i] = sin(angle + laser.transform.theta);
+    }
+  }
+
+  // Robot motion from the first to the last beam, if correcting for it
+  Pose2d motion;
+  bool deskew = false;
+  if (deskew_ && msg.time_increment != 0.0 && msg.ranges.size() > 1)
+  {
+    rclcpp::Time start(msg.header.stamp);
+    rclcpp::Time end = start + rclcpp::Duration::from_seconds(
+      msg.time_increment * (msg.ranges.size() - 1));
+    try
+    {
+      auto t = tf2_buffer_->lookupTransform(robot_frame_, tf2_ros::fromMsg(start),
+                                            robot_frame_, tf2_ros::fromMsg(end),
+                                            odom_frame_, tf2::durationFromSec(transform_timeout_));
+      motion = fromMsg(t);
+      deskew = true;
+    }
+    catch (const tf2::TransformException& ex)
+    {
+      RCLCPP_WARN(logger_, "Could not deskew scan from %s, no odometry", laser.frame.c_str());
+    }
+  }
+  const double last_beam = msg.ranges.size() - 1;
+
+  // Using this scan, convert ROS msg into ndt_2d style scan
+  auto addPoint = [&](size_t i)
+  {
+    // Filter out NANs and scans beyond max range
+    if (std::isnan(msg.ranges[i]) || msg.ranges[i] > range_max_) return;
+    Point point(laser.cos_lut[i] * msg.ranges[i] + laser.transform.x,
+                laser.sin_lut[i] * msg.ranges[i] + laser.transform.y);
+    if (deskew)
+    {
+      // Interpolate the robot pose when this beam was taken, relative to the
+      // first beam (the scan timestamp), and move the point into that frame
+      double f = i / last_beam;
+      double theta = f * motion.theta;
+      double cos_th = cos(theta);
+      double sin_th = sin(theta);
+      point = Point(cos_th * point.x - sin_th * point.y + f * motion.x,
+                    sin_th * point.x + cos_th * point.y + f * motion.y);
+    }
+    points.push_back(point);
+  };
+  if (laser.inverted)
+  {
+    for (size_t i = msg.ranges.size() - 1; i > 0 && i < msg.ranges.size(); --i)
+    {
+      addPoint(i);
+    }
+  }
+  else
+  {
+    for (size_t i = 0; i < msg.ranges.size(); ++i)
+    {
+      addPoint(i);
+    }
+  }
+}
+
+void Mapper::getScanPoints(const sensor_msgs::msg::LaserScan & msg, std::vector<Point> & points)
+{
+  convertScan(lasers_[0], msg, points);
+
+  // Lasers usually overlap, points of a later laser are dropped if they fall
+  // in a voxel that already holds points of an earlier laser, so that each
+  // laser keeps its own density
+  bool reduce = scan_voxel_size_ > 0.0;
+  auto voxel = [this](const Point & point)
+  {
+    uint64_t x = static_cast<uint32_t>(static_cast<int32_t>(std::floor(point.x / scan_voxel_size_)));
+    uint64_t y = static_cast<uint32_t>(static_cast<int32_t>(std::floor(point.y / scan_voxel_size_)));
+    return (x << 32) | y;
+  };
+  std::unordered_set<uint64_t> voxels;
+  std::vector<uint64_t> laser_voxels;
+
+  size_t merged = 0;
+  std::vector<Point> laser_points;
+  for (size_t i = 1; i < lasers_.size(); ++i)
+  {
+    Laser & laser = lasers_[i];
+    if (!laser.latest)
+    {
+      continue;
+    }
+
+    rclcpp::Duration dt = rclcpp::Time(laser.latest->header.stamp) - rclcpp::Time(msg.header.stamp);
+    if (std::fabs(dt.seconds()) > scan_sync_tolerance_)
+    {
+      continue;
+    }
+
+    // Motion of the robot between the two scans
+    Pose2d motion;
+    try
+    {
+      auto t = tf2_buffer_->lookupTransform(robot_frame_, tf2_ros::fromMsg(msg.header.stamp),
+                                            robot_frame_,
+                                            tf2_ros::fromMsg(laser.latest->header.stamp),
+                                            odom_frame_, tf2::durationFromSec(transform_timeout_));
+      motion = fromMsg(t);
+    }
+    catch (const tf2::TransformException& ex)
+    {
+      RCLCPP_WARN(logger_, "Could not merge scan from %s, no odometry", laser.frame.c_str());
+      continue;
+    }
+
+    if (reduce && merged == 0)
+    {
+      // Voxels of the first laser are only needed once there is something to merge
+      voxels.reserve(points.size() * 2);
+      for (auto & point : points)
+      {
+        voxels.insert(voxel(point));
+      }
+    }
+
+    convertScan(laser, *laser.latest, laser_points);
+    double cos_m = cos(motion.theta);
+    double sin_m = sin(motion.theta);
+    laser_voxels.clear();
+    for (auto & point : laser_points)
+    {
+      Point p(cos_m * point.x - sin_m * point.y + motion.x,
+              sin_m * point.x + cos_m * point.y + motion.y);
+      if (reduce)
+      {
+        uint64_t key = voxel(p);
+        if (voxels.count(key))
+        {
+          continue;
+        }
+        laser_voxels.push_back(key);
+      }
+      points.push_back(p);
+    }
+    voxels.insert(laser_voxels.begin(), laser_voxels.end());
+
+    // Each scan is only merged once
+    laser.latest.reset();
+    ++merged;
+  }
+}
+
+void Mapper::loopClosureThread()
+{
+  while (rclcpp::ok())
+  {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    // Only do loop closure if we are mapping
+    if (!enable_mapping_)
+    {
+      continue;
+    }
+
+    // Defer loop closure while overloaded, new scans are processed once it recovers
+    if (load_shedder_->level() >= LoadShedder::SKIP_LOOP_CLOSURE)
+    {
+      continue;
+    }
+
+    // Determine number of scans (under lock)
+    size_t num_scans;
+    {
+      std::lock_guard<std::mutex> lock(graph_mutex_);
+      num_scans = graph_->scans.size();
+    }
+
+    // Can't do a global search until we have at least enough scans
+    if (num_scans <= rolling_depth_)
+    {
+      continue;
+    }
+
+    // We don't process the initial rolling window for loop closure
+    if (global_scans_processed_ <= rolling_depth_)
+    {
+      global_scans_processed_ = rolling_depth_ + 1;
+    }
+
+    bool new_matches = false;
+    if (num_scans > global_scans_processed_)
+    {
+      // We have new scans to process
+      for (; global_scans_processed_ < num_scans; ++global_scans_processed_)
+      {
+        // Determine where rolling window starts
+        size_t rolling = global_scans_processed_ - rolling_depth_;
+
+        // Grab a reference to the scan we are loop closing for and find candidate
+        // scans, along with the initial pose to use when matching against each
+        ScanPtr scan;
+        std::vector<std::pair<size_t, Pose2d>> scans;
+        {
+          std::lock_guard<std::mutex> lock(graph_mutex_);
+          scan = graph_->scans[global_scans_processed_];
+          if (appearance_search_)
+          {
+            // Scans just before this one look alike, and odometry already
+            // links them, so only search beyond appearance_min_travel
+            size_t limit = std::min(rolling, graph_->findTravelLimit(global_scans_processed_,
+                                                                     appearance_min_travel_));
+
+            // Candidates that look similar, regardless of odometry drift
+            if (limit > 0)
+            {
+              auto similar = graph_->findSimilar(scan, global_search_limit_,
+                                                 descriptor_threshold_, limit);
+              for (auto & s : similar)
+              {
+                scans.emplace_back(s.index, s.pose);
+              }
+            }
+          }
+          else
+          {
+            for (auto i : graph_->findNearest(scan, global_search_size_, rolling))
+            {
+              scans.emplace_back(i, scan->getPose());
+            }
+          }
+        }
+
+        // Now do global loop closure scan matching
+        size_t num_scans_to_check = global_search_limit_;
+        for (auto & s : scans)
+        {
+          size_t i = s.first;
+
+          // Lock graph to access scans
+          std::unique_lock<std::mutex> lock(graph_mutex_);
+          const auto candidate = graph_->scans[i];
+          if (candidate->getPoints().empty()) continue;
+
+          // Matcher may be replaced by a parameter change, hold on to this one.
+          // Appearance candidate poses are rough, so use a wider search window
+          ScanMatcherPtr matcher = appearance_search_ ? appearance_scan_matcher_ :
+                                                        global_scan_matcher_;
+
+          // Match a copy of the scan, so the graph is not modified unless accepted
+          ScanPtr query = std::make_shared<Scan>(scan->getId());
+          query->setPoints(scan->getPoints());
+          query->setPose(s.second);
+
+          // Take one additional scan on either side of candidate
+          size_t begin_idx = (i > 0) ? i - 1: i;
+          size_t end_idx = (i < rolling) ? i + 1 : i;
+          auto begin = graph_->scans.begin() + begin_idx;
+          auto end = graph_->scans.begin() + end_idx;
+
+          // Build NDT of candidate region
+          {
+            NDT_2D_SCOPED_TIMER(latency_[NDT_BUILD]);
+            matcher->reset();
+            matcher->addScans(begin, end);
+          }
+
+          // Can unlock graph now before we do the (slow) scan matching
+          lock.unlock();
+
+          // Try to match scans
+          Pose2d correction;
+          Eigen::Matrix3d covariance;
+          double score;
+          {
+            NDT_2D_SCOPED_TIMER(latency_[LOOP_CLOSURE_MATCHING]);
+            score = matcher->matchScan(query, correction, covariance);
+          }
+
+          bool accepted = std::isfinite(score) && (score < typical_matcher_response_);
+          NDT_2D_TRACEPOINT(loop_closure_candidate, scan->getId(), candidate->getId(), accepted);
+          if (accepted)
+          {
+            new_matches = true;
+            RCLCPP_INFO(logger_, "***Adding loop closure from %lu to %lu (score %f)",
+                                 candidate->getId(), scan->getId(), score);
+
+            // Correct pose
+            correction.x += query->getPose().x;
+            correction.y += query->getPose().y;
+            correction.theta += query->getPose().theta;
+            query->setPose(correction);
+            // Correction is bounded by the search window, so apply it now
+            scan->setPose(correction);
+
+            // Add constraint to the graph
+            ConstraintPtr constraint = makeConstraint(candidate, query, covariance);
+            constraint->switchable = true;
             lock.lock();  // lock before adding constraint
             graph_->constraints.push_back(constraint);
             map_update_available_ = true;
@@ -635,15 +1651,217 @@ void Mapper::loopClosureThread()
     {
       RCLCPP_INFO(logger_, "Optimizing pose graph");
       std::lock_guard<std::mutex> lock(graph_mutex_);
-      solver_->optimize(graph_->constraints, graph_->scans);
+      NDT_2D_SCOPED_TIMER(latency_[OPTIMIZATION]);
+      NDT_2D_TRACEPOINT(optimize_start, graph_->scans.size());
+      bool success = solver_->optimize(graph_->constraints, graph_->scans);
+      NDT_2D_TRACEPOINT(optimize_end, graph_->scans.size(), success);
+      if (!success)
+      {
+        RCLCPP_WARN(logger_, "Pose graph optimization failed");
+      }
       optimization_last_ = graph_->scans.size();
       map_update_available_ = true;
     }
   }
 }
 
+void Mapper::rebuildThread()
+{
+  while (rclcpp::ok())
+  {
+    // Wait for a request
+    ScanMatcherPtr matcher;
+    LikelihoodFieldPtr field;
+    {
+      std::unique_lock<std::mutex> lock(rebuild_mutex_);
+      if (!rebuild_matcher_request_ && !rebuild_field_request_)
+      {
+        rebuild_cv_.wait_for(lock, std::chrono::milliseconds(250));
+      }
+      matcher.swap(rebuild_matcher_request_);
+      field.swap(rebuild_field_request_);
+    }
+
+    if (!matcher && !field)
+    {
+      continue;
+    }
+
+    // Build from a copy of the scan list, so that the graph is not locked
+    GraphPtr graph;
+    std::vector<ScanPtr> scans;
+    {
+      std::lock_guard<std::mutex> lock(graph_mutex_);
+      graph = graph_;
+      scans = graph_->scans;
+    }
+
+    if (matcher)
+    {
+      NDT_2D_SCOPED_TIMER(latency_[NDT_BUILD]);
+      matcher->addScans(scans.begin(), scans.end());
+    }
+
+    if (field)
+    {
+      field->build(scans.begin(), scans.end());
+    }
+
+    // Result is swapped in by laserCallback(), which owns the models
+    std::lock_guard<std::mutex> lock(rebuild_mutex_);
+    if (matcher)
+    {
+      rebuild_matcher_result_ = matcher;
+      rebuild_matcher_graph_ = graph;
+    }
+    if (field)
+    {
+      rebuild_field_result_ = field;
+    }
+  }
+}
+
+void Mapper::relocalizationThread()
+{
+  while (rclcpp::ok())
+  {
+    // Wait for a request
+    ScanPtr scan;
+    Pose2d odom_pose;
+    {
+      std::unique_lock<std::mutex> lock(relocalization_mutex_);
+      relocalization_cv_.wait_for(lock, std::chrono::milliseconds(250));
+      if (!relocalization_request_)
+      {
+        continue;
+      }
+      scan = relocalization_request_;
+      odom_pose = relocalization_request_odom_;
+      relocalization_request_.reset();
+    }
+
+    NDT_2D_SCOPED_TIMER(latency_[RELOCALIZATION]);
+
+    // Find scans which look like this one, anywhere in the map
+    std::vector<SimilarScan> candidates;
+    ScanMatcherPtr matcher;
+    GraphPtr graph;
+    ScanMatcherModelPtr model;
+    std::vector<ScanPtr> scans;
+    {
+      std::lock_guard<std::mutex> lock(graph_mutex_);
+      candidates = graph_->findSimilar(scan, relocalization_candidates_, descriptor_threshold_);
+
+      // Matcher may be replaced by a parameter change, hold on to this one
+      matcher = relocalization_scan_matcher_;
+      if (relocalization_graph_ != graph_)
+      {
+        // Map has been loaded (or changed) since last relocalization, like
+        // the global scan matcher when localizing, this uses ALL scans
+        graph = graph_;
+        if (global_scan_matcher_ && global_scan_matcher_graph_ == graph_)
+        {
+          model = global_scan_matcher_->getModel();
+        }
+        scans = graph_->scans;
+      }
+    }
+
+    if (graph)
+    {
+      // Share the model of the global scan matcher if possible, otherwise
+      // build one. Either way the graph is not locked, since building a model
+      // of a large map would block loop closure and publishing
+      if (!model || !matcher->setModel(model))
+      {
+        NDT_2D_SCOPED_TIMER(latency_[NDT_BUILD]);
+        matcher->reset();
+        matcher->addScans(scans.begin(), scans.end());
+      }
+      scans.clear();
+
+      std::lock_guard<std::mutex> lock(graph_mutex_);
+      if (matcher == relocalization_scan_matcher_)
+      {
+        // Unless the matcher was replaced meanwhile, then it is rebuilt next time
+        relocalization_graph_ = graph;
+      }
+    }
+
+    // Verify candidates in parallel, matchScan() does not modify the
+    // scan matcher, so all threads can share the same instance
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                      std::chrono::duration<double>(relocalization_timeout_));
+    std::vector<std::future<std::pair<double, Pose2d>>> results;
+    for (auto & candidate : candidates)
+    {
+      results.push_back(std::async(std::launch::async, [matcher, scan, candidate, deadline]()
+      {
+        ScanPtr query = std::make_shared<Scan>(scan->getId());
+        query->setPoints(scan->getPoints());
+        query->setPose(candidate.pose);
+
+        // Matchers check the deadline as they search, and give up once it passes
+        Pose2d correction;
+        Eigen::Matrix3d covariance;
+        double score = matcher->matchScan(query, correction, covariance, deadline);
+
+        Pose2d pose(candidate.pose.x + correction.x,
+                    candidate.pose.y + correction.y,
+                    angles::normalize_angle(candidate.pose.theta + correction.theta));
+        return std::make_pair(score, pose);
+      }));
+    }
+
+    // Take the best candidate verified before the deadline
+    double best_score = relocalization_score_threshold_;
+    Pose2d best_pose;
+    bool found = false;
+    size_t timed_out = 0;
+    for (auto & result : results)
+    {
+      if (result.wait_until(deadline) != std::future_status::ready)
+      {
+        ++timed_out;
+        continue;
+      }
+
+      auto verified = result.get();
+      if (std::isfinite(verified.first) && verified.first < best_score)
+      {
+        best_score = verified.first;
+        best_pose = verified.second;
+        found = true;
+      }
+    }
+
+    RCLCPP_INFO(logger_, "Relocalization checked %lu candidates (%lu timed out), %s",
+                candidates.size(), timed_out, found ? "succeeded" : "failed");
+
+    // Result is applied by laserCallback(), which owns the particle filter
+    if (found)
+    {
+      std::lock_guard<std::mutex> lock(relocalization_mutex_);
+      relocalization_result_pose_ = best_pose;
+      relocalization_result_odom_ = odom_pose;
+      relocalization_result_available_ = true;
+    }
+
+    // Late results are discarded. Matches that were still running give up
+    // at the deadline, so this only waits for one step of their search
+    results.clear();
+
+    std::lock_guard<std::mutex> lock(relocalization_mutex_);
+    relocalization_in_progress_ = false;
+  }
+}
+
 void Mapper::mapPublishThread()
 {
+#ifdef NDT_2D_ENABLE_METRICS
+  auto last_metrics_publish = std::chrono::steady_clock::now();
+#endif
   while (rclcpp::ok())
   {
     if (map_update_available_)
@@ -652,23 +1870,29 @@ void Mapper::mapPublishThread()
       rclcpp::Time now = this->now();
 
       // Publish an occupancy grid
-      nav_msgs::msg::OccupancyGrid grid_msg;
-      grid_msg.header.frame_id = "map";
-      grid_msg.header.stamp = now;
-      grid_msg.info.map_load_time = now;
+      publishMessage(map_pub_, [this, &now](nav_msgs::msg::OccupancyGrid & grid_msg)
       {
+        grid_msg.header.frame_id = "map";
+        grid_msg.header.stamp = now;
+        grid_msg.info.map_load_time = now;
         std::lock_guard<std::mutex> lock(graph_mutex_);
+        NDT_2D_SCOPED_TIMER(latency_[RENDERING]);
         grid_->getMsg(graph_->scans, grid_msg);
-      }
-      map_pub_->publish(grid_msg);
+        NDT_2D_TRACEPOINT(map_publish, graph_->scans.size());
+      });
 
-      // Publish the graph
-      visualization_msgs::msg::MarkerArray graph_msg;
+      // Publish the graph, only if a pose has changed. The message is updated
+      // in place and, with intra-process disabled, published by reference
+      // straight to the middleware, rather than copied into a new message
+      bool graph_changed = false;
       {
         std::lock_guard<std::mutex> lock(graph_mutex_);
-        graph_->getMsg(graph_msg, now);
+        graph_changed = graph_->getMsg(graph_msg_, now);
+      }
+      if (graph_changed)
+      {
+        graph_pub_->publish(graph_msg_);
       }
-      graph_pub_->publish(graph_msg);
     }
 
     // Publish TF
@@ -697,10 +1921,117 @@ void Mapper::mapPublishThread()
       tf2_broadcaster_->sendTransform(transform);
     }
 
+#ifdef NDT_2D_ENABLE_METRICS
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_metrics_publish > std::chrono::duration<double>(metrics_publish_period_))
+    {
+      publishMetrics();
+      last_metrics_publish = now;
+    }
+#endif
+
     std::this_thread::sleep_for(std::chrono::milliseconds(250));
   }
 }
 
+void Mapper::publishMetrics()
+{
+  static const char * stage_names[NUM_STAGES] =
+  {
+    "tf_lookup",
+    "scan_conversion",
+    "ndt_build",
+    "scan_matching",
+    "filter_update",
+    "filter_measure",
+    "filter_resample",
+    "loop_closure_matching",
+    "optimization",
+    "rendering",
+    "relocalization"
+  };
+
+  ndt_2d::msg::Metrics msg;
+  msg.header.stamp = this->now();
+  for (size_t i = 0; i < NUM_STAGES; ++i)
+  {
+    ndt_2d::msg::StageLatency stage;
+    stage.name = stage_names[i];
+    stage.count = latency_[i].count();
+    stage.p50 = latency_[i].quantile(0.5);
+    stage.p95 = latency_[i].quantile(0.95);
+    stage.max = latency_[i].max();
+    msg.stages.push_back(stage);
+    // Each report covers only the period since the previous report
+    latency_[i].reset();
+  }
+  msg.degradation_level = load_shedder_->level();
+  msg.degraded_scans = load_shedder_->takeDegradedScans();
+  metrics_pub_->publish(msg);
+}
+
+void Mapper::getMemoryUsage(ndt_2d::msg::MemoryUsage & msg)
+{
+  auto add = [&msg](const std::string & name, size_t bytes)
+  {
+    ndt_2d::msg::ComponentMemory component;
+    component.name = name;
+    component.bytes = bytes;
+    msg.components.push_back(component);
+    msg.total += bytes;
+  };
+
+  msg.header.stamp = this->now();
+  msg.total = 0;
+  msg.budget = memory_budget_;
+
+  // Loop closure thread rebuilds the global scan matcher and
+  // runs the solver under the graph lock
+  std::lock_guard<std::mutex> lock(graph_mutex_);
+  add("graph", graph_->memoryUsage());
+  if (local_scan_matcher_)
+  {
+    add("local_scan_matcher", local_scan_matcher_->memoryUsage());
+  }
+  if (global_scan_matcher_)
+  {
+    add("global_scan_matcher", global_scan_matcher_->memoryUsage());
+  }
+  if (relocalization_scan_matcher_)
+  {
+    add("relocalization_scan_matcher", relocalization_scan_matcher_->memoryUsage());
+  }
+  if (filter_)
+  {
+    add("particle_filter", filter_->memoryUsage());
+  }
+  if (likelihood_field_)
+  {
+    add("likelihood_field", likelihood_field_->memoryUsage());
+  }
+  add("occupancy_grid", grid_->memoryUsage());
+  add("solver", solver_->memoryUsage());
+}
+
+void Mapper::publishMemoryUsage()
+{
+  ndt_2d::msg::MemoryUsage msg;
+  getMemoryUsage(msg);
+  if (memory_budget_ > 0 && msg.total > memory_budget_)
+  {
+    RCLCPP_WARN(logger_, "Memory usage of %lu bytes exceeds budget of %lu bytes",
+                msg.total, memory_budget_);
+  }
+  memory_pub_->publish(msg);
+}
+
+void Mapper::getMemoryUsageCallback(
+  const std::shared_ptr<ndt_2d::srv::GetMemoryUsage::Request>,
+  std::shared_ptr<ndt_2d::srv::GetMemoryUsage::Response> response)
+{
+  getMemoryUsage(response->usage);
+}
+
 }  // namespace ndt_2d
 
 #include "rclcpp_components/register_node_macro.hpp"
@@ -30,6 +30,7 @@
 #include <Eigen/Eigen>
 #include <Eigen/Eigenvalues>
 
+#include <algorithm>
 #include <cmath>
 #include <ndt_2d/conversions.hpp>
 #include <ndt_2d/ndt_model.hpp>
@@ -102,7 +103,7 @@ void Cell::compute()
   valid = true;
 }
 
-double Cell::score(const Eigen::Vector2d & point)
+double Cell::score(const Eigen::Vector2d & point) const
 {
   if (n < 5)
   {
@@ -123,6 +124,19 @@ NDT::NDT(double cell_size, double size_x, double size_y, double origin_x, double
   origin_x_ = origin_x;
   origin_y_ = origin_y;
   cells_.resize(size_x_ * size_y_);
+  cell_data_ = cells_.data();
+}
+
+NDT::NDT(double cell_size, size_t size_x, size_t size_y, double origin_x, double origin_y,
+         const Cell * cells, const std::shared_ptr<const void> & storage)
+: cell_size_(cell_size),
+  size_x_(size_x),
+  size_y_(size_y),
+  origin_x_(origin_x),
+  origin_y_(origin_y),
+  cell_data_(cells),
+  storage_(storage)
+{
 }
 
 NDT::~NDT()
@@ -159,23 +173,23 @@ void NDT::compute()
   }
 }
 
-double NDT::likelihood(const Eigen::Vector2d & point)
+double NDT::likelihood(const Eigen::Vector2d & point) const
 {
   int index = getIndex(point(0), point(1));
   if (index >= 0)
   {
-    return cells_[index].score(point);
+    return cell_data_[index].score(point);
   }
   return 0.0;
 }
 
-double NDT::likelihood(const Eigen::Vector3d & point)
+double NDT::likelihood(const Eigen::Vector3d & point) const
 {
   Eigen::Vector2d p(point(0), point(1));
   return likelihood(p);
 }
 
-double NDT::likelihood(const std::vector<Point> & points)
+double NDT::likelihood(const std::vector<Point> & points) const
 {
   double score = 0.0;
   for (auto & point : points)
@@ -186,7 +200,32 @@ double NDT::likelihood(const std::vector<Point> & points)
   return score;
 }
 
-double NDT::likelihood(const ScanPtr & scan)
+const Cell * NDT::getCell(const Eigen::Vector2d & point) const
+{
+  int index = getIndex(point(0), point(1));
+  if (index >= 0)
+  {
+    return &cell_data_[index];
+  }
+  return nullptr;
+}
+
+const Cell * NDT::getCells() const
+{
+  return cell_data_;
+}
+
+size_t NDT::getNumCells() const
+{
+  return size_x_ * size_y_;
+}
+
+size_t NDT::memoryUsage() const
+{
+  return sizeof(NDT) + cells_.capacity() * sizeof(Cell);
+}
+
+double NDT::likelihood(const ScanPtr & scan) const
 {
   const Eigen::Isometry3d transform = toEigen(scan->getPose());
 
@@ -200,7 +239,48 @@ double NDT::likelihood(const ScanPtr & scan)
   return score;
 }
 
-int NDT::getIndex(double x, double y)
+double NDT::likelihood(const double * x, const double * y, size_t size,
+                       double dx, double dy) const
+{
+  // Points are processed in blocks: first computing the cell indices, which
+  // has no branches so can be vectorized, then scoring the valid cells
+  constexpr size_t BLOCK = 32;
+
+  double score = 0.0;
+  int index[BLOCK];
+  for (size_t start = 0; start < size; start += BLOCK)
+  {
+    const size_t block = std::min(BLOCK, size - start);
+
+    // Same as getIndex(), -1 for points outside the NDT
+    for (size_t i = 0; i < block; ++i)
+    {
+      const double px = x[start + i] + dx - origin_x_;
+      const double py = y[start + i] + dy - origin_y_;
+      const int grid_x = static_cast<int>(px / cell_size_);
+      const int grid_y = static_cast<int>(py / cell_size_);
+      const bool valid = px >= 0.0 && py >= 0.0 &&
+                         grid_x < static_cast<int>(size_x_) && grid_y < static_cast<int>(size_y_);
+      index[i] = valid ? grid_y * static_cast<int>(size_x_) + grid_x : -1;
+    }
+
+    // Same as Cell::score()
+    for (size_t i = 0; i < block; ++i)
+    {
+      if (index[i] < 0) continue;
+      const Cell & cell = cell_data_[index[i]];
+      if (cell.n < 5) continue;
+      const double qx = x[start + i] + dx - cell.mean(0);
+      const double qy = y[start + i] + dy - cell.mean(1);
+      const double rx = qx * cell.information(0, 0) + qy * cell.information(1, 0);
+      const double ry = qx * cell.information(0, 1) + qy * cell.information(1, 1);
+      score += std::exp(-0.5 * (rx * qx + ry * qy));
+    }
+  }
+  return score;
+}
+
+int NDT::getIndex(double x, double y) const
 {
   if (x < origin_x_ || y < origin_y_)
   {
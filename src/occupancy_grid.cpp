@@ -40,7 +40,8 @@ OccupancyGrid::OccupancyGrid(const double resolution, const double occ_thresh)
   max_x_(0),
   min_y_(0),
   max_y_(0),
-  num_scans_(0)
+  num_scans_(0),
+  num_cells_(0)
 {
 }
 
@@ -64,6 +65,7 @@ void OccupancyGrid::getMsg(std::vector<ndt_2d::ScanPtr> & scans,
   grid.info.origin.position.y = min_y_ - pad;
   grid.info.origin.orientation.w = 1.0;
   grid.data.assign(grid.info.width * grid.info.height, -1);
+  num_cells_ = grid.data.size();
 
   // Create working arrays
   std::vector<int> hit(grid.data.size(), 0);
@@ -151,6 +153,12 @@ void OccupancyGrid::getMsg(std::vector<ndt_2d::ScanPtr> & scans,
   }
 }
 
+size_t OccupancyGrid::memoryUsage() const
+{
+  // Message data plus hit and empty working arrays
+  return sizeof(OccupancyGrid) + num_cells_ * (sizeof(int8_t) + 2 * sizeof(int));
+}
+
 void OccupancyGrid::updateBounds(std::vector<ndt_2d::ScanPtr>& scans)
 {
   size_t start_idx = num_scans_;
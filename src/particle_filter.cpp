@@ -27,6 +27,7 @@
  */
 
 #include <angles/angles.h>
+#include <cmath>
 #include <random>
 #include <ndt_2d/particle_filter.hpp>
 
@@ -50,6 +51,19 @@ ParticleFilter::ParticleFilter(size_t min_particles, size_t max_particles,
   updateStatistics();
 }
 
+void ParticleFilter::setMotionModel(MotionModelPtr & motion_model)
+{
+  motion_model_ = motion_model;
+}
+
+void ParticleFilter::setParticleLimits(size_t min_particles, size_t max_particles)
+{
+  min_particles_ = min_particles;
+  max_particles_ = max_particles;
+  particles_.reserve(max_particles_);
+  weights_.reserve(max_particles_);
+}
+
 void ParticleFilter::init(const double x, const double y, const double theta,
                           const double sigma_x, const double sigma_y, const double sigma_theta)
 {
@@ -78,12 +92,28 @@ void ParticleFilter::update(const double dx, const double dy, const double dth)
 void ParticleFilter::measure(const ScanMatcherPtr & matcher,
                              const ScanPtr & scan)
 {
+  // Poses of the particles in NDT format
+  std::vector<Pose2d> poses;
+  poses.reserve(particles_.size());
+  for (auto & particle : particles_)
+  {
+    poses.emplace_back(particle(0), particle(1), particle(2));
+  }
+
+  // Compute the scores in one batch, ignoring the scan->pose
+  matcher->scorePoints(scan->getPoints(), poses, weights_);
+  updateStatistics();
+}
+
+void ParticleFilter::measure(const LikelihoodField & field, const ScanPtr & scan,
+                             size_t max_beams)
+{
+  // Copy points once, rather than for every particle
+  std::vector<Point> points = scan->getPoints();
   for (size_t i = 0; i < particles_.size(); ++i)
   {
-    // Pose of this particle in NDT format
     Pose2d pose(particles_[i](0), particles_[i](1), particles_[i](2));
-    // Compute the score, ignoring the scan->pose
-    weights_[i] = matcher->scorePoints(scan->getPoints(), pose);
+    weights_[i] = field.score(points, pose, max_beams);
   }
   updateStatistics();
 }
@@ -160,6 +190,15 @@ void ParticleFilter::getMsg(geometry_msgs::msg::PoseArray & msg)
   }
 }
 
+size_t ParticleFilter::memoryUsage() const
+{
+  // The tree itself is already part of sizeof(ParticleFilter)
+  return sizeof(ParticleFilter) - sizeof(kd_tree_) +
+         particles_.capacity() * sizeof(Particle) +
+         weights_.capacity() * sizeof(double) +
+         kd_tree_.memoryUsage();
+}
+
 void ParticleFilter::updateStatistics()
 {
   // Recompute weights to sum to 1.0
@@ -168,9 +207,17 @@ void ParticleFilter::updateStatistics()
   {
     sum_weight += w;
   }
-  for (auto & w : weights_)
+  if (sum_weight == 0.0 || !std::isfinite(sum_weight))
+  {
+    // No particle explains the measurement at all, keep them equally likely
+    weights_.assign(weights_.size(), 1.0 / weights_.size());
+  }
+  else
   {
-    w /= sum_weight;
+    for (auto & w : weights_)
+    {
+      w /= sum_weight;
+    }
   }
 
   // Temporary mean and correlation
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ndt_2d/capture.hpp>
+#include <ndt_2d/scan_matcher.hpp>
+#include <pluginlib/class_loader.hpp>
+#include <rclcpp/rclcpp.hpp>
+
+/*
+ * Replay a capture of scan matcher calls, reporting per-call timing and
+ * differences in results. Usage:
+ *
+ *   ros2 run ndt_2d replay_matcher <capture_file> [scan_matcher_type]
+ *
+ * The scan matcher is initialized with the parameters stored in the capture,
+ * these can be overridden with the usual "--ros-args -p name:=value".
+ */
+int main(int argc, char ** argv)
+{
+  std::vector<std::string> args = rclcpp::init_and_remove_ros_arguments(argc, argv);
+  if (args.size() < 2)
+  {
+    fprintf(stderr, "usage: replay_matcher <capture_file> [scan_matcher_type]\n");
+    return 1;
+  }
+
+  ndt_2d::CaptureHeader header;
+  ndt_2d::CaptureReader reader;
+  if (!reader.open(args[1], header))
+  {
+    fprintf(stderr, "Unable to read capture file %s\n", args[1].c_str());
+    return 1;
+  }
+  std::string type = (args.size() > 2) ? args[2] : header.type;
+
+  // Parameters from the capture, unless overridden on the command line
+  // (NodeOptions overrides would otherwise take precedence over --ros-args)
+  auto command_line = rclcpp::Node("replay_matcher_args").get_node_parameters_interface()->
+    get_parameter_overrides();
+  std::vector<rclcpp::Parameter> parameters;
+  for (auto & param : header.parameters)
+  {
+    if (command_line.count(param.get_name()) == 0)
+    {
+      parameters.push_back(param);
+    }
+  }
+  auto node = std::make_shared<rclcpp::Node>("replay_matcher",
+    rclcpp::NodeOptions().parameter_overrides(parameters));
+
+  pluginlib::ClassLoader<ndt_2d::ScanMatcher> loader("ndt_2d", "ndt_2d::ScanMatcher");
+  ndt_2d::ScanMatcherPtr matcher = loader.createSharedInstance(type);
+  matcher->initialize(header.name, node.get(), header.range_max);
+
+  printf("Replaying %s captured with %s, using %s\n", args[1].c_str(),
+         header.type.c_str(), type.c_str());
+  printf("call, scan_id, captured_ms, replay_ms, captured_score, replay_score, dx, dy, dtheta\n");
+
+  // Points of scans added to the matcher, by key within the capture
+  std::unordered_map<size_t, std::vector<ndt_2d::Point>> points;
+  size_t calls = 0;
+  double captured_total = 0.0, replay_total = 0.0, max_diff = 0.0;
+
+  ndt_2d::CaptureRecord record;
+  while (reader.read(record))
+  {
+    if (record.type == ndt_2d::CaptureRecord::SCAN)
+    {
+      points[record.key] = record.points;
+    }
+    else if (record.type == ndt_2d::CaptureRecord::ADD_SCANS)
+    {
+      std::vector<ndt_2d::ScanPtr> scans;
+      for (auto & s : record.scans)
+      {
+        ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(s.id);
+        scan->setPose(s.pose);
+        scan->setPoints(points[s.key]);
+        scans.push_back(scan);
+      }
+      matcher->addScans(scans.begin(), scans.end());
+    }
+    else if (record.type == ndt_2d::CaptureRecord::RESET)
+    {
+      matcher->reset();
+    }
+    else if (record.type == ndt_2d::CaptureRecord::MATCH)
+    {
+      ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(record.id);
+      scan->setPose(record.pose);
+      scan->setPoints(record.points);
+
+      ndt_2d::Pose2d correction;
+      Eigen::Matrix3d covariance;
+      auto start = std::chrono::steady_clock::now();
+      double score = matcher->matchScan(scan, correction, covariance);
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+      double captured_ms = record.duration_ns * 1e-6;
+      double dx = correction.x - record.correction.x;
+      double dy = correction.y - record.correction.y;
+      double dth = correction.theta - record.correction.theta;
+      printf("%lu, %lu, %.3f, %.3f, %f, %f, %f, %f, %f\n", calls, record.id,
+             captured_ms, elapsed.count(), record.score, score, dx, dy, dth);
+
+      ++calls;
+      captured_total += captured_ms;
+      replay_total += elapsed.count();
+      max_diff = std::max(max_diff, std::hypot(dx, dy));
+    }
+  }
+
+  if (calls > 0)
+  {
+    printf("\n%lu calls: captured mean %.3f ms, replay mean %.3f ms (%.2fx), "
+           "max translation difference %f m\n", calls, captured_total / calls,
+           replay_total / calls, captured_total / replay_total, max_diff);
+  }
+
+  // Matcher must be destroyed before the class loader
+  matcher.reset();
+  rclcpp::shutdown();
+  return 0;
+}
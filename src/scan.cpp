@@ -69,6 +69,11 @@ std::vector<Point> Scan::getPoints()
   return points_;
 }
 
+size_t Scan::memoryUsage()
+{
+  return sizeof(Scan) + points_.capacity() * sizeof(Point);
+}
+
 void Scan::update()
 {
   double cos_theta = cos(pose_.theta);
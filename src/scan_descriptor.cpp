@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <cmath>
+#include <limits>
+#include <ndt_2d/scan_descriptor.hpp>
+
+namespace ndt_2d
+{
+
+ScanDescriptor::ScanDescriptor(const std::vector<Point> & points, double max_range,
+                               size_t num_rings, size_t num_sectors)
+: num_rings_(num_rings),
+  num_sectors_(num_sectors)
+{
+  cells_.assign(num_rings_ * num_sectors_, 0);
+  sector_counts_.assign(num_sectors_, 0);
+  ring_key_.assign(num_rings_, 0.0f);
+
+  const double ring_size = max_range / num_rings_;
+  const double sector_size = 2.0 * M_PI / num_sectors_;
+  for (auto & point : points)
+  {
+    double range = std::hypot(point.x, point.y);
+    if (range >= max_range) continue;
+    size_t ring = static_cast<size_t>(range / ring_size);
+    size_t sector = static_cast<size_t>((std::atan2(point.y, point.x) + M_PI) / sector_size);
+    // atan2 can return exactly pi
+    sector = std::min(sector, num_sectors_ - 1);
+
+    uint8_t & cell = cells_[sector * num_rings_ + ring];
+    if (!cell)
+    {
+      cell = 1;
+      ++sector_counts_[sector];
+      ring_key_[ring] += 1.0f;
+    }
+  }
+
+  for (auto & ring : ring_key_)
+  {
+    ring /= num_sectors_;
+  }
+}
+
+const std::vector<float> & ScanDescriptor::getRingKey() const
+{
+  return ring_key_;
+}
+
+double ScanDescriptor::ringKeyDistance(const ScanDescriptor & other) const
+{
+  double sum = 0.0;
+  for (size_t i = 0; i < ring_key_.size() && i < other.ring_key_.size(); ++i)
+  {
+    double d = ring_key_[i] - other.ring_key_[i];
+    sum += d * d;
+  }
+  return std::sqrt(sum);
+}
+
+double ScanDescriptor::distance(const ScanDescriptor & other, double & yaw) const
+{
+  yaw = 0.0;
+  if (num_rings_ != other.num_rings_ || num_sectors_ != other.num_sectors_)
+  {
+    return 1.0;
+  }
+
+  // For each shift, compare sector i of this to sector i + shift of other
+  double best = std::numeric_limits<double>::max();
+  size_t best_shift = 0;
+  for (size_t shift = 0; shift < num_sectors_; ++shift)
+  {
+    double similarity = 0.0;
+    size_t sectors = 0;
+    for (size_t i = 0; i < num_sectors_; ++i)
+    {
+      size_t j = (i + shift) % num_sectors_;
+      if (sector_counts_[i] == 0 || other.sector_counts_[j] == 0)
+      {
+        // Sectors with no returns carry no information
+        continue;
+      }
+
+      // Cosine similarity of binary vectors
+      const uint8_t * a = &cells_[i * num_rings_];
+      const uint8_t * b = &other.cells_[j * num_rings_];
+      size_t common = 0;
+      for (size_t r = 0; r < num_rings_; ++r)
+      {
+        common += a[r] & b[r];
+      }
+      similarity += common / std::sqrt(sector_counts_[i] * other.sector_counts_[j]);
+      ++sectors;
+    }
+
+    double d = (sectors > 0) ? 1.0 - similarity / sectors : 1.0;
+    if (d < best)
+    {
+      best = d;
+      best_shift = shift;
+    }
+  }
+
+  // Bearing of sector i in this scan equals bearing of sector i + shift in other
+  yaw = best_shift * 2.0 * M_PI / num_sectors_;
+  if (yaw > M_PI) yaw -= 2.0 * M_PI;
+  return best;
+}
+
+size_t ScanDescriptor::memoryUsage() const
+{
+  return sizeof(ScanDescriptor) +
+         ring_key_.capacity() * sizeof(float) +
+         cells_.capacity() * sizeof(uint8_t) +
+         sector_counts_.capacity() * sizeof(uint16_t);
+}
+
+}  // namespace ndt_2d
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <chrono>
+#include <ndt_2d/scan_matcher_capture.hpp>
+
+namespace ndt_2d
+{
+
+ScanMatcherCapture::ScanMatcherCapture(const ScanMatcherPtr & matcher, const std::string & type,
+                                       const std::string & filename)
+: matcher_(matcher),
+  type_(type),
+  filename_(filename)
+{
+}
+
+void ScanMatcherCapture::initialize(const std::string & name,
+                                    rclcpp::Node * node, double range_max)
+{
+  // Initialize first, so that the matcher parameters are declared
+  matcher_->initialize(name, node, range_max);
+
+  CaptureHeader header;
+  header.type = type_;
+  header.name = name;
+  header.range_max = range_max;
+  auto names = node->list_parameters({name}, 0).names;
+  header.parameters = node->get_parameters(names);
+
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  if (!writer_.open(filename_, header))
+  {
+    RCLCPP_ERROR(node->get_logger(), "Unable to open capture file %s", filename_.c_str());
+  }
+}
+
+void ScanMatcherCapture::addScans(const std::vector<ScanPtr>::const_iterator & begin,
+                                  const std::vector<ScanPtr>::const_iterator & end)
+{
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    writer_.writeAddScans(begin, end);
+  }
+  matcher_->addScans(begin, end);
+}
+
+double ScanMatcherCapture::matchScan(const ScanPtr & scan, Pose2d & pose,
+                                     Eigen::Matrix3d & covariance) const
+{
+  return matchScan(scan, pose, covariance, std::chrono::steady_clock::time_point::max());
+}
+
+double ScanMatcherCapture::matchScan(const ScanPtr & scan, Pose2d & pose,
+                                     Eigen::Matrix3d & covariance,
+                                     const std::chrono::steady_clock::time_point & deadline) const
+{
+  auto start = std::chrono::steady_clock::now();
+  double score = matcher_->matchScan(scan, pose, covariance, deadline);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+  writer_.writeMatch(scan, score, pose, covariance,
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  return score;
+}
+
+double ScanMatcherCapture::scoreScan(const ScanPtr & scan) const
+{
+  return matcher_->scoreScan(scan);
+}
+
+double ScanMatcherCapture::scorePoints(const std::vector<Point> & points,
+                                       const Pose2d & pose) const
+{
+  return matcher_->scorePoints(points, pose);
+}
+
+void ScanMatcherCapture::scorePoints(const std::vector<Point> & points,
+                                     const std::vector<Pose2d> & poses,
+                                     std::vector<double> & scores) const
+{
+  matcher_->scorePoints(points, poses, scores);
+}
+
+double ScanMatcherCapture::novelty(const ScanPtr & scan) const
+{
+  return matcher_->novelty(scan);
+}
+
+void ScanMatcherCapture::reset()
+{
+  {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    writer_.writeReset();
+  }
+  matcher_->reset();
+}
+
+size_t ScanMatcherCapture::memoryUsage() const
+{
+  return matcher_->memoryUsage();
+}
+
+ScanMatcherModelPtr ScanMatcherCapture::getModel() const
+{
+  return matcher_->getModel();
+}
+
+}  // namespace ndt_2d
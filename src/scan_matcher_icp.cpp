@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <Eigen/Eigenvalues>
+#include <cmath>
+#include <limits>
+#include <ndt_2d/conversions.hpp>
+#include <ndt_2d/scan_matcher_icp.hpp>
+
+namespace ndt_2d
+{
+
+void ScanMatcherICP::initialize(const std::string & name, rclcpp::Node * node, double range_max)
+{
+  max_iterations_ = declareParameter<int>(node, name + ".max_iterations", 10);
+  max_correspondence_distance_ =
+    declareParameter<double>(node, name + ".max_correspondence_distance", 0.3);
+  normal_neighbors_ = declareParameter<int>(node, name + ".normal_neighbors", 5);
+  point_sigma_ = declareParameter<double>(node, name + ".point_sigma", 0.05);
+  laser_max_beams_ = declareParameter<int>(node, name + ".laser_max_beams", 100);
+
+  range_max_ = range_max;
+}
+
+void ScanMatcherICP::addScans(const std::vector<ScanPtr>::const_iterator& begin,
+                              const std::vector<ScanPtr>::const_iterator& end)
+{
+  reset();
+
+  // Transform all points into the map frame
+  for (auto scan = begin; scan != end; ++scan)
+  {
+    Pose2d pose = (*scan)->getPose();
+    double costh = cos(pose.theta);
+    double sinth = sin(pose.theta);
+    for (auto & point : (*scan)->getPoints())
+    {
+      x_.push_back(point.x * costh - point.y * sinth + pose.x);
+      y_.push_back(point.x * sinth + point.y * costh + pose.y);
+    }
+  }
+
+  if (x_.empty())
+  {
+    return;
+  }
+
+  tree_ = std::make_unique<kd_tree_t>(2 /* dimension */, adapter_, 10 /* leaf size */);
+  tree_->buildIndex();
+
+  // Line normal of each point is the minor axis of its neighbors, points
+  // that are not on a line (corners, isolated points) get no normal
+  normal_x_.assign(x_.size(), std::numeric_limits<double>::quiet_NaN());
+  normal_y_.assign(x_.size(), std::numeric_limits<double>::quiet_NaN());
+  std::vector<size_t> indices(normal_neighbors_);
+  std::vector<double> distances(normal_neighbors_);
+  const double max_sq_dist = max_correspondence_distance_ * max_correspondence_distance_;
+  for (size_t i = 0; i < x_.size(); ++i)
+  {
+    const double query[2] = {x_[i], y_[i]};
+    size_t found = tree_->knnSearch(query, normal_neighbors_, &indices[0], &distances[0]);
+
+    Eigen::Vector2d mean = Eigen::Vector2d::Zero();
+    Eigen::Matrix2d correlation = Eigen::Matrix2d::Zero();
+    size_t n = 0;
+    for (size_t j = 0; j < found; ++j)
+    {
+      if (distances[j] > max_sq_dist) continue;
+      Eigen::Vector2d p(x_[indices[j]], y_[indices[j]]);
+      mean += p;
+      correlation += p * p.transpose();
+      ++n;
+    }
+    if (n < 3) continue;
+
+    mean /= n;
+    Eigen::Matrix2d covariance = correlation / n - mean * mean.transpose();
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix2d> solver(covariance);
+    // Eigenvalues are sorted in increasing order
+    if (solver.eigenvalues()(0) > 0.1 * solver.eigenvalues()(1)) continue;
+    normal_x_[i] = solver.eigenvectors()(0, 0);
+    normal_y_[i] = solver.eigenvectors()(1, 0);
+  }
+}
+
+double ScanMatcherICP::matchScan(const ScanPtr & scan, Pose2d & pose,
+                                 Eigen::Matrix3d & covariance) const
+{
+  return matchScan(scan, pose, covariance, std::chrono::steady_clock::time_point::max());
+}
+
+double ScanMatcherICP::matchScan(const ScanPtr & scan, Pose2d & pose,
+                                 Eigen::Matrix3d & covariance,
+                                 const std::chrono::steady_clock::time_point & deadline) const
+{
+  pose = Pose2d();
+  covariance = Eigen::Matrix3d::Identity();
+
+  // Scans must be added first
+  if (!tree_) return 0.0;
+
+  // Subsampled points, in the scan frame
+  std::vector<Eigen::Vector2d> points;
+  transformPoints(scan->getPoints(), Pose2d(), points);
+  if (points.empty()) return 0.0;
+
+  const Pose2d scan_pose = scan->getPose();
+  Eigen::Vector3d estimate(scan_pose.x, scan_pose.y, scan_pose.theta);
+
+  // Gauss-Newton on the point-to-line distances. The extra iteration
+  // computes the score and Hessian at the final estimate.
+  Eigen::Matrix3d hessian;
+  double score = 0.0;
+  size_t correspondences = 0;
+  for (size_t iteration = 0; iteration <= max_iterations_; ++iteration)
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+    {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    hessian.setZero();
+    Eigen::Vector3d gradient = Eigen::Vector3d::Zero();
+    score = 0.0;
+    correspondences = 0;
+
+    double costh = cos(estimate(2));
+    double sinth = sin(estimate(2));
+    for (auto & p : points)
+    {
+      Eigen::Vector2d q(p(0) * costh - p(1) * sinth + estimate(0),
+                        p(0) * sinth + p(1) * costh + estimate(1));
+      size_t index;
+      double d = distance(q(0), q(1), index);
+      if (std::isnan(d)) continue;
+      score -= likelihood(d);
+
+      Eigen::Vector2d normal(normal_x_[index], normal_y_[index]);
+      if (std::isnan(normal(0)))
+      {
+        // Points without a line normal are matched point-to-point
+        if (d == 0.0) continue;
+        normal = (q - Eigen::Vector2d(x_[index], y_[index])) / d;
+      }
+
+      // Derivative of the residual with respect to x, y, theta
+      Eigen::Vector3d jacobian(normal(0), normal(1),
+                               normal(0) * (-p(0) * sinth - p(1) * costh) +
+                               normal(1) * (p(0) * costh - p(1) * sinth));
+      hessian += jacobian * jacobian.transpose();
+      gradient += jacobian * d;
+      ++correspondences;
+    }
+
+    // Need at least as many constraints as degrees of freedom
+    if (correspondences < 3 || iteration == max_iterations_) break;
+
+    Eigen::Vector3d delta = -hessian.ldlt().solve(gradient);
+    if (!delta.allFinite()) break;
+    estimate += delta;
+
+    if (delta.head<2>().norm() < 1e-4 && std::fabs(delta(2)) < 1e-4)
+    {
+      // Converged, next iteration computes final score and Hessian
+      iteration = max_iterations_ - 1;
+    }
+  }
+
+  if (correspondences >= 3)
+  {
+    Eigen::Matrix3d inverse = hessian.inverse();
+    if (inverse.allFinite())
+    {
+      covariance = point_sigma_ * point_sigma_ * inverse;
+    }
+  }
+
+  pose.x = estimate(0) - scan_pose.x;
+  pose.y = estimate(1) - scan_pose.y;
+  pose.theta = estimate(2) - scan_pose.theta;
+  return score / points.size();
+}
+
+double ScanMatcherICP::scoreScan(const ScanPtr & scan) const
+{
+  return scorePoints(scan->getPoints(), scan->getPose());
+}
+
+double ScanMatcherICP::scorePoints(const std::vector<Point> & points, const Pose2d & pose) const
+{
+  // Need a valid map
+  if (!tree_) return 0.0;
+
+  std::vector<Eigen::Vector2d> transformed;
+  transformPoints(points, pose, transformed);
+  if (transformed.empty()) return 0.0;
+
+  double score = 0.0;
+  size_t index;
+  for (auto & p : transformed)
+  {
+    score -= likelihood(distance(p(0), p(1), index));
+  }
+
+  return score / transformed.size();
+}
+
+double ScanMatcherICP::novelty(const ScanPtr & scan) const
+{
+  // Nothing is explained by an empty map
+  if (!tree_) return 1.0;
+
+  std::vector<Point> points = scan->getPoints();
+  if (points.empty()) return 0.0;
+
+  // Same threshold as ScanMatcherNDT, about two standard deviations
+  const double min_likelihood = 0.1;
+
+  // Unlike scoring, this uses every point since small new areas matter
+  const Eigen::Isometry3d t = toEigen(scan->getPose());
+  size_t unexplained = 0;
+  size_t index;
+  for (auto & point : points)
+  {
+    Eigen::Vector3d p(point.x, point.y, 1.0);
+    p = t * p;
+    if (likelihood(distance(p(0), p(1), index)) < min_likelihood)
+    {
+      ++unexplained;
+    }
+  }
+
+  return static_cast<double>(unexplained) / points.size();
+}
+
+void ScanMatcherICP::reset()
+{
+  tree_.reset();
+  x_.clear();
+  y_.clear();
+  normal_x_.clear();
+  normal_y_.clear();
+}
+
+size_t ScanMatcherICP::memoryUsage() const
+{
+  // Approximate the kd-tree as one node per leaf of 10 points
+  size_t bytes = sizeof(ScanMatcherICP);
+  bytes += (x_.capacity() + y_.capacity() + normal_x_.capacity() + normal_y_.capacity()) *
+           sizeof(double);
+  if (tree_) bytes += sizeof(kd_tree_t) + x_.size() * sizeof(size_t) + x_.size() / 10 * 64;
+  return bytes;
+}
+
+double ScanMatcherICP::distance(double x, double y, size_t & index) const
+{
+  const double query[2] = {x, y};
+  double sq_dist;
+  if (tree_->knnSearch(query, 1, &index, &sq_dist) == 0 ||
+      sq_dist > max_correspondence_distance_ * max_correspondence_distance_)
+  {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+
+  if (std::isnan(normal_x_[index]))
+  {
+    return std::sqrt(sq_dist);
+  }
+
+  return normal_x_[index] * (x - x_[index]) + normal_y_[index] * (y - y_[index]);
+}
+
+double ScanMatcherICP::likelihood(double distance) const
+{
+  if (std::isnan(distance)) return 0.0;
+  return std::exp(-0.5 * distance * distance / (point_sigma_ * point_sigma_));
+}
+
+void ScanMatcherICP::transformPoints(const std::vector<Point> & points, const Pose2d & pose,
+                                     std::vector<Eigen::Vector2d> & transformed) const
+{
+  // Subsample the scan
+  size_t scan_points_to_use = std::min(laser_max_beams_, points.size());
+  double scan_step = static_cast<double>(points.size()) / scan_points_to_use;
+
+  double costh = cos(pose.theta);
+  double sinth = sin(pose.theta);
+  transformed.resize(scan_points_to_use);
+  for (size_t i = 0; i < scan_points_to_use; ++i)
+  {
+    const Point & point = points[static_cast<size_t>(i * scan_step)];
+    transformed[i](0) = point.x * costh - point.y * sinth + pose.x;
+    transformed[i](1) = point.x * sinth + point.y * costh + pose.y;
+  }
+}
+
+}  // namespace ndt_2d
+
+#include <pluginlib/class_list_macros.hpp>
+PLUGINLIB_EXPORT_CLASS(ndt_2d::ScanMatcherICP, ndt_2d::ScanMatcher)
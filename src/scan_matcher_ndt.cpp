@@ -26,22 +26,81 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <Eigen/LU>
+#include <angles/angles.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
 #include <ndt_2d/conversions.hpp>
 #include <ndt_2d/scan_matcher_ndt.hpp>
 
 namespace ndt_2d
 {
 
+namespace
+{
+
+// Best pose and working values for covariance computation of a search
+struct SearchResult
+{
+  double best_score = 0.0;
+  Pose2d pose;
+  Eigen::Matrix3d k = Eigen::Matrix3d::Zero();
+  Eigen::Vector3d u = Eigen::Vector3d::Zero();
+  double s = 0.0;
+};
+
+/** @brief Search all translations of rotated points. */
+void searchTranslations(const NDT & ndt, const double * x, const double * y, size_t size,
+                        const std::vector<double> & offsets, double dth, SearchResult & result)
+{
+  for (size_t i = 0; i < offsets.size(); ++i)
+  {
+    const double dx = offsets[i];
+    for (size_t j = 0; j < offsets.size(); ++j)
+    {
+      const double dy = offsets[j];
+      double score = -ndt.likelihood(x, y, size, dx, dy);
+      if (score < result.best_score)
+      {
+        result.best_score = score;
+        result.pose.x = dx;
+        result.pose.y = dy;
+        result.pose.theta = dth;
+      }
+
+      // Covariance computation
+      Eigen::Vector3d v(dx, dy, dth);
+      result.k += v * v.transpose() * score;
+      result.u += v * score;
+      result.s += score;
+    }
+  }
+}
+
+}  // namespace
+
 void ScanMatcherNDT::initialize(const std::string & name, rclcpp::Node * node, double range_max)
 {
-  resolution_ = node->declare_parameter<double>(name + ".ndt_resolution", 0.25);
+  resolution_ = declareParameter<double>(node, name + ".ndt_resolution", 0.25);
 
-  angular_res_ = node->declare_parameter<double>(name + ".search_angular_resolution", 0.0025);
-  angular_size_ = node->declare_parameter<double>(name + ".search_angular_size", 0.1);
-  linear_res_ = node->declare_parameter<double>(name + ".search_linear_resolution", 0.005);
-  linear_size_ = node->declare_parameter<double>(name + ".search_linear_size", 0.05);
+  angular_res_ = declareParameter<double>(node, name + ".search_angular_resolution", 0.0025);
+  angular_size_ = declareParameter<double>(node, name + ".search_angular_size", 0.1);
+  linear_res_ = declareParameter<double>(node, name + ".search_linear_resolution", 0.005);
+  linear_size_ = declareParameter<double>(node, name + ".search_linear_size", 0.05);
 
-  laser_max_beams_ = node->declare_parameter<int>(name + ".laser_max_beams", 100);
+  laser_max_beams_ = declareParameter<int>(node, name + ".laser_max_beams", 100);
+  score_threads_ = std::max(1, declareParameter<int>(node, name + ".score_threads", 1));
+
+  std::string mode = declareParameter<std::string>(node, name + ".mode", "p2d");
+  if (mode != "p2d" && mode != "d2d")
+  {
+    RCLCPP_WARN(node->get_logger(), "Unknown %s.mode %s, using p2d", name.c_str(), mode.c_str());
+  }
+  use_d2d_ = (mode == "d2d");
+  max_iterations_ = declareParameter<int>(node, name + ".max_iterations", 10);
+  d2d_resolution_ = declareParameter<double>(node, name + ".d2d_resolution", 1.0);
 
   range_max_ = range_max;
 }
@@ -63,29 +122,31 @@ void ScanMatcherNDT::addScans(const std::vector<ScanPtr>::const_iterator& begin,
     max_y_ = std::max(pose.y + range_max_, max_y_);
   }
 
-  ndt_ = std::make_unique<NDT>(resolution_,
-                               (max_x_ - min_x_), (max_y_ - min_y_), min_x_, min_y_);
+  auto ndt = std::make_shared<NDT>(resolution_,
+                                   (max_x_ - min_x_), (max_y_ - min_y_), min_x_, min_y_);
   for (auto scan = begin; scan != end; ++scan)
   {
-    ndt_->addScan(*scan);
+    ndt->addScan(*scan);
   }
 
-  ndt_->compute();
+  ndt->compute();
+  ndt_ = ndt;
 }
 
 double ScanMatcherNDT::matchScan(const ScanPtr & scan, Pose2d & pose,
                                  Eigen::Matrix3d & covariance) const
+{
+  return matchScan(scan, pose, covariance, std::chrono::steady_clock::time_point::max());
+}
+
+double ScanMatcherNDT::matchScan(const ScanPtr & scan, Pose2d & pose,
+                                 Eigen::Matrix3d & covariance,
+                                 const std::chrono::steady_clock::time_point & deadline) const
 {
   // Scans must be added first
   if (!ndt_) return 0.0;
 
-  // Search NDT for best correlation for new scan
-  double best_score = 0;
-
-  // Working values for covariance computation
-  Eigen::Matrix3d k = Eigen::Matrix3d::Zero();
-  Eigen::Vector3d u = Eigen::Vector3d::Zero();
-  double s = 0.0;
+  if (use_d2d_) return matchScanD2D(scan, pose, covariance, deadline);
 
   // Local copies
   Pose2d scan_pose = scan->getPose();
@@ -95,42 +156,81 @@ double ScanMatcherNDT::matchScan(const ScanPtr & scan, Pose2d & pose,
   size_t scan_points_to_use = std::min(laser_max_beams_, points.size());
   double scan_step = static_cast<double>(points.size()) / scan_points_to_use;
 
-  std::vector<Point> points_outer;
-  std::vector<Point> points_inner;
-  points_outer.resize(scan_points_to_use);
-  points_inner.resize(scan_points_to_use);
+  // Translations to search, the same in x and y
+  std::vector<double> offsets;
+  for (double d = -linear_size_; d < linear_size_; d += linear_res_)
+  {
+    offsets.push_back(d);
+  }
 
+  // Search NDT for best correlation for new scan
+  SearchResult result;
+  std::vector<double> x(scan_points_to_use), y(scan_points_to_use);
   for (double dth = -angular_size_; dth < angular_size_; dth += angular_res_)
   {
+    if (std::chrono::steady_clock::now() > deadline)
+    {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+
     // Do orientation on the outer loop - then we can simply shift points in inner loops
     double costh = cos(scan_pose.theta + dth);
     double sinth = sin(scan_pose.theta + dth);
-    for (size_t i = 0; i < points_outer.size(); ++i)
+    for (size_t i = 0; i < scan_points_to_use; ++i)
     {
       size_t scan_idx = static_cast<size_t>(i * scan_step);
-      points_outer[i].x = points[scan_idx].x * costh -
-                          points[scan_idx].y * sinth + scan_pose.x;
-      points_outer[i].y = points[scan_idx].x * sinth +
-                          points[scan_idx].y * costh + scan_pose.y;
+      x[i] = points[scan_idx].x * costh - points[scan_idx].y * sinth + scan_pose.x;
+      y[i] = points[scan_idx].x * sinth + points[scan_idx].y * costh + scan_pose.y;
+    }
+    searchTranslations(*ndt_, x.data(), y.data(), scan_points_to_use, offsets, dth, result);
+  }
+
+  pose = result.pose;
+
+  // Compute covariance
+  const double s = result.s;
+  covariance = (1 / s) * result.k + (1 / (s * s) * result.u * result.u.transpose());
+
+  return result.best_score / scan_points_to_use;
+}
+
+double ScanMatcherNDT::matchScanD2D(const ScanPtr & scan, Pose2d & pose,
+                                    Eigen::Matrix3d & covariance,
+                                    const std::chrono::steady_clock::time_point & deadline) const
+{
+  std::vector<Eigen::Vector2d> means;
+  std::vector<Eigen::Matrix2d> covariances;
+  getDistributions(scan, means, covariances);
+  if (means.empty()) return 0.0;
+
+  // Search NDT for best correlation for new scan
+  Pose2d scan_pose = scan->getPose();
+  double best_score = 0;
+  Eigen::Vector3d best(scan_pose.x, scan_pose.y, scan_pose.theta);
+
+  // Working values for covariance computation
+  Eigen::Matrix3d k = Eigen::Matrix3d::Zero();
+  Eigen::Vector3d u = Eigen::Vector3d::Zero();
+  double s = 0.0;
+
+  // Same search as P2D, but each candidate only evaluates tens of cells
+  for (double dth = -angular_size_; dth < angular_size_; dth += angular_res_)
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+    {
+      return std::numeric_limits<double>::quiet_NaN();
     }
 
     for (double dx = -linear_size_; dx < linear_size_; dx += linear_res_)
     {
       for (double dy = -linear_size_; dy < linear_size_; dy += linear_res_)
       {
-        for (size_t i = 0; i < points_inner.size(); ++i)
-        {
-          points_inner[i].x = points_outer[i].x + dx;
-          points_inner[i].y = points_outer[i].y + dy;
-        }
-
-        double score = -ndt_->likelihood(points_inner);
+        Eigen::Vector3d candidate(scan_pose.x + dx, scan_pose.y + dy, scan_pose.theta + dth);
+        double score = scoreDistributions(means, covariances, candidate);
         if (score < best_score)
         {
           best_score = score;
-          pose.x = dx;
-          pose.y = dy;
-          pose.theta = dth;
+          best = candidate;
         }
 
         // Covariance computation
@@ -142,14 +242,145 @@ double ScanMatcherNDT::matchScan(const ScanPtr & scan, Pose2d & pose,
     }
   }
 
+  // Refine the best candidate below the search resolution using Newton's method
+  for (size_t iteration = 0; iteration < max_iterations_; ++iteration)
+  {
+    Eigen::Vector3d gradient;
+    Eigen::Matrix3d hessian;
+    scoreDistributions(means, covariances, best, &gradient, &hessian);
+    if (std::abs(hessian.determinant()) < 1e-12) break;
+    Eigen::Vector3d step = -hessian.inverse() * gradient;
+
+    // Backtrack until the score improves
+    bool improved = false;
+    for (size_t i = 0; i < 5; ++i)
+    {
+      double score = scoreDistributions(means, covariances, best + step);
+      if (score < best_score)
+      {
+        best_score = score;
+        best += step;
+        improved = true;
+        break;
+      }
+      step *= 0.5;
+    }
+    if (!improved || step.norm() < 1e-5) break;
+  }
+
+  pose.x = best(0) - scan_pose.x;
+  pose.y = best(1) - scan_pose.y;
+  pose.theta = angles::normalize_angle(best(2) - scan_pose.theta);
+
   // Compute covariance
   covariance = (1 / s) * k + (1 / (s * s) * u * u.transpose());
 
-  return best_score / scan_points_to_use;
+  return best_score / means.size();
+}
+
+void ScanMatcherNDT::getDistributions(const ScanPtr & scan, std::vector<Eigen::Vector2d> & means,
+                                      std::vector<Eigen::Matrix2d> & covariances) const
+{
+  means.clear();
+  covariances.clear();
+
+  std::vector<Point> points = scan->getPoints();
+  if (points.empty()) return;
+
+  // Bounding box of the points, in the scan frame
+  double min_x = points[0].x, max_x = points[0].x;
+  double min_y = points[0].y, max_y = points[0].y;
+  for (auto & point : points)
+  {
+    min_x = std::min(point.x, min_x);
+    max_x = std::max(point.x, max_x);
+    min_y = std::min(point.y, min_y);
+    max_y = std::max(point.y, max_y);
+  }
+
+  // The query NDT is built at the origin, so it is valid for any pose
+  ScanPtr local = std::make_shared<Scan>(scan->getId());
+  local->setPoints(points);
+  NDT ndt(d2d_resolution_, max_x - min_x, max_y - min_y, min_x, min_y);
+  ndt.addScan(local);
+  ndt.compute();
+
+  for (size_t i = 0; i < ndt.getNumCells(); ++i)
+  {
+    const Cell & cell = ndt.getCells()[i];
+    // Same minimum number of points as Cell::score()
+    if (cell.valid && cell.n >= 5)
+    {
+      means.push_back(cell.mean);
+      covariances.push_back(cell.covariance);
+    }
+  }
+}
+
+double ScanMatcherNDT::scoreDistributions(const std::vector<Eigen::Vector2d> & means,
+                                          const std::vector<Eigen::Matrix2d> & covariances,
+                                          const Eigen::Vector3d & pose,
+                                          Eigen::Vector3d * gradient,
+                                          Eigen::Matrix3d * hessian) const
+{
+  if (gradient) gradient->setZero();
+  if (hessian) hessian->setZero();
+
+  // Cells along a wall are nearly singular, two parallel walls would
+  // have a singular combined covariance without some minimum noise
+  const Eigen::Matrix2d noise = Eigen::Matrix2d::Identity() * 0.0001;
+
+  Eigen::Matrix2d rotation;
+  rotation << cos(pose(2)), -sin(pose(2)),
+              sin(pose(2)), cos(pose(2));
+  Eigen::Matrix2d rotation_derivative;
+  rotation_derivative << -sin(pose(2)), -cos(pose(2)),
+                         cos(pose(2)), -sin(pose(2));
+
+  double score = 0.0;
+  for (size_t i = 0; i < means.size(); ++i)
+  {
+    Eigen::Vector2d mean = rotation * means[i] + pose.head<2>();
+    const Cell * cell = ndt_->getCell(mean);
+    if (!cell || !cell->valid || cell->n < 5) continue;
+
+    // Likelihood of the difference of the two Gaussians
+    Eigen::Vector2d m = mean - cell->mean;
+    Eigen::Matrix2d b =
+      rotation * covariances[i] * rotation.transpose() + cell->covariance + noise;
+    Eigen::Matrix2d b_inv = b.inverse();
+    Eigen::Vector2d b_inv_m = b_inv * m;
+    double likelihood = std::exp(-0.5 * m.dot(b_inv_m));
+    score -= likelihood;
+
+    if (gradient && hessian)
+    {
+      // Jacobian of m with respect to (x, y, theta), the rotation of the
+      // covariance is small over a step, so it is held constant
+      Eigen::Matrix<double, 2, 3> j;
+      j.leftCols<2>() = Eigen::Matrix2d::Identity();
+      j.col(2) = rotation_derivative * means[i];
+      *gradient += likelihood * j.transpose() * b_inv_m;
+      *hessian += likelihood * j.transpose() * b_inv * j;
+    }
+  }
+
+  return score;
 }
 
 double ScanMatcherNDT::scoreScan(const ScanPtr & scan) const
 {
+  if (use_d2d_ && ndt_)
+  {
+    std::vector<Eigen::Vector2d> means;
+    std::vector<Eigen::Matrix2d> covariances;
+    getDistributions(scan, means, covariances);
+    if (means.empty()) return 0.0;
+
+    Pose2d pose = scan->getPose();
+    Eigen::Vector3d p(pose.x, pose.y, pose.theta);
+    return scoreDistributions(means, covariances, p) / means.size();
+  }
   return scorePoints(scan->getPoints(), scan->getPose());
 }
 
@@ -177,11 +408,133 @@ double ScanMatcherNDT::scorePoints(const std::vector<Point> & points, const Pose
   return score / scan_points_to_use;
 }
 
+void ScanMatcherNDT::scorePoints(const std::vector<Point> & points,
+                                 const std::vector<Pose2d> & poses,
+                                 std::vector<double> & scores) const
+{
+  scores.assign(poses.size(), 0.0);
+
+  // Need a valid NDT
+  if (!ndt_ || points.empty()) return;
+
+  // Subsample the scan once, for all poses
+  size_t scan_points_to_use = std::min(laser_max_beams_, points.size());
+  double scan_step = static_cast<double>(points.size()) / scan_points_to_use;
+  std::vector<double> xs(scan_points_to_use), ys(scan_points_to_use);
+  for (size_t i = 0; i < scan_points_to_use; ++i)
+  {
+    size_t scan_idx = static_cast<size_t>(i * scan_step);
+    xs[i] = points[scan_idx].x;
+    ys[i] = points[scan_idx].y;
+  }
+
+  // Precompute the poses as separate arrays
+  std::vector<double> pose_x(poses.size()), pose_y(poses.size());
+  std::vector<double> pose_cos(poses.size()), pose_sin(poses.size());
+  for (size_t i = 0; i < poses.size(); ++i)
+  {
+    pose_x[i] = poses[i].x;
+    pose_y[i] = poses[i].y;
+    pose_cos[i] = cos(poses[i].theta);
+    pose_sin[i] = sin(poses[i].theta);
+  }
+
+  // Score a range of poses, the NDT is only read so ranges can run in parallel
+  auto score_range = [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
+    {
+      double score = 0.0;
+      for (size_t j = 0; j < scan_points_to_use; ++j)
+      {
+        Eigen::Vector2d p(xs[j] * pose_cos[i] - ys[j] * pose_sin[i] + pose_x[i],
+                          xs[j] * pose_sin[i] + ys[j] * pose_cos[i] + pose_y[i]);
+        score += -ndt_->likelihood(p);
+      }
+      scores[i] = score / scan_points_to_use;
+    }
+  };
+
+  size_t num_threads = std::min(score_threads_, poses.size());
+  if (num_threads <= 1)
+  {
+    score_range(0, poses.size());
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  size_t chunk = (poses.size() + num_threads - 1) / num_threads;
+  for (size_t begin = chunk; begin < poses.size(); begin += chunk)
+  {
+    threads.emplace_back(score_range, begin, std::min(begin + chunk, poses.size()));
+  }
+  // This thread scores the first chunk
+  score_range(0, std::min(chunk, poses.size()));
+  for (auto & thread : threads)
+  {
+    thread.join();
+  }
+}
+
+double ScanMatcherNDT::novelty(const ScanPtr & scan) const
+{
+  // Nothing is explained by an empty NDT
+  if (!ndt_) return 1.0;
+
+  std::vector<Point> points = scan->getPoints();
+  if (points.empty()) return 0.0;
+
+  // Points more than about two standard deviations from any cell are unexplained
+  const double min_likelihood = 0.1;
+
+  // Unlike scoring, this uses every point since small new areas matter
+  const Eigen::Isometry3d t = toEigen(scan->getPose());
+  size_t unexplained = 0;
+  for (auto & point : points)
+  {
+    Eigen::Vector3d p(point.x, point.y, 1.0);
+    p = t * p;
+    if (ndt_->likelihood(p) < min_likelihood)
+    {
+      ++unexplained;
+    }
+  }
+
+  return static_cast<double>(unexplained) / points.size();
+}
+
 void ScanMatcherNDT::reset()
 {
   ndt_.reset();
 }
 
+size_t ScanMatcherNDT::memoryUsage() const
+{
+  size_t bytes = sizeof(ScanMatcherNDT);
+  if (ndt_) bytes += ndt_->memoryUsage();
+  return bytes;
+}
+
+ScanMatcherModelPtr ScanMatcherNDT::getModel() const
+{
+  if (!ndt_) return nullptr;
+  return std::make_shared<ScanMatcherNDTModel>(ndt_);
+}
+
+bool ScanMatcherNDT::setModel(const ScanMatcherModelPtr & model)
+{
+  auto ndt_model = std::dynamic_pointer_cast<const ScanMatcherNDTModel>(model);
+  if (!ndt_model) return false;
+  ndt_ = ndt_model->ndt;
+  return true;
+}
+
+ScanMatcherPtr ScanMatcherNDT::clone() const
+{
+  // Parameters are copied, the NDT is shared
+  return std::make_shared<ScanMatcherNDT>(*this);
+}
+
 }  // namespace ndt_2d
 
 #include <pluginlib/class_list_macros.hpp>
@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <ndt_2d/scan_matcher_psm.hpp>
+
+namespace ndt_2d
+{
+
+void ScanMatcherPSM::initialize(const std::string & name, rclcpp::Node * node, double range_max)
+{
+  angular_res_ = declareParameter<double>(node, name + ".angular_resolution", 0.0087);
+  angular_size_ = declareParameter<double>(node, name + ".search_angular_size", 0.1);
+  linear_res_ = declareParameter<double>(node, name + ".search_linear_resolution", 0.01);
+  linear_size_ = declareParameter<double>(node, name + ".search_linear_size", 0.05);
+  range_sigma_ = declareParameter<double>(node, name + ".range_sigma", 0.05);
+
+  range_max_ = range_max;
+
+  // Bins must evenly divide the circle, so that shifts wrap around
+  bins_ = std::max<size_t>(1, std::round(2.0 * M_PI / angular_res_));
+  bin_size_ = 2.0 * M_PI / bins_;
+}
+
+void ScanMatcherPSM::addScans(const std::vector<ScanPtr>::const_iterator& begin,
+                              const std::vector<ScanPtr>::const_iterator& end)
+{
+  reset();
+
+  // Transform all points into the map frame
+  std::vector<double> x, y;
+  for (auto scan = begin; scan != end; ++scan)
+  {
+    Pose2d pose = (*scan)->getPose();
+    double costh = cos(pose.theta);
+    double sinth = sin(pose.theta);
+    for (auto & point : (*scan)->getPoints())
+    {
+      x.push_back(point.x * costh - point.y * sinth + pose.x);
+      y.push_back(point.x * sinth + point.y * costh + pose.y);
+    }
+  }
+  if (x.empty()) return;
+
+  // Sort points into a grid, cells are small enough that a search only
+  // visits a little more area than the range of the laser
+  cell_size_ = std::max(range_max_ / 4.0, 0.1);
+  origin_x_ = *std::min_element(x.begin(), x.end());
+  origin_y_ = *std::min_element(y.begin(), y.end());
+  size_x_ = static_cast<int>((*std::max_element(x.begin(), x.end()) - origin_x_) / cell_size_) + 1;
+  size_y_ = static_cast<int>((*std::max_element(y.begin(), y.end()) - origin_y_) / cell_size_) + 1;
+
+  std::vector<size_t> cells(x.size());
+  cell_start_.assign(size_x_ * size_y_ + 1, 0);
+  for (size_t i = 0; i < x.size(); ++i)
+  {
+    int cx = static_cast<int>((x[i] - origin_x_) / cell_size_);
+    int cy = static_cast<int>((y[i] - origin_y_) / cell_size_);
+    cells[i] = cy * size_x_ + cx;
+    ++cell_start_[cells[i] + 1];
+  }
+  for (size_t i = 1; i < cell_start_.size(); ++i)
+  {
+    cell_start_[i] += cell_start_[i - 1];
+  }
+
+  x_.resize(x.size());
+  y_.resize(y.size());
+  std::vector<size_t> next(cell_start_.begin(), cell_start_.end() - 1);
+  for (size_t i = 0; i < x.size(); ++i)
+  {
+    size_t index = next[cells[i]]++;
+    x_[index] = x[i];
+    y_[index] = y[i];
+  }
+}
+
+double ScanMatcherPSM::matchScan(const ScanPtr & scan, Pose2d & pose,
+                                 Eigen::Matrix3d & covariance) const
+{
+  return matchScan(scan, pose, covariance, std::chrono::steady_clock::time_point::max());
+}
+
+double ScanMatcherPSM::matchScan(const ScanPtr & scan, Pose2d & pose,
+                                 Eigen::Matrix3d & covariance,
+                                 const std::chrono::steady_clock::time_point & deadline) const
+{
+  pose = Pose2d();
+  covariance = Eigen::Matrix3d::Identity();
+
+  // Scans must be added first
+  if (x_.empty()) return 0.0;
+
+  std::vector<double> query;
+  project(scan->getPoints(), query);
+  size_t query_bins = std::count_if(query.begin(), query.end(),
+                                    [](double r) { return std::isfinite(r); });
+  if (query_bins == 0) return 0.0;
+
+  // Only map points that can be seen from any candidate pose
+  Pose2d scan_pose = scan->getPose();
+  std::vector<double> x, y;
+  getNearbyPoints(scan_pose, range_max_ + std::sqrt(2.0) * linear_size_, x, y);
+
+  // Search translations on a grid, rotations by shifting the query image
+  const int max_shift = std::round(angular_size_ / bin_size_);
+  double best_score = 0;
+  int best_shift = 0;
+
+  // Working values for covariance computation
+  Eigen::Matrix3d k = Eigen::Matrix3d::Zero();
+  Eigen::Vector3d u = Eigen::Vector3d::Zero();
+  double s = 0.0;
+
+  std::vector<double> model;
+  for (double dx = -linear_size_; dx < linear_size_; dx += linear_res_)
+  {
+    if (std::chrono::steady_clock::now() > deadline)
+    {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    for (double dy = -linear_size_; dy < linear_size_; dy += linear_res_)
+    {
+      // Project the map once per translation
+      project(x, y, Pose2d(scan_pose.x + dx, scan_pose.y + dy, scan_pose.theta), model);
+
+      // Each rotation is just a shift of the query image
+      for (int shift = -max_shift; shift <= max_shift; ++shift)
+      {
+        double score = -compare(query, model, shift);
+        if (score < best_score)
+        {
+          best_score = score;
+          best_shift = shift;
+          pose.x = dx;
+          pose.y = dy;
+        }
+
+        // Covariance computation
+        Eigen::Vector3d v(dx, dy, shift * bin_size_);
+        k += v * v.transpose() * score;
+        u += v * score;
+        s += score;
+      }
+    }
+  }
+
+  // Nothing matched at all
+  if (best_score == 0.0) return 0.0;
+
+  // Refine the rotation below the bin size, fitting a parabola to the scores
+  project(x, y, Pose2d(scan_pose.x + pose.x, scan_pose.y + pose.y, scan_pose.theta), model);
+  double before = -compare(query, model, best_shift - 1);
+  double after = -compare(query, model, best_shift + 1);
+  double curvature = before - 2.0 * best_score + after;
+  double offset = 0.0;
+  if (curvature > 0.0)
+  {
+    offset = std::max(-0.5, std::min(0.5, 0.5 * (before - after) / curvature));
+  }
+  pose.theta = (best_shift + offset) * bin_size_;
+
+  // Compute covariance
+  covariance = (1 / s) * k + (1 / (s * s) * u * u.transpose());
+
+  return best_score / query_bins;
+}
+
+double ScanMatcherPSM::scoreScan(const ScanPtr & scan) const
+{
+  return scorePoints(scan->getPoints(), scan->getPose());
+}
+
+double ScanMatcherPSM::scorePoints(const std::vector<Point> & points, const Pose2d & pose) const
+{
+  std::vector<double> scores;
+  scorePoints(points, {pose}, scores);
+  return scores[0];
+}
+
+void ScanMatcherPSM::scorePoints(const std::vector<Point> & points,
+                                 const std::vector<Pose2d> & poses,
+                                 std::vector<double> & scores) const
+{
+  scores.assign(poses.size(), 0.0);
+  if (x_.empty()) return;
+
+  // Query image is the same for every pose
+  std::vector<double> query, model;
+  project(points, query);
+  size_t query_bins = std::count_if(query.begin(), query.end(),
+                                    [](double r) { return std::isfinite(r); });
+  if (query_bins == 0) return;
+
+  std::vector<double> x, y;
+  for (size_t i = 0; i < poses.size(); ++i)
+  {
+    getNearbyPoints(poses[i], range_max_, x, y);
+    project(x, y, poses[i], model);
+    scores[i] = -compare(query, model, 0) / query_bins;
+  }
+}
+
+double ScanMatcherPSM::novelty(const ScanPtr & scan) const
+{
+  // Nothing is explained by an empty map
+  if (x_.empty()) return 1.0;
+
+  std::vector<double> query, model, x, y;
+  project(scan->getPoints(), query);
+  getNearbyPoints(scan->getPose(), range_max_, x, y);
+  project(x, y, scan->getPose(), model);
+
+  // Same threshold as ScanMatcherNDT, about two standard deviations
+  const double min_likelihood = 0.1;
+
+  size_t query_bins = 0, unexplained = 0;
+  for (size_t i = 0; i < bins_; ++i)
+  {
+    if (!std::isfinite(query[i])) continue;
+    ++query_bins;
+    if (!std::isfinite(model[i]) || likelihood(query[i] - model[i]) < min_likelihood)
+    {
+      ++unexplained;
+    }
+  }
+
+  if (query_bins == 0) return 0.0;
+  return static_cast<double>(unexplained) / query_bins;
+}
+
+void ScanMatcherPSM::reset()
+{
+  // Release the memory, maps can be large
+  std::vector<double>().swap(x_);
+  std::vector<double>().swap(y_);
+  std::vector<size_t>().swap(cell_start_);
+}
+
+size_t ScanMatcherPSM::memoryUsage() const
+{
+  return sizeof(ScanMatcherPSM) + (x_.capacity() + y_.capacity()) * sizeof(double) +
+         cell_start_.capacity() * sizeof(size_t);
+}
+
+void ScanMatcherPSM::project(const std::vector<double> & x, const std::vector<double> & y,
+                             const Pose2d & pose, std::vector<double> & ranges) const
+{
+  ranges.assign(bins_, std::numeric_limits<double>::infinity());
+  for (size_t i = 0; i < x.size(); ++i)
+  {
+    const double dx = x[i] - pose.x;
+    const double dy = y[i] - pose.y;
+    const double range = std::hypot(dx, dy);
+    if (range > range_max_) continue;
+
+    // Bearing relative to the heading, from -pi to pi
+    double bearing = std::atan2(dy, dx) - pose.theta;
+    size_t bin = static_cast<size_t>(std::floor((bearing + M_PI) / bin_size_ + bins_)) % bins_;
+    ranges[bin] = std::min(ranges[bin], range);
+  }
+}
+
+void ScanMatcherPSM::project(const std::vector<Point> & points, std::vector<double> & ranges) const
+{
+  std::vector<double> x, y;
+  x.reserve(points.size());
+  y.reserve(points.size());
+  for (auto & point : points)
+  {
+    x.push_back(point.x);
+    y.push_back(point.y);
+  }
+  project(x, y, Pose2d(), ranges);
+}
+
+double ScanMatcherPSM::compare(const std::vector<double> & query,
+                               const std::vector<double> & model, int shift) const
+{
+  // Query bin i, rotated by shift, falls in model bin i + shift
+  const int bins = bins_;
+  double score = 0.0;
+  for (int i = 0; i < bins; ++i)
+  {
+    if (!std::isfinite(query[i])) continue;
+    double range = model[((i + shift) % bins + bins) % bins];
+    if (!std::isfinite(range)) continue;
+    score += likelihood(query[i] - range);
+  }
+  return score;
+}
+
+double ScanMatcherPSM::likelihood(double difference) const
+{
+  return std::exp(-0.5 * difference * difference / (range_sigma_ * range_sigma_));
+}
+
+int ScanMatcherPSM::getCell(double coordinate, double origin, int size) const
+{
+  // Clamp before converting, coordinates may be far outside the grid
+  double cell = std::floor((coordinate - origin) / cell_size_);
+  return static_cast<int>(std::max(-1.0, std::min(static_cast<double>(size), cell)));
+}
+
+void ScanMatcherPSM::getNearbyPoints(const Pose2d & pose, double distance,
+                                     std::vector<double> & x, std::vector<double> & y) const
+{
+  x.clear();
+  y.clear();
+  if (x_.empty()) return;
+
+  // Cells overlapping the bounding box of the search
+  int min_x = getCell(pose.x - distance, origin_x_, size_x_);
+  int max_x = getCell(pose.x + distance, origin_x_, size_x_);
+  int min_y = getCell(pose.y - distance, origin_y_, size_y_);
+  int max_y = getCell(pose.y + distance, origin_y_, size_y_);
+  if (max_x < 0 || max_y < 0 || min_x >= size_x_ || min_y >= size_y_) return;
+  min_x = std::max(min_x, 0);
+  min_y = std::max(min_y, 0);
+  max_x = std::min(max_x, size_x_ - 1);
+  max_y = std::min(max_y, size_y_ - 1);
+
+  const double distance_sq = distance * distance;
+  for (int cy = min_y; cy <= max_y; ++cy)
+  {
+    // Cells of a row are consecutive
+    size_t end = cell_start_[cy * size_x_ + max_x + 1];
+    for (size_t i = cell_start_[cy * size_x_ + min_x]; i < end; ++i)
+    {
+      const double dx = x_[i] - pose.x;
+      const double dy = y_[i] - pose.y;
+      if (dx * dx + dy * dy < distance_sq)
+      {
+        x.push_back(x_[i]);
+        y.push_back(y_[i]);
+      }
+    }
+  }
+}
+
+}  // namespace ndt_2d
+
+#include <pluginlib/class_list_macros.hpp>
+PLUGINLIB_EXPORT_CLASS(ndt_2d::ScanMatcherPSM, ndt_2d::ScanMatcher)
@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <ndt_2d/shared_map.hpp>
+
+namespace ndt_2d
+{
+
+static const char SHARED_MAP_MAGIC[8] = {'N', 'D', 'T', '2', 'D', 'S', 'H', 'M'};
+static const uint32_t SHARED_MAP_VERSION = 1;
+// Sections start at multiples of this, so Eigen members of cells are aligned
+static const uint64_t SHARED_MAP_ALIGNMENT = 64;
+
+struct SharedMapHeader
+{
+  char magic[8];
+  uint32_t version;
+  // sizeof(Cell) of the writer, cells are stored as is
+  uint32_t cell_bytes;
+  uint64_t num_scans, scans_offset;
+  uint64_t num_points, points_offset;
+  uint64_t num_constraints, constraints_offset;
+  // NDT, size_x and size_y are zero if there is none
+  double ndt_cell_size, ndt_origin_x, ndt_origin_y;
+  uint64_t ndt_size_x, ndt_size_y, ndt_cells_offset;
+};
+
+struct SharedScan
+{
+  uint64_t id;
+  double x, y, theta;
+  // Points of the scan are num_points, starting at first_point
+  uint64_t first_point, num_points;
+};
+
+struct SharedConstraint
+{
+  uint64_t begin, end;
+  double transform[3];
+  double information[9];
+  uint64_t switchable;
+};
+
+static uint64_t align(uint64_t offset)
+{
+  return (offset + SHARED_MAP_ALIGNMENT - 1) / SHARED_MAP_ALIGNMENT * SHARED_MAP_ALIGNMENT;
+}
+
+// Are count elements at offset within a file of this size, without overflow
+static bool fits(uint64_t offset, uint64_t count, uint64_t element, uint64_t size)
+{
+  return offset <= size && count <= (size - offset) / element;
+}
+
+static void pad(std::ofstream & file, uint64_t offset)
+{
+  static const char zeros[SHARED_MAP_ALIGNMENT] = {};
+  file.write(zeros, offset - static_cast<uint64_t>(file.tellp()));
+}
+
+bool SharedMap::write(const std::string & filename, const std::vector<ScanPtr> & scans,
+                      const std::vector<ConstraintPtr> & constraints, const NDT * ndt)
+{
+  SharedMapHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SHARED_MAP_MAGIC, sizeof(header.magic));
+  header.version = SHARED_MAP_VERSION;
+  header.cell_bytes = sizeof(Cell);
+
+  // Layout the sections
+  std::vector<SharedScan> shared_scans(scans.size());
+  for (size_t i = 0; i < scans.size(); ++i)
+  {
+    Pose2d pose = scans[i]->getPose();
+    shared_scans[i].id = scans[i]->getId();
+    shared_scans[i].x = pose.x;
+    shared_scans[i].y = pose.y;
+    shared_scans[i].theta = pose.theta;
+    shared_scans[i].first_point = header.num_points;
+    shared_scans[i].num_points = scans[i]->getPoints().size();
+    header.num_points += shared_scans[i].num_points;
+  }
+  header.num_scans = scans.size();
+  header.num_constraints = constraints.size();
+  header.scans_offset = align(sizeof(header));
+  header.points_offset = align(header.scans_offset + header.num_scans * sizeof(SharedScan));
+  header.constraints_offset = align(header.points_offset + header.num_points * sizeof(Point));
+  uint64_t end = header.constraints_offset + header.num_constraints * sizeof(SharedConstraint);
+  if (ndt)
+  {
+    header.ndt_cell_size = ndt->cell_size_;
+    header.ndt_origin_x = ndt->origin_x_;
+    header.ndt_origin_y = ndt->origin_y_;
+    header.ndt_size_x = ndt->size_x_;
+    header.ndt_size_y = ndt->size_y_;
+    header.ndt_cells_offset = align(end);
+  }
+
+  std::string tmp_filename = filename + ".tmp";
+  std::ofstream file(tmp_filename, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+  {
+    return false;
+  }
+
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  pad(file, header.scans_offset);
+  file.write(reinterpret_cast<const char *>(shared_scans.data()),
+             shared_scans.size() * sizeof(SharedScan));
+
+  pad(file, header.points_offset);
+  for (auto & scan : scans)
+  {
+    std::vector<Point> points = scan->getPoints();
+    file.write(reinterpret_cast<const char *>(points.data()), points.size() * sizeof(Point));
+  }
+
+  pad(file, header.constraints_offset);
+  for (auto & constraint : constraints)
+  {
+    SharedConstraint c;
+    c.begin = constraint->begin;
+    c.end = constraint->end;
+    for (size_t i = 0; i < 3; ++i)
+    {
+      c.transform[i] = constraint->transform(i);
+    }
+    for (size_t i = 0; i < 9; ++i)
+    {
+      c.information[i] = constraint->information(i / 3, i % 3);
+    }
+    c.switchable = constraint->switchable;
+    file.write(reinterpret_cast<const char *>(&c), sizeof(c));
+  }
+
+  if (ndt)
+  {
+    pad(file, header.ndt_cells_offset);
+    file.write(reinterpret_cast<const char *>(ndt->cell_data_),
+               ndt->getNumCells() * sizeof(Cell));
+  }
+
+  file.close();
+  if (!file)
+  {
+    std::remove(tmp_filename.c_str());
+    return false;
+  }
+
+  // Readers attached to the old file keep their mapping of it
+  return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+std::shared_ptr<const SharedMap> SharedMap::open(const std::string & filename)
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SharedMapHeader))
+  {
+    ::close(fd);
+    return nullptr;
+  }
+
+  // Mapping remains valid after the file is closed
+  void * data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+  {
+    return nullptr;
+  }
+  std::shared_ptr<SharedMap> map(new SharedMap(static_cast<const uint8_t *>(data), st.st_size));
+
+  // Validate everything that accessors rely on
+  const SharedMapHeader & header = *map->at<SharedMapHeader>(0);
+  if (std::memcmp(header.magic, SHARED_MAP_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != SHARED_MAP_VERSION || header.cell_bytes != sizeof(Cell))
+  {
+    return nullptr;
+  }
+
+  uint64_t size = map->size_;
+  uint64_t num_cells = header.ndt_size_x * header.ndt_size_y;
+  if (!fits(header.scans_offset, header.num_scans, sizeof(SharedScan), size) ||
+      !fits(header.points_offset, header.num_points, sizeof(Point), size) ||
+      !fits(header.constraints_offset, header.num_constraints, sizeof(SharedConstraint), size) ||
+      (header.ndt_size_y > 0 && header.ndt_size_x > UINT64_MAX / header.ndt_size_y) ||
+      (num_cells > 0 && (header.ndt_cells_offset % SHARED_MAP_ALIGNMENT != 0 ||
+                         !fits(header.ndt_cells_offset, num_cells, sizeof(Cell), size))))
+  {
+    return nullptr;
+  }
+
+  const SharedScan * scans = map->at<SharedScan>(header.scans_offset);
+  for (uint64_t i = 0; i < header.num_scans; ++i)
+  {
+    if (scans[i].first_point > header.num_points ||
+        scans[i].num_points > header.num_points - scans[i].first_point)
+    {
+      return nullptr;
+    }
+  }
+
+  return map;
+}
+
+SharedMap::SharedMap(const uint8_t * data, size_t size)
+: data_(data),
+  size_(size)
+{
+}
+
+SharedMap::~SharedMap()
+{
+  munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+size_t SharedMap::getNumScans() const
+{
+  return at<SharedMapHeader>(0)->num_scans;
+}
+
+size_t SharedMap::getScanId(size_t index) const
+{
+  return at<SharedScan>(at<SharedMapHeader>(0)->scans_offset)[index].id;
+}
+
+Pose2d SharedMap::getScanPose(size_t index) const
+{
+  const SharedScan & scan = at<SharedScan>(at<SharedMapHeader>(0)->scans_offset)[index];
+  return Pose2d(scan.x, scan.y, scan.theta);
+}
+
+const Point * SharedMap::getScanPoints(size_t index, size_t & size) const
+{
+  const SharedMapHeader & header = *at<SharedMapHeader>(0);
+  const SharedScan & scan = at<SharedScan>(header.scans_offset)[index];
+  size = scan.num_points;
+  return at<Point>(header.points_offset) + scan.first_point;
+}
+
+size_t SharedMap::getNumConstraints() const
+{
+  return at<SharedMapHeader>(0)->num_constraints;
+}
+
+Constraint SharedMap::getConstraint(size_t index) const
+{
+  const SharedMapHeader & header = *at<SharedMapHeader>(0);
+  const SharedConstraint & c = at<SharedConstraint>(header.constraints_offset)[index];
+
+  Constraint constraint;
+  constraint.begin = c.begin;
+  constraint.end = c.end;
+  for (size_t i = 0; i < 3; ++i)
+  {
+    constraint.transform(i) = c.transform[i];
+  }
+  for (size_t i = 0; i < 9; ++i)
+  {
+    constraint.information(i / 3, i % 3) = c.information[i];
+  }
+  constraint.switchable = c.switchable != 0;
+  return constraint;
+}
+
+std::shared_ptr<const NDT> SharedMap::getNDT() const
+{
+  const SharedMapHeader & header = *at<SharedMapHeader>(0);
+  if (header.ndt_size_x == 0 || header.ndt_size_y == 0)
+  {
+    return nullptr;
+  }
+
+  return std::make_shared<const NDT>(header.ndt_cell_size, header.ndt_size_x, header.ndt_size_y,
+                                     header.ndt_origin_x, header.ndt_origin_y,
+                                     at<Cell>(header.ndt_cells_offset), shared_from_this());
+}
+
+size_t SharedMap::size() const
+{
+  return size_;
+}
+
+}  // namespace ndt_2d
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <vector>
+#include <ndt_2d/capture.hpp>
+
+TEST(CaptureTests, read_write_test)
+{
+  const std::string FILENAME = "test_capture.ndtcap";
+
+  ndt_2d::CaptureHeader header;
+  header.type = "ndt_2d::ScanMatcherNDT";
+  header.name = "local_scan_matcher";
+  header.range_max = 12.5;
+  header.parameters.emplace_back("local_scan_matcher.ndt_resolution", 0.25);
+  header.parameters.emplace_back("local_scan_matcher.laser_max_beams", 100);
+  header.parameters.emplace_back("local_scan_matcher.mode", std::string("p2d"));
+
+  std::vector<ndt_2d::Point> points;
+  points.emplace_back(1.0, 2.0);
+  points.emplace_back(3.0, 4.0);
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  for (size_t i = 0; i < 2; ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    scan->setPose(ndt_2d::Pose2d(i, 0.0, 0.1));
+    scan->setPoints(points);
+    scans.push_back(scan);
+  }
+
+  ndt_2d::ScanPtr query = std::make_shared<ndt_2d::Scan>(2);
+  query->setPose(ndt_2d::Pose2d(2.0, 0.5, 0.2));
+  query->setPoints(points);
+
+  Eigen::Matrix3d covariance = Eigen::Matrix3d::Identity();
+  covariance(0, 1) = 0.5;
+
+  {
+    ndt_2d::CaptureWriter writer;
+    ASSERT_TRUE(writer.open(FILENAME, header));
+    writer.writeAddScans(scans.begin(), scans.end());
+    // Scan points should only be written once
+    writer.writeReset();
+    writer.writeAddScans(scans.begin(), scans.end());
+    writer.writeMatch(query, -0.75, ndt_2d::Pose2d(0.01, -0.02, 0.03), covariance, 12345);
+  }
+
+  ndt_2d::CaptureHeader read_header;
+  ndt_2d::CaptureReader reader;
+  ASSERT_TRUE(reader.open(FILENAME, read_header));
+  EXPECT_EQ(header.type, read_header.type);
+  EXPECT_EQ(header.name, read_header.name);
+  EXPECT_EQ(12.5, read_header.range_max);
+  ASSERT_EQ(3u, read_header.parameters.size());
+  EXPECT_EQ(0.25, read_header.parameters[0].as_double());
+  EXPECT_EQ(100, read_header.parameters[1].as_int());
+  EXPECT_EQ("p2d", read_header.parameters[2].as_string());
+
+  std::vector<ndt_2d::CaptureRecord::Type> types;
+  ndt_2d::CaptureRecord record;
+  while (reader.read(record))
+  {
+    types.push_back(record.type);
+    if (record.type == ndt_2d::CaptureRecord::SCAN)
+    {
+      ASSERT_EQ(2u, record.points.size());
+      EXPECT_EQ(3.0, record.points[1].x);
+      EXPECT_EQ(4.0, record.points[1].y);
+    }
+    else if (record.type == ndt_2d::CaptureRecord::ADD_SCANS)
+    {
+      ASSERT_EQ(2u, record.scans.size());
+      EXPECT_EQ(1u, record.scans[1].key);
+      EXPECT_EQ(1u, record.scans[1].id);
+      EXPECT_EQ(1.0, record.scans[1].pose.x);
+      EXPECT_EQ(0.1, record.scans[1].pose.theta);
+    }
+    else if (record.type == ndt_2d::CaptureRecord::MATCH)
+    {
+      EXPECT_EQ(2u, record.id);
+      EXPECT_EQ(0.5, record.pose.y);
+      ASSERT_EQ(2u, record.points.size());
+      EXPECT_EQ(3.0, record.points[1].x);
+      EXPECT_EQ(-0.75, record.score);
+      EXPECT_EQ(-0.02, record.correction.y);
+      EXPECT_EQ(0.5, record.covariance(0, 1));
+      EXPECT_EQ(12345u, record.duration_ns);
+    }
+  }
+
+  std::vector<ndt_2d::CaptureRecord::Type> expected =
+  {
+    ndt_2d::CaptureRecord::SCAN,
+    ndt_2d::CaptureRecord::SCAN,
+    ndt_2d::CaptureRecord::ADD_SCANS,
+    ndt_2d::CaptureRecord::RESET,
+    ndt_2d::CaptureRecord::ADD_SCANS,
+    ndt_2d::CaptureRecord::MATCH
+  };
+  EXPECT_EQ(expected, types);
+
+  std::remove(FILENAME.c_str());
+}
+
+TEST(CaptureTests, reused_id_test)
+{
+  const std::string FILENAME = "test_capture_reused_id.ndtcap";
+
+  ndt_2d::CaptureHeader header;
+  header.type = "ndt_2d::ScanMatcherNDT";
+  header.name = "global_scan_matcher";
+  header.range_max = 12.5;
+
+  // Scans with the same id but different points, as happens with queries
+  // while localizing, and with map scans after a map is reloaded
+  std::vector<ndt_2d::ScanPtr> scans;
+  for (size_t i = 0; i < 2; ++i)
+  {
+    std::vector<ndt_2d::Point> points(i + 1, ndt_2d::Point(i, 1.0));
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(7);
+    scan->setPoints(points);
+    scans.push_back(scan);
+  }
+
+  {
+    ndt_2d::CaptureWriter writer;
+    ASSERT_TRUE(writer.open(FILENAME, header));
+    Eigen::Matrix3d covariance = Eigen::Matrix3d::Identity();
+    writer.writeMatch(scans[0], -1.0, ndt_2d::Pose2d(), covariance, 1);
+    writer.writeMatch(scans[1], -1.0, ndt_2d::Pose2d(), covariance, 1);
+    writer.writeAddScans(scans.begin(), scans.begin() + 1);
+    writer.writeReset();
+    writer.writeAddScans(scans.begin() + 1, scans.end());
+  }
+
+  ndt_2d::CaptureHeader read_header;
+  ndt_2d::CaptureReader reader;
+  ASSERT_TRUE(reader.open(FILENAME, read_header));
+
+  std::vector<std::vector<ndt_2d::Point>> match_points;
+  std::vector<size_t> scan_keys, added_keys;
+  ndt_2d::CaptureRecord record;
+  while (reader.read(record))
+  {
+    if (record.type == ndt_2d::CaptureRecord::MATCH)
+    {
+      EXPECT_EQ(7u, record.id);
+      match_points.push_back(record.points);
+    }
+    else if (record.type == ndt_2d::CaptureRecord::SCAN)
+    {
+      scan_keys.push_back(record.key);
+    }
+    else if (record.type == ndt_2d::CaptureRecord::ADD_SCANS)
+    {
+      ASSERT_EQ(1u, record.scans.size());
+      EXPECT_EQ(7u, record.scans[0].id);
+      added_keys.push_back(record.scans[0].key);
+    }
+  }
+
+  // Each query keeps its own points
+  ASSERT_EQ(2u, match_points.size());
+  ASSERT_EQ(1u, match_points[0].size());
+  EXPECT_EQ(0.0, match_points[0][0].x);
+  ASSERT_EQ(2u, match_points[1].size());
+  EXPECT_EQ(1.0, match_points[1][0].x);
+
+  // Each added scan is written under its own key
+  ASSERT_EQ(2u, scan_keys.size());
+  EXPECT_NE(scan_keys[0], scan_keys[1]);
+  EXPECT_EQ(scan_keys, added_keys);
+
+  std::remove(FILENAME.c_str());
+}
+
+TEST(CaptureTests, expired_scans_test)
+{
+  const std::string FILENAME = "test_capture_expired_scans.ndtcap";
+
+  ndt_2d::CaptureHeader header;
+  header.type = "ndt_2d::ScanMatcherNDT";
+  header.name = "local_scan_matcher";
+  header.range_max = 12.5;
+
+  ndt_2d::CaptureWriter writer;
+  ASSERT_TRUE(writer.open(FILENAME, header));
+
+  // Scans that are still alive keep their key while expired ones are erased
+  ndt_2d::ScanPtr kept = std::make_shared<ndt_2d::Scan>(0);
+  kept->setPoints(std::vector<ndt_2d::Point>(1, ndt_2d::Point(1.0, 1.0)));
+  uint64_t kept_key = writer.writeScan(kept);
+  for (size_t i = 1; i < 1000; ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    EXPECT_EQ(i, writer.writeScan(scan));
+    EXPECT_EQ(kept_key, writer.writeScan(kept));
+  }
+
+  std::remove(FILENAME.c_str());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <ndt_2d/compressed_map.hpp>
+
+// Scans of a room, with noise, like those of a real map
+static std::vector<ndt_2d::ScanPtr> makeScans(size_t num_scans)
+{
+  std::vector<ndt_2d::ScanPtr> scans;
+  for (size_t i = 0; i < num_scans; ++i)
+  {
+    std::vector<ndt_2d::Point> points;
+    for (size_t j = 0; j < 720; ++j)
+    {
+      double angle = j * 2.0 * M_PI / 720;
+      double noise = 0.01 * std::sin(j * 12.9898 + i * 78.233);
+      double range = 5.0 / std::max(std::abs(std::cos(angle)), std::abs(std::sin(angle))) + noise;
+      points.emplace_back(range * std::cos(angle), range * std::sin(angle));
+    }
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    scan->setPose(ndt_2d::Pose2d(0.1 * i, -0.05 * i, 0.01 * i));
+    scan->setPoints(points);
+    scans.push_back(scan);
+  }
+  return scans;
+}
+
+TEST(CompressedMapTests, read_write_test)
+{
+  const std::string FILENAME = "test_compressed_map.ndtz";
+  EXPECT_TRUE(ndt_2d::CompressedMap::isCompressedMap(FILENAME));
+  EXPECT_FALSE(ndt_2d::CompressedMap::isCompressedMap("test_graph"));
+
+  // Enough scans for several chunks
+  std::vector<ndt_2d::ScanPtr> scans = makeScans(3 * ndt_2d::CompressedMap::CHUNK_SCANS + 10);
+  std::vector<ndt_2d::ConstraintPtr> constraints;
+  for (size_t i = 1; i < scans.size(); ++i)
+  {
+    Eigen::Matrix3d covariance = Eigen::Matrix3d::Identity() * (0.1 + 0.001 * i);
+    constraints.push_back(ndt_2d::makeConstraint(scans[i - 1], scans[i], covariance));
+    constraints.back()->switchable = (i % 3 == 0);
+  }
+
+  ASSERT_TRUE(ndt_2d::CompressedMap::write(FILENAME, scans, constraints));
+
+  // Order of magnitude smaller than storing points as doubles
+  size_t num_points = 0;
+  for (auto & scan : scans)
+  {
+    num_points += scan->getPoints().size();
+  }
+  std::ifstream file(FILENAME, std::ios::binary | std::ios::ate);
+  size_t file_size = file.tellg();
+  EXPECT_LT(file_size, num_points * 2 * sizeof(double) / 10);
+
+  std::vector<ndt_2d::ScanPtr> loaded_scans;
+  std::vector<ndt_2d::ConstraintPtr> loaded_constraints;
+  ASSERT_TRUE(ndt_2d::CompressedMap::read(FILENAME, loaded_scans, loaded_constraints));
+  ASSERT_EQ(scans.size(), loaded_scans.size());
+  ASSERT_EQ(constraints.size(), loaded_constraints.size());
+
+  for (size_t i = 0; i < scans.size(); ++i)
+  {
+    EXPECT_EQ(scans[i]->getId(), loaded_scans[i]->getId());
+    EXPECT_EQ(scans[i]->getPose().x, loaded_scans[i]->getPose().x);
+    EXPECT_EQ(scans[i]->getPose().y, loaded_scans[i]->getPose().y);
+    EXPECT_EQ(scans[i]->getPose().theta, loaded_scans[i]->getPose().theta);
+
+    std::vector<ndt_2d::Point> points = scans[i]->getPoints();
+    std::vector<ndt_2d::Point> loaded_points = loaded_scans[i]->getPoints();
+    ASSERT_EQ(points.size(), loaded_points.size());
+    for (size_t j = 0; j < points.size(); ++j)
+    {
+      EXPECT_NEAR(points[j].x, loaded_points[j].x,
+                  ndt_2d::CompressedMap::POINT_RESOLUTION / 2 + 1e-9);
+      EXPECT_NEAR(points[j].y, loaded_points[j].y,
+                  ndt_2d::CompressedMap::POINT_RESOLUTION / 2 + 1e-9);
+    }
+  }
+
+  // Constraints are not quantized
+  for (size_t i = 0; i < constraints.size(); ++i)
+  {
+    EXPECT_EQ(constraints[i]->begin, loaded_constraints[i]->begin);
+    EXPECT_EQ(constraints[i]->end, loaded_constraints[i]->end);
+    EXPECT_EQ(constraints[i]->transform, loaded_constraints[i]->transform);
+    EXPECT_EQ(constraints[i]->information, loaded_constraints[i]->information);
+    EXPECT_EQ(constraints[i]->switchable, loaded_constraints[i]->switchable);
+  }
+
+  // Decoding on a single thread gives the same result
+  std::vector<ndt_2d::ScanPtr> serial_scans;
+  std::vector<ndt_2d::ConstraintPtr> serial_constraints;
+  ASSERT_TRUE(ndt_2d::CompressedMap::read(FILENAME, serial_scans, serial_constraints, 1));
+  ASSERT_EQ(loaded_scans.size(), serial_scans.size());
+  ASSERT_EQ(loaded_constraints.size(), serial_constraints.size());
+  for (size_t i = 0; i < serial_scans.size(); ++i)
+  {
+    EXPECT_EQ(loaded_scans[i]->getId(), serial_scans[i]->getId());
+    EXPECT_EQ(loaded_scans[i]->getPoints().back().x, serial_scans[i]->getPoints().back().x);
+  }
+
+  std::remove(FILENAME.c_str());
+}
+
+TEST(CompressedMapTests, invalid_file_test)
+{
+  const std::string FILENAME = "test_compressed_map_invalid.ndtz";
+  std::vector<ndt_2d::ScanPtr> scans;
+  std::vector<ndt_2d::ConstraintPtr> constraints;
+
+  EXPECT_FALSE(ndt_2d::CompressedMap::read(FILENAME, scans, constraints));
+
+  {
+    std::ofstream file(FILENAME, std::ios::binary);
+    file << "not a compressed map";
+  }
+  EXPECT_FALSE(ndt_2d::CompressedMap::read(FILENAME, scans, constraints));
+
+  // No file is left behind if it can not be written
+  EXPECT_FALSE(ndt_2d::CompressedMap::write("no_such_directory/" + FILENAME, makeScans(10), {}));
+
+  ASSERT_TRUE(ndt_2d::CompressedMap::write(FILENAME, makeScans(10), {}));
+  EXPECT_FALSE(std::ifstream(FILENAME + ".tmp").is_open());
+  std::string data;
+  {
+    std::ifstream in(FILENAME, std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  // Truncated file is rejected
+  {
+    std::ofstream out(FILENAME, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size() / 2);
+  }
+  scans.clear();
+  EXPECT_FALSE(ndt_2d::CompressedMap::read(FILENAME, scans, constraints));
+
+  // Corrupted chunk is rejected
+  {
+    std::string corrupt = data;
+    for (size_t i = corrupt.size() / 2; i < corrupt.size() / 2 + 16; ++i)
+    {
+      corrupt[i] = ~corrupt[i];
+    }
+    std::ofstream out(FILENAME, std::ios::binary | std::ios::trunc);
+    out.write(corrupt.data(), corrupt.size());
+  }
+  scans.clear();
+  EXPECT_FALSE(ndt_2d::CompressedMap::read(FILENAME, scans, constraints));
+
+  std::remove(FILENAME.c_str());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -28,6 +28,7 @@
 
 #include <gtest/gtest.h>
 #include <ndt_2d/graph.hpp>
+#include <ndt_2d/shared_map.hpp>
 #include <rcpputils/filesystem_helper.hpp>
 
 TEST(GraphTests, read_write_test)
@@ -126,6 +127,10 @@ TEST(GraphTests, read_write_test)
   EXPECT_EQ(3, new_graph.scans[1]->getPoints().size());
   EXPECT_EQ(1, new_graph.constraints.size());
 
+  // Memory usage includes scans and constraints
+  size_t scan_bytes = new_graph.scans[0]->memoryUsage() + new_graph.scans[1]->memoryUsage();
+  EXPECT_LT(scan_bytes + sizeof(ndt_2d::Constraint), new_graph.memoryUsage());
+
   // Verify constraint save/load
   EXPECT_EQ(0, new_graph.constraints[0]->begin);
   EXPECT_EQ(1, new_graph.constraints[0]->end);
@@ -138,6 +143,182 @@ TEST(GraphTests, read_write_test)
   EXPECT_EQ(true, new_graph.constraints[0]->switchable);
 }
 
+TEST(GraphTests, compressed_read_write_test)
+{
+  const std::string MAP_NAME = "test_graph.ndtz";
+
+  ndt_2d::Graph graph(true);
+  for (size_t i = 0; i < 2; ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    std::vector<ndt_2d::Point> points(3);
+    points[0].x = 2.0;
+    points[0].y = 3.0;
+    points[1].x = 3.0;
+    points[1].y = 3.0;
+    points[2].x = 4.0 + i;
+    points[2].y = 4.0;
+    scan->setPoints(points);
+    scan->setPose(ndt_2d::Pose2d(i, 1.0, 0.05 * i));
+    graph.scans.push_back(scan);
+  }
+  ndt_2d::ConstraintPtr constraint = std::make_shared<ndt_2d::Constraint>();
+  constraint->begin = 0;
+  constraint->end = 1;
+  constraint->transform(0) = 1.0;
+  constraint->information = Eigen::Matrix3d::Identity() * 100.0;
+  constraint->switchable = true;
+  graph.constraints.push_back(constraint);
+  EXPECT_TRUE(graph.save(MAP_NAME));
+
+  ndt_2d::Graph new_graph(true, MAP_NAME);
+  ASSERT_EQ(2, new_graph.scans.size());
+  ASSERT_EQ(3, new_graph.scans[1]->getPoints().size());
+  EXPECT_EQ(5.0, new_graph.scans[1]->getPoints()[2].x);
+  EXPECT_EQ(1.0, new_graph.scans[1]->getPose().x);
+  EXPECT_EQ(0.05, new_graph.scans[1]->getPose().theta);
+  ASSERT_EQ(1, new_graph.constraints.size());
+  EXPECT_EQ(1, new_graph.constraints[0]->end);
+  EXPECT_EQ(100.0, new_graph.constraints[0]->information(2, 2));
+  EXPECT_EQ(true, new_graph.constraints[0]->switchable);
+
+  rcpputils::fs::remove(MAP_NAME);
+  EXPECT_THROW(ndt_2d::Graph(true, MAP_NAME), std::runtime_error);
+}
+
+TEST(GraphTests, shared_map_test)
+{
+  const std::string MAP_NAME = "test_graph.ndtshm";
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  for (size_t i = 0; i < 2; ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i + 10);
+    std::vector<ndt_2d::Point> points(3);
+    points[0].x = 2.0;
+    points[0].y = 3.0;
+    points[1].x = 3.0;
+    points[1].y = 3.0;
+    points[2].x = 4.0 + i;
+    points[2].y = 4.0;
+    scan->setPoints(points);
+    scan->setPose(ndt_2d::Pose2d(i, 1.0, 0.05 * i));
+    scans.push_back(scan);
+  }
+  ndt_2d::ConstraintPtr constraint = std::make_shared<ndt_2d::Constraint>();
+  constraint->begin = 0;
+  constraint->end = 1;
+  constraint->transform = Eigen::Vector3d(1.0, 0.0, 0.05);
+  constraint->information = Eigen::Matrix3d::Identity() * 100.0;
+  constraint->switchable = true;
+  ASSERT_TRUE(ndt_2d::SharedMap::write(MAP_NAME, scans, {constraint}, nullptr));
+
+  // Graph holds copies, so the map can be closed and removed
+  std::shared_ptr<ndt_2d::Graph> graph;
+  {
+    ndt_2d::SharedMapPtr map = ndt_2d::SharedMap::open(MAP_NAME);
+    ASSERT_TRUE(map);
+    graph = std::make_shared<ndt_2d::Graph>(true, *map);
+  }
+  rcpputils::fs::remove(MAP_NAME);
+
+  ASSERT_EQ(2, graph->scans.size());
+  EXPECT_EQ(11, graph->scans[1]->getId());
+  ASSERT_EQ(3, graph->scans[1]->getPoints().size());
+  EXPECT_EQ(5.0, graph->scans[1]->getPoints()[2].x);
+  EXPECT_EQ(1.0, graph->scans[1]->getPose().x);
+  EXPECT_EQ(0.05, graph->scans[1]->getPose().theta);
+  ASSERT_EQ(1, graph->constraints.size());
+  EXPECT_EQ(1, graph->constraints[0]->end);
+  EXPECT_EQ(0.05, graph->constraints[0]->transform(2));
+  EXPECT_EQ(100.0, graph->constraints[0]->information(2, 2));
+  EXPECT_EQ(true, graph->constraints[0]->switchable);
+}
+
+TEST(GraphTests, msg_test)
+{
+  ndt_2d::Graph graph(true);
+  for (size_t i = 0; i < 3; ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    scan->setPose(ndt_2d::Pose2d(i, 2.0 * i, 0.0));
+    graph.scans.push_back(scan);
+  }
+  Eigen::Matrix3d covariance = Eigen::Matrix3d::Identity();
+  graph.constraints.push_back(ndt_2d::makeConstraint(graph.scans[0], graph.scans[1], covariance));
+  graph.constraints.push_back(ndt_2d::makeConstraint(graph.scans[1], graph.scans[2], covariance));
+  graph.constraints.push_back(ndt_2d::makeConstraint(graph.scans[0], graph.scans[2], covariance));
+  graph.constraints.back()->switchable = true;
+
+  // One marker for nodes, one per type of edge
+  visualization_msgs::msg::MarkerArray msg;
+  rclcpp::Time t;
+  EXPECT_TRUE(graph.getMsg(msg, t));
+  ASSERT_EQ(3, msg.markers.size());
+  EXPECT_EQ(visualization_msgs::msg::Marker::SPHERE_LIST, msg.markers[0].type);
+  ASSERT_EQ(3, msg.markers[0].points.size());
+  EXPECT_EQ(2.0, msg.markers[0].points[2].x);
+  EXPECT_EQ(4.0, msg.markers[0].points[2].y);
+  EXPECT_EQ(visualization_msgs::msg::Marker::LINE_LIST, msg.markers[1].type);
+  ASSERT_EQ(4, msg.markers[1].points.size());
+  EXPECT_EQ(1.0, msg.markers[1].points[2].x);
+  ASSERT_EQ(2, msg.markers[2].points.size());
+  EXPECT_EQ(2.0, msg.markers[2].points[1].x);
+
+  // Nothing changed
+  EXPECT_FALSE(graph.getMsg(msg, t));
+
+  // Moved nodes update their edges
+  graph.scans[1]->setPose(ndt_2d::Pose2d(1.5, 2.0, 0.0));
+  EXPECT_TRUE(graph.getMsg(msg, t));
+  EXPECT_EQ(1.5, msg.markers[0].points[1].x);
+  EXPECT_EQ(1.5, msg.markers[1].points[1].x);
+  EXPECT_EQ(1.5, msg.markers[1].points[2].x);
+  EXPECT_FALSE(graph.getMsg(msg, t));
+
+  // New nodes
+  graph.scans.push_back(std::make_shared<ndt_2d::Scan>(3));
+  EXPECT_TRUE(graph.getMsg(msg, t));
+  EXPECT_EQ(4, msg.markers[0].points.size());
+  EXPECT_FALSE(graph.getMsg(msg, t));
+
+  // New edges
+  graph.constraints.push_back(ndt_2d::makeConstraint(graph.scans[2], graph.scans[3], covariance));
+  EXPECT_TRUE(graph.getMsg(msg, t));
+  ASSERT_EQ(3, msg.markers.size());
+  ASSERT_EQ(6, msg.markers[1].points.size());
+  EXPECT_EQ(0.0, msg.markers[1].points[5].x);
+  EXPECT_EQ(2, msg.markers[2].points.size());
+  EXPECT_FALSE(graph.getMsg(msg, t));
+}
+
+TEST(GraphTests, travel_limit_test)
+{
+  // Straight line, 0.1 meters between scans
+  ndt_2d::Graph graph(true);
+  EXPECT_EQ(0u, graph.findTravelLimit(0, 1.0));
+  for (size_t i = 0; i < 100; ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    scan->setPose(ndt_2d::Pose2d(0.1 * i, 0.0, 0.0));
+    graph.scans.push_back(scan);
+  }
+
+  EXPECT_EQ(49u, graph.findTravelLimit(99, 4.95));
+  EXPECT_EQ(99u, graph.findTravelLimit(99, 0.0));
+  // Not far enough along the trajectory
+  EXPECT_EQ(0u, graph.findTravelLimit(20, 5.0));
+
+  // Revisiting a place does not bring it closer along the trajectory
+  for (size_t i = 0; i < 100; ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(100 + i);
+    scan->setPose(ndt_2d::Pose2d(9.9 - 0.1 * i, 0.0, 0.0));
+    graph.scans.push_back(scan);
+  }
+  EXPECT_EQ(149u, graph.findTravelLimit(199, 4.95));
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include <ndt_2d/likelihood_field.hpp>
+#include <ndt_2d/motion_model.hpp>
+#include <ndt_2d/particle_filter.hpp>
+
+TEST(LikelihoodFieldTests, test_likelihood)
+{
+  // A wall along y = 1
+  std::vector<ndt_2d::Point> points;
+  for (double x = -2.0; x < 2.0; x += 0.01)
+  {
+    points.emplace_back(x, 1.0);
+  }
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(std::make_shared<ndt_2d::Scan>(0));
+  scans[0]->setPoints(points);
+
+  ndt_2d::LikelihoodField field(0.05, 0.1, 0.0);
+  EXPECT_DOUBLE_EQ(0.0, field.likelihood(Eigen::Vector2d(0.0, 1.0)));
+
+  field.build(scans.begin(), scans.end());
+
+  // Gaussian of distance to the wall, quantized to cells
+  EXPECT_NEAR(1.0, field.likelihood(Eigen::Vector2d(0.0, 1.01)), 0.01);
+  EXPECT_NEAR(std::exp(-0.5), field.likelihood(Eigen::Vector2d(0.0, 1.11)), 0.01);
+  EXPECT_NEAR(std::exp(-2.0), field.likelihood(Eigen::Vector2d(0.0, 0.81)), 0.01);
+  EXPECT_NEAR(0.0, field.likelihood(Eigen::Vector2d(0.0, 0.61)), 0.01);
+
+  // Outside the field
+  EXPECT_DOUBLE_EQ(0.0, field.likelihood(Eigen::Vector2d(10.0, 1.0)));
+  EXPECT_DOUBLE_EQ(0.0, field.likelihood(Eigen::Vector2d(0.0, -10.0)));
+
+  // Scan of the wall from the origin, subsampled to 50 points
+  EXPECT_NEAR(1.0, field.score(points, ndt_2d::Pose2d(), 50), 0.01);
+  EXPECT_NEAR(std::exp(-0.5), field.score(points, ndt_2d::Pose2d(0.0, 0.1, 0.0), 50), 0.05);
+
+  // One byte per cell
+  EXPECT_LT(field.memoryUsage(), sizeof(ndt_2d::LikelihoodField) + 100 * 20);
+
+  // Beams that miss the map entirely still score z_rand
+  ndt_2d::LikelihoodField floored(0.05, 0.1, 0.05);
+  floored.build(scans.begin(), scans.end());
+  EXPECT_DOUBLE_EQ(0.05, floored.score(points, ndt_2d::Pose2d(0.0, -10.0, 0.0), 50));
+  EXPECT_NEAR(0.95 + 0.05, floored.score(points, ndt_2d::Pose2d(), 50), 0.01);
+}
+
+TEST(LikelihoodFieldTests, test_particle_filter_measure)
+{
+  // Corner, so that x and y are both constrained
+  std::vector<ndt_2d::Point> points;
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(2.0, t);
+    points.emplace_back(t, 2.0);
+  }
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(std::make_shared<ndt_2d::Scan>(0));
+  scans[0]->setPoints(points);
+
+  // No floor, so the weighting is as sharp as the field allows
+  ndt_2d::LikelihoodField field(0.05, 0.1, 0.0);
+  field.build(scans.begin(), scans.end());
+
+  ndt_2d::MotionModelPtr model =
+    std::make_shared<ndt_2d::MotionModel>(0.1, 0.1, 0.1, 0.1, 0.0);
+  ndt_2d::ParticleFilter filter(500, 500, model);
+  filter.init(0.1, -0.1, 0.0, 0.1, 0.1, 0.02);
+
+  // Weighting moves the mean towards the true pose at the origin
+  ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(1);
+  scan->setPoints(points);
+  filter.measure(field, scan, 100);
+  Eigen::Vector3d mean = filter.getMean();
+  EXPECT_LT(std::hypot(mean(0), mean(1)), std::hypot(0.1, 0.1) - 0.03);
+}
+
+TEST(LikelihoodFieldTests, test_particle_filter_kidnapped)
+{
+  std::vector<ndt_2d::Point> points;
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(2.0, t);
+  }
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(std::make_shared<ndt_2d::Scan>(0));
+  scans[0]->setPoints(points);
+
+  // Without a floor every beam of every particle misses the field
+  ndt_2d::LikelihoodField field(0.05, 0.1, 0.0);
+  field.build(scans.begin(), scans.end());
+
+  ndt_2d::MotionModelPtr model =
+    std::make_shared<ndt_2d::MotionModel>(0.1, 0.1, 0.1, 0.1, 0.0);
+  ndt_2d::ParticleFilter filter(100, 100, model);
+  filter.init(50.0, 50.0, 0.0, 0.1, 0.1, 0.02);
+
+  ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(1);
+  scan->setPoints(points);
+  filter.measure(field, scan, 100);
+
+  // Weights fall back to uniform rather than NaN
+  Eigen::Vector3d mean = filter.getMean();
+  EXPECT_TRUE(std::isfinite(mean(0)));
+  EXPECT_TRUE(std::isfinite(mean(1)));
+  EXPECT_NEAR(50.0, mean(0), 0.1);
+  EXPECT_NEAR(50.0, mean(1), 0.1);
+  Eigen::Matrix3d cov = filter.getCovariance();
+  EXPECT_TRUE(cov.allFinite());
+}
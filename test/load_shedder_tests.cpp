@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ndt_2d/load_shedder.hpp>
+#include <gtest/gtest.h>
+
+TEST(LoadShedderTests, test_escalation_and_recovery)
+{
+  ndt_2d::LoadShedder shedder(0.5, 3);
+  EXPECT_EQ(ndt_2d::LoadShedder::NOMINAL, shedder.update(0.1));
+  EXPECT_EQ(0u, shedder.takeDegradedScans());
+
+  // Growing lag raises one level per scan, up to odometry only
+  EXPECT_EQ(ndt_2d::LoadShedder::SKIP_LOOP_CLOSURE, shedder.update(0.6));
+  EXPECT_EQ(ndt_2d::LoadShedder::REDUCED_BEAMS, shedder.update(0.7));
+  EXPECT_EQ(ndt_2d::LoadShedder::ODOMETRY_ONLY, shedder.update(0.8));
+  EXPECT_EQ(ndt_2d::LoadShedder::ODOMETRY_ONLY, shedder.update(0.9));
+
+  // Lag that is high but falling holds the level
+  EXPECT_EQ(ndt_2d::LoadShedder::ODOMETRY_ONLY, shedder.update(0.6));
+  // As does lag between the thresholds, even for many scans
+  for (size_t i = 0; i < 10; ++i)
+  {
+    EXPECT_EQ(ndt_2d::LoadShedder::ODOMETRY_ONLY, shedder.update(0.3));
+  }
+  EXPECT_EQ(ndt_2d::LoadShedder::ODOMETRY_ONLY, shedder.level());
+
+  // Recovery is one level per recovery_scans low lag scans
+  EXPECT_EQ(ndt_2d::LoadShedder::ODOMETRY_ONLY, shedder.update(0.1));
+  EXPECT_EQ(ndt_2d::LoadShedder::ODOMETRY_ONLY, shedder.update(0.1));
+  EXPECT_EQ(ndt_2d::LoadShedder::REDUCED_BEAMS, shedder.update(0.1));
+  for (size_t i = 0; i < 6; ++i)
+  {
+    shedder.update(0.1);
+  }
+  EXPECT_EQ(ndt_2d::LoadShedder::NOMINAL, shedder.level());
+
+  // Count of degraded scans resets when taken
+  EXPECT_EQ(23u, shedder.takeDegradedScans());
+  EXPECT_EQ(0u, shedder.takeDegradedScans());
+
+  // After recovering, a new overload escalates again
+  EXPECT_EQ(ndt_2d::LoadShedder::SKIP_LOOP_CLOSURE, shedder.update(0.6));
+}
+
+TEST(LoadShedderTests, test_disabled)
+{
+  ndt_2d::LoadShedder shedder(0.0, 3);
+  EXPECT_EQ(ndt_2d::LoadShedder::NOMINAL, shedder.update(10.0));
+  EXPECT_EQ(ndt_2d::LoadShedder::NOMINAL, shedder.level());
+  EXPECT_EQ(0u, shedder.takeDegradedScans());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
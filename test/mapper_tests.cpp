@@ -0,0 +1,264 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <geometry_msgs/msg/pose_array.hpp>
+#include <geometry_msgs/msg/pose_with_covariance_stamped.hpp>
+#include <geometry_msgs/msg/transform_stamped.hpp>
+#include <ndt_2d/graph.hpp>
+#include <ndt_2d/ndt_mapper.hpp>
+#include <ndt_2d/srv/configure.hpp>
+#include <rcpputils/filesystem_helper.hpp>
+#include <sensor_msgs/msg/laser_scan.hpp>
+#include <tf2_ros/static_transform_broadcaster.h>
+
+using namespace std::chrono_literals;
+
+TEST(MapperTests, test_configure_does_not_delay_scans)
+{
+  // A large map, so that loading it takes a while
+  const std::string MAP_NAME = "test_mapper_map";
+  rcpputils::fs::remove_all(MAP_NAME);
+  {
+    ndt_2d::Graph graph(true);
+    for (size_t i = 0; i < 2000; ++i)
+    {
+      ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+      std::vector<ndt_2d::Point> points;
+      for (size_t j = 0; j < 1000; ++j)
+      {
+        double angle = j * 2.0 * M_PI / 1000;
+        points.emplace_back(5.0 * cos(angle), 5.0 * sin(angle));
+      }
+      scan->setPoints(points);
+      scan->setPose(ndt_2d::Pose2d(0.1 * i, 0.0, 0.0));
+      graph.scans.push_back(scan);
+    }
+    ASSERT_TRUE(graph.save(MAP_NAME));
+  }
+
+  // Localization mode, the initial pose and scan callbacks publish the
+  // particles, every scan is processed
+  rclcpp::NodeOptions options;
+  options.parameter_overrides(
+  {
+    {"use_particle_filter", true},
+    {"enable_mapping", false},
+    {"enable_relocalization", false},
+    {"memory_publish_period", 0.0},
+    {"minimum_travel_distance", 0.0},
+    {"minimum_travel_rotation", 0.0}
+  });
+  auto mapper = std::make_shared<ndt_2d::Mapper>(options);
+  auto node = std::make_shared<rclcpp::Node>("mapper_tests");
+
+  // At least two threads, even on a single core machine
+  rclcpp::executors::MultiThreadedExecutor executor(rclcpp::ExecutorOptions(), 2);
+  executor.add_node(mapper);
+  executor.add_node(node);
+  std::thread spin_thread([&executor]() { executor.spin(); });
+
+  // Mapper threads run until shutdown, so always shut down before returning
+  struct Shutdown
+  {
+    ~Shutdown()
+    {
+      executor.cancel();
+      spin_thread.join();
+      rclcpp::shutdown();
+    }
+    rclcpp::Executor & executor;
+    std::thread & spin_thread;
+  } shutdown{executor, spin_thread};
+
+  // Initial pose callback needs the odom -> base_link transform, scans
+  // also need base_link -> laser
+  tf2_ros::StaticTransformBroadcaster broadcaster(node);
+  std::vector<geometry_msgs::msg::TransformStamped> transforms(2);
+  transforms[0].header.stamp = node->now();
+  transforms[0].header.frame_id = "odom";
+  transforms[0].child_frame_id = "base_link";
+  transforms[0].transform.rotation.w = 1.0;
+  transforms[1].header.stamp = node->now();
+  transforms[1].header.frame_id = "base_link";
+  transforms[1].child_frame_id = "laser";
+  transforms[1].transform.rotation.w = 1.0;
+  broadcaster.sendTransform(transforms);
+
+  std::atomic<size_t> clouds(0);
+  auto sub = node->create_subscription<geometry_msgs::msg::PoseArray>(
+    "particlecloud", 10,
+    [&clouds](const geometry_msgs::msg::PoseArray::ConstSharedPtr) { ++clouds; });
+  auto pub = node->create_publisher<geometry_msgs::msg::PoseWithCovarianceStamped>(
+    "initialpose", 10);
+  auto scan_pub = node->create_publisher<sensor_msgs::msg::LaserScan>("scan", 10);
+  auto client = node->create_client<ndt_2d::srv::Configure>("configure");
+  ASSERT_TRUE(client->wait_for_service(10s));
+  auto start = std::chrono::steady_clock::now();
+  while ((pub->get_subscription_count() == 0 || scan_pub->get_subscription_count() == 0 ||
+          sub->get_publisher_count() == 0) &&
+         std::chrono::steady_clock::now() - start < 10s)
+  {
+    std::this_thread::sleep_for(10ms);
+  }
+
+  geometry_msgs::msg::PoseWithCovarianceStamped pose;
+  pose.header.frame_id = "map";
+  pose.pose.pose.orientation.w = 1.0;
+  pose.pose.covariance[0] = 0.01;
+  pose.pose.covariance[7] = 0.01;
+  pose.pose.covariance[35] = 0.01;
+
+  // Publish an initial pose, return how long until the particles are published
+  auto handle_pose = [&]()
+  {
+    size_t prev_clouds = clouds.load();
+    auto sent = std::chrono::steady_clock::now();
+    pose.header.stamp = node->now();
+    pub->publish(pose);
+    while (clouds.load() == prev_clouds && std::chrono::steady_clock::now() - sent < 10s)
+    {
+      std::this_thread::sleep_for(1ms);
+    }
+    EXPECT_GT(clouds.load(), prev_clouds);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - sent).count();
+  };
+
+  // A circle around the robot, like the scans of the map
+  sensor_msgs::msg::LaserScan scan;
+  scan.header.frame_id = "laser";
+  scan.angle_min = -M_PI;
+  scan.angle_increment = 2.0 * M_PI / 360;
+  scan.angle_max = scan.angle_min + 359 * scan.angle_increment;
+  scan.range_min = 0.1;
+  scan.range_max = 10.0;
+  scan.ranges.assign(360, 5.0);
+
+  // Publish a scan, return how long until the particles are published, or a
+  // negative value if they are not (scans are dropped once a load completes,
+  // until the next initial pose)
+  auto handle_scan = [&]()
+  {
+    size_t prev_clouds = clouds.load();
+    auto sent = std::chrono::steady_clock::now();
+    scan.header.stamp = node->now();
+    scan_pub->publish(scan);
+    while (clouds.load() == prev_clouds && std::chrono::steady_clock::now() - sent < 2s)
+    {
+      std::this_thread::sleep_for(1ms);
+    }
+    if (clouds.load() == prev_clouds)
+    {
+      return -1.0;
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - sent).count();
+  };
+
+  // Poses are ignored until the transform arrives, so keep sending one until
+  // the particles are published
+  size_t initial_clouds = clouds.load();
+  start = std::chrono::steady_clock::now();
+  while (clouds.load() == initial_clouds && std::chrono::steady_clock::now() - start < 10s)
+  {
+    pose.header.stamp = node->now();
+    pub->publish(pose);
+    std::this_thread::sleep_for(100ms);
+  }
+  ASSERT_GT(clouds.load(), initial_clouds);
+  // Let the particles of any other poses sent in the meantime arrive
+  std::this_thread::sleep_for(200ms);
+
+  // Latency with nothing else going on, the first scan also finds the laser
+  double idle_latency = handle_pose();
+  ASSERT_GT(handle_scan(), 0.0);
+  double idle_scan_latency = handle_scan();
+  ASSERT_GT(idle_scan_latency, 0.0);
+
+  auto request = std::make_shared<ndt_2d::srv::Configure::Request>();
+  request->action = ndt_2d::srv::Configure::Request::LOAD_FROM_FILE;
+  request->filename = MAP_NAME;
+
+  // Time to load the map with nothing else going on
+  start = std::chrono::steady_clock::now();
+  auto result = client->async_send_request(request);
+  ASSERT_EQ(std::future_status::ready, result.wait_for(60s));
+  double load_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Load again, handling poses and scans while the service call is in
+  // progress, the loaded map has to be localized in with a pose before scans
+  // are processed
+  std::vector<double> latencies, scan_latencies;
+  result = client->async_send_request(request);
+  while (result.wait_for(0s) != std::future_status::ready)
+  {
+    latencies.push_back(handle_pose());
+    double scan_latency = handle_scan();
+    if (scan_latency >= 0.0)
+    {
+      scan_latencies.push_back(scan_latency);
+    }
+  }
+  ASSERT_EQ(std::future_status::ready, result.wait_for(60s));
+
+  rcpputils::fs::remove_all(MAP_NAME);
+
+  ASSERT_GE(latencies.size(), 1u);
+  ASSERT_GE(scan_latencies.size(), 1u);
+  double max_latency = *std::max_element(latencies.begin(), latencies.end());
+  double max_scan_latency = *std::max_element(scan_latencies.begin(), scan_latencies.end());
+  std::cout << "Map load " << load_time << "s, pose latency " << idle_latency <<
+    "s idle, " << max_latency << "s max of " << latencies.size() <<
+    " while loading, scan latency " << idle_scan_latency << "s idle, " <<
+    max_scan_latency << "s max of " << scan_latencies.size() << " while loading" << std::endl;
+
+  if (load_time < 20 * std::max(idle_latency, idle_scan_latency))
+  {
+    GTEST_SKIP() << "Map loaded too quickly (" << load_time << "s) to measure";
+  }
+
+  // With a single callback group, the first pose or scan would wait for the
+  // whole load and no others would be handled until it completed
+  ASSERT_GE(latencies.size(), 3u);
+  EXPECT_LT(max_latency, 0.5 * load_time);
+  EXPECT_LT(max_scan_latency, 0.5 * load_time);
+}
+
+int main(int argc, char** argv)
+{
+  rclcpp::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  rclcpp::shutdown();
+  return result;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ndt_2d/metrics.hpp>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+TEST(MetricsTests, test_histogram)
+{
+  ndt_2d::LatencyHistogram histogram;
+  EXPECT_EQ(0u, histogram.count());
+  EXPECT_DOUBLE_EQ(0.0, histogram.quantile(0.5));
+  EXPECT_DOUBLE_EQ(0.0, histogram.max());
+
+  // 1ms through 100ms
+  for (uint64_t i = 1; i <= 100; ++i)
+  {
+    histogram.record(i * 1000000);
+  }
+  EXPECT_EQ(100u, histogram.count());
+  EXPECT_DOUBLE_EQ(0.1, histogram.max());
+
+  // Quantiles are accurate to within one bucket (25%)
+  EXPECT_NEAR(0.05, histogram.quantile(0.5), 0.05 * 0.25);
+  EXPECT_NEAR(0.095, histogram.quantile(0.95), 0.095 * 0.25);
+  EXPECT_LE(histogram.quantile(0.95), histogram.max());
+  EXPECT_LE(histogram.quantile(0.5), histogram.quantile(0.95));
+
+  histogram.reset();
+  EXPECT_EQ(0u, histogram.count());
+  EXPECT_DOUBLE_EQ(0.0, histogram.max());
+}
+
+TEST(MetricsTests, test_histogram_threads)
+{
+  ndt_2d::LatencyHistogram histogram;
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < 4; ++t)
+  {
+    threads.emplace_back([&histogram, t]()
+    {
+      for (uint64_t i = 0; i < 10000; ++i)
+      {
+        histogram.record(1000 + t);
+      }
+    });
+  }
+  for (auto & thread : threads)
+  {
+    thread.join();
+  }
+
+  EXPECT_EQ(40000u, histogram.count());
+  EXPECT_DOUBLE_EQ(1003e-9, histogram.max());
+}
+
+TEST(MetricsTests, test_scoped_timer)
+{
+  ndt_2d::LatencyHistogram histogram;
+  {
+    ndt_2d::ScopedTimer timer(histogram);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(1u, histogram.count());
+  EXPECT_GE(histogram.max(), 0.01);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -26,6 +26,8 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <cmath>
+#include <vector>
 #include <ndt_2d/ndt_model.hpp>
 #include <gtest/gtest.h>
 
@@ -227,6 +229,55 @@ TEST(NdtModelTests, test_ndt)
   // Test scoring
   double score = ndt.likelihood(points);
   EXPECT_NEAR(0.7659, score, 0.001);
+
+  // Lookup of cells
+  const ndt_2d::Cell * cell = ndt.getCell(Eigen::Vector2d(3.5, 3.5));
+  ASSERT_NE(nullptr, cell);
+  EXPECT_DOUBLE_EQ(5.0, cell->n);
+  EXPECT_EQ(nullptr, ndt.getCell(Eigen::Vector2d(20.0, 20.0)));
+
+  // Grid is padded by one cell, so 11x11 cells
+  EXPECT_EQ(121u, ndt.getNumCells());
+  EXPECT_EQ(sizeof(ndt_2d::NDT) + 121 * sizeof(ndt_2d::Cell), ndt.memoryUsage());
+  EXPECT_EQ(sizeof(ndt_2d::Scan) + 5 * sizeof(ndt_2d::Point), scan->memoryUsage());
+}
+
+TEST(NdtModelTests, test_ndt_likelihood_kernel)
+{
+  ndt_2d::NDT ndt(1.0, 10.0, 10.0, 0.0, 0.0);
+
+  // A diagonal line of points
+  std::vector<ndt_2d::Point> points;
+  for (double t = 0.05; t < 10.0; t += 0.1)
+  {
+    points.emplace_back(t, t + 0.02 * std::sin(10.0 * t));
+  }
+  ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(0);
+  scan->setPoints(points);
+  ndt.addScan(scan);
+  ndt.compute();
+
+  // Query 40 points, some outside the NDT
+  std::vector<double> x, y;
+  for (size_t i = 0; i < 40; ++i)
+  {
+    x.push_back(-1.0 + 0.3 * i);
+    y.push_back(-1.0 + 0.3 * i + 0.01);
+  }
+
+  // Shifted points scored one at a time
+  const double dx = 0.02, dy = -0.01;
+  std::vector<ndt_2d::Point> shifted;
+  for (size_t i = 0; i < x.size(); ++i)
+  {
+    shifted.emplace_back(x[i] + dx, y[i] + dy);
+  }
+  double expected = ndt.likelihood(shifted);
+  EXPECT_GT(expected, 10.0);
+
+  // Blocked kernel gives the same result, including a partial last block
+  EXPECT_NEAR(expected, ndt.likelihood(x.data(), y.data(), x.size(), dx, dy), 1e-9);
+  EXPECT_DOUBLE_EQ(0.0, ndt.likelihood(x.data(), y.data(), 0, dx, dy));
 }
 
 int main(int argc, char** argv)
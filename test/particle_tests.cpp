@@ -204,6 +204,32 @@ TEST(ParticleTests, test_particle_filter)
   EXPECT_NEAR(mean(2), 0.0, 0.3);
 }
 
+TEST(ParticleTests, test_particle_filter_reconfigure)
+{
+  ndt_2d::MotionModelPtr model =
+    std::make_shared<ndt_2d::MotionModel>(0.1, 0.1, 0.1, 0.1, 0.0);
+  ndt_2d::ParticleFilter filter(50, 100, model);
+  filter.init(0.0, 0.0, 0.0, 0.1, 0.1, 0.1);
+
+  // Raise the particle limits, resampling should respect new minimum
+  filter.setParticleLimits(150, 200);
+  filter.resample(0.99, 0.01);
+  geometry_msgs::msg::PoseArray msg;
+  filter.getMsg(msg);
+  EXPECT_GE(msg.poses.size(), 150u);
+  EXPECT_LE(msg.poses.size(), 200u);
+
+  // Swap in a noise-free model, the mean should move exactly
+  ndt_2d::MotionModelPtr exact =
+    std::make_shared<ndt_2d::MotionModel>(0.0, 0.0, 0.0, 0.0, 0.0);
+  filter.setMotionModel(exact);
+  Eigen::Vector3d before = filter.getMean();
+  filter.update(1.0, 0.0, 0.0);
+  Eigen::Vector3d after = filter.getMean();
+  EXPECT_NEAR(after(0) - before(0), 1.0, 0.05);
+  EXPECT_NEAR(after(2), before(2), 0.01);
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <angles/angles.h>
+#include <cmath>
+#include <vector>
+#include <ndt_2d/graph.hpp>
+#include <ndt_2d/scan_descriptor.hpp>
+
+// Points along the walls of an asymmetric room, as seen from pose
+std::vector<ndt_2d::Point> makePoints(const ndt_2d::Pose2d & pose)
+{
+  std::vector<ndt_2d::Point> world;
+  for (double t = 0.0; t < 8.0; t += 0.05)
+  {
+    world.emplace_back(t - 2.0, -2.0);
+    world.emplace_back(t - 2.0, 3.0);
+  }
+  for (double t = 0.0; t < 5.0; t += 0.05)
+  {
+    world.emplace_back(-2.0, t - 2.0);
+    world.emplace_back(6.0, t - 2.0);
+  }
+  for (double t = 0.0; t < 1.0; t += 0.05)
+  {
+    // A pillar
+    world.emplace_back(3.0 + t, 1.0);
+    world.emplace_back(3.0, 1.0 + t);
+  }
+
+  std::vector<ndt_2d::Point> points;
+  double costh = cos(pose.theta), sinth = sin(pose.theta);
+  for (auto & p : world)
+  {
+    double dx = p.x - pose.x, dy = p.y - pose.y;
+    points.emplace_back(costh * dx + sinth * dy, -sinth * dx + costh * dy);
+  }
+  return points;
+}
+
+TEST(ScanDescriptorTests, test_rotation_invariance)
+{
+  ndt_2d::ScanDescriptor a(makePoints(ndt_2d::Pose2d(0.0, 0.0, 0.0)), 10.0);
+  ndt_2d::ScanDescriptor b(makePoints(ndt_2d::Pose2d(0.0, 0.0, 1.0)), 10.0);
+  ndt_2d::ScanDescriptor c(makePoints(ndt_2d::Pose2d(4.5, 2.0, 0.0)), 10.0);
+
+  // Ring key does not change with rotation
+  EXPECT_LT(a.ringKeyDistance(b), 0.05);
+  EXPECT_GT(a.ringKeyDistance(c), a.ringKeyDistance(b));
+
+  // Full descriptor recovers the rotation, within one sector (4 degrees)
+  double yaw;
+  EXPECT_LT(b.distance(a, yaw), 0.2);
+  EXPECT_NEAR(1.0, yaw, 0.07);
+  EXPECT_LT(a.distance(b, yaw), 0.2);
+  EXPECT_NEAR(-1.0, yaw, 0.07);
+
+  // Different place is further away
+  EXPECT_GT(a.distance(c, yaw), b.distance(a, yaw));
+  EXPECT_GT(a.memoryUsage(), sizeof(ndt_2d::ScanDescriptor));
+}
+
+TEST(ScanDescriptorTests, test_find_similar)
+{
+  ndt_2d::Graph graph(false);
+  std::vector<ndt_2d::Pose2d> poses =
+  {
+    ndt_2d::Pose2d(0.0, 0.0, 0.0),
+    ndt_2d::Pose2d(1.5, 0.0, 0.0),
+    ndt_2d::Pose2d(3.0, -1.0, 0.0),
+    ndt_2d::Pose2d(4.5, 2.0, 0.0)
+  };
+  for (size_t i = 0; i < poses.size(); ++i)
+  {
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    scan->setPose(poses[i]);
+    scan->setPoints(makePoints(poses[i]));
+    graph.scans.push_back(scan);
+  }
+
+  // Revisit the second pose, rotated, with a badly drifted pose estimate
+  ndt_2d::ScanPtr query = std::make_shared<ndt_2d::Scan>(poses.size());
+  query->setPose(ndt_2d::Pose2d(-5.0, 5.0, 0.0));
+  query->setPoints(makePoints(ndt_2d::Pose2d(1.5, 0.0, 0.5)));
+
+  // Distance based search cannot find it
+  EXPECT_TRUE(graph.findNearest(query, 0.2).empty());
+
+  std::vector<ndt_2d::SimilarScan> similar = graph.findSimilar(query, 2);
+  ASSERT_EQ(2u, similar.size());
+  EXPECT_EQ(1u, similar[0].index);
+  EXPECT_LE(similar[0].distance, similar[1].distance);
+  EXPECT_NEAR(1.5, similar[0].pose.x, 0.2);
+  EXPECT_NEAR(0.0, similar[0].pose.y, 0.2);
+  EXPECT_NEAR(0.5, similar[0].pose.theta, 0.07);
+
+  // Threshold removes poor matches
+  similar = graph.findSimilar(query, 4, 0.0);
+  EXPECT_TRUE(similar.empty());
+
+  // Limit removes later scans
+  similar = graph.findSimilar(query, 4, 1.0, 1);
+  ASSERT_EQ(1u, similar.size());
+  EXPECT_EQ(0u, similar[0].index);
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <Eigen/Eigenvalues>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <ndt_2d/scan_matcher_icp.hpp>
+#include <ndt_2d/scan_matcher_psm.hpp>
+#include <ndt_2d/scan_matcher_ndt.hpp>
+#include <rclcpp/rclcpp.hpp>
+
+// Points along two walls of a corner
+std::vector<ndt_2d::Point> makeCorner()
+{
+  std::vector<ndt_2d::Point> points;
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(2.0, t);
+  }
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(t, 2.0);
+  }
+  return points;
+}
+
+ndt_2d::ScanPtr makeScan(size_t id, const std::vector<ndt_2d::Point> & points,
+                         const ndt_2d::Pose2d & pose)
+{
+  ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(id);
+  scan->setPoints(points);
+  scan->setPose(pose);
+  return scan;
+}
+
+TEST(ScanMatcherTests, test_ndt_novelty)
+{
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests");
+  ndt_2d::ScanMatcherNDT matcher;
+  matcher.initialize("matcher", node.get(), 5.0);
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, makeCorner(), ndt_2d::Pose2d()));
+
+  // Nothing is explained before scans are added
+  ndt_2d::ScanPtr query = makeScan(1, makeCorner(), ndt_2d::Pose2d());
+  EXPECT_DOUBLE_EQ(1.0, matcher.novelty(query));
+
+  matcher.addScans(scans.begin(), scans.end());
+
+  // Same scan at the same pose is explained
+  EXPECT_LT(matcher.novelty(query), 0.1);
+
+  // Adding a new wall makes the scan more novel
+  std::vector<ndt_2d::Point> points = makeCorner();
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(-2.0, t);
+  }
+  query->setPoints(points);
+  EXPECT_NEAR(1.0 / 3.0, matcher.novelty(query), 0.1);
+
+  // Far away, nothing is explained
+  query->setPose(ndt_2d::Pose2d(20.0, 20.0, 0.0));
+  EXPECT_DOUBLE_EQ(1.0, matcher.novelty(query));
+}
+
+TEST(ScanMatcherTests, test_ndt_score_poses)
+{
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests",
+    rclcpp::NodeOptions().parameter_overrides({rclcpp::Parameter("matcher.score_threads", 4)}));
+  ndt_2d::ScanMatcherNDT matcher;
+  matcher.initialize("matcher", node.get(), 5.0);
+
+  std::vector<ndt_2d::Point> points = makeCorner();
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, points, ndt_2d::Pose2d()));
+
+  std::vector<ndt_2d::Pose2d> poses;
+  for (size_t i = 0; i < 25; ++i)
+  {
+    poses.emplace_back(0.01 * i, -0.005 * i, 0.002 * i);
+  }
+
+  // Every score is zero before scans are added
+  std::vector<double> scores;
+  matcher.scorePoints(points, poses, scores);
+  ASSERT_EQ(poses.size(), scores.size());
+  EXPECT_DOUBLE_EQ(0.0, scores[0]);
+
+  // Batch scores are identical to scoring each pose, whichever thread runs them
+  matcher.addScans(scans.begin(), scans.end());
+  matcher.scorePoints(points, poses, scores);
+  ASSERT_EQ(poses.size(), scores.size());
+  for (size_t i = 0; i < poses.size(); ++i)
+  {
+    EXPECT_DOUBLE_EQ(matcher.scorePoints(points, poses[i]), scores[i]);
+  }
+  EXPECT_LT(scores[0], scores[24]);
+
+  // Default implementation for other scan matchers
+  ndt_2d::ScanMatcherICP icp;
+  icp.initialize("icp", node.get(), 5.0);
+  icp.addScans(scans.begin(), scans.end());
+  icp.scorePoints(points, poses, scores);
+  ASSERT_EQ(poses.size(), scores.size());
+  EXPECT_DOUBLE_EQ(icp.scorePoints(points, poses[3]), scores[3]);
+}
+
+TEST(ScanMatcherTests, test_ndt_shared_model)
+{
+  // Smaller search, so that many matches run quickly
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests",
+    rclcpp::NodeOptions().parameter_overrides({
+      rclcpp::Parameter("matcher.search_angular_size", 0.02),
+      rclcpp::Parameter("view.search_angular_size", 0.02)}));
+  auto matcher = std::make_shared<ndt_2d::ScanMatcherNDT>();
+  matcher->initialize("matcher", node.get(), 5.0);
+
+  std::vector<ndt_2d::Point> points = makeCorner();
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(-2.0, t);
+  }
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, points, ndt_2d::Pose2d()));
+
+  // No model before scans are added
+  EXPECT_EQ(nullptr, matcher->getModel());
+  matcher->addScans(scans.begin(), scans.end());
+  ndt_2d::ScanMatcherModelPtr model = matcher->getModel();
+  ASSERT_NE(nullptr, model);
+  EXPECT_GT(model->memoryUsage(), 0u);
+
+  // A view over the model, and a clone
+  auto view = std::make_shared<ndt_2d::ScanMatcherNDT>();
+  view->initialize("view", node.get(), 5.0);
+  EXPECT_FALSE(view->setModel(nullptr));
+  EXPECT_TRUE(view->setModel(model));
+  ndt_2d::ScanMatcherPtr clone = matcher->clone();
+  ASSERT_NE(nullptr, clone);
+
+  // Models of other scan matchers are not supported
+  ndt_2d::ScanMatcherICP icp;
+  icp.initialize("icp", node.get(), 5.0);
+  icp.addScans(scans.begin(), scans.end());
+  EXPECT_EQ(nullptr, icp.getModel());
+  EXPECT_FALSE(icp.setModel(model));
+  EXPECT_EQ(nullptr, icp.clone());
+
+  // Serial results for a set of queries
+  std::vector<ndt_2d::ScanPtr> queries;
+  for (size_t i = 0; i < 4; ++i)
+  {
+    queries.push_back(makeScan(i + 1, points,
+                               ndt_2d::Pose2d(0.01 * i, -0.008 * i, 0.005 * i)));
+  }
+  std::vector<double> expected_scores;
+  std::vector<ndt_2d::Pose2d> expected_corrections;
+  for (auto & query : queries)
+  {
+    ndt_2d::Pose2d correction;
+    Eigen::Matrix3d covariance;
+    expected_scores.push_back(matcher->matchScan(query, correction, covariance));
+    expected_corrections.push_back(correction);
+  }
+
+  // Concurrent matching on all instances gives identical results
+  std::vector<ndt_2d::ScanMatcherPtr> instances = {matcher, view, clone};
+  std::vector<std::thread> threads;
+  std::vector<int> mismatches(6, 0);
+  for (size_t t = 0; t < mismatches.size(); ++t)
+  {
+    threads.emplace_back([&, t]()
+    {
+      const ndt_2d::ScanMatcherPtr & instance = instances[t % instances.size()];
+      for (size_t i = 0; i < queries.size(); ++i)
+      {
+        ndt_2d::Pose2d correction;
+        Eigen::Matrix3d covariance;
+        double score = instance->matchScan(queries[i], correction, covariance);
+        if (score != expected_scores[i] ||
+            correction.x != expected_corrections[i].x ||
+            correction.y != expected_corrections[i].y ||
+            correction.theta != expected_corrections[i].theta ||
+            instance->scorePoints(points, queries[i]->getPose()) !=
+              matcher->scorePoints(points, queries[i]->getPose()))
+        {
+          ++mismatches[t];
+        }
+      }
+    });
+  }
+  for (auto & thread : threads)
+  {
+    thread.join();
+  }
+  for (auto & count : mismatches)
+  {
+    EXPECT_EQ(0, count);
+  }
+
+  // Resetting the original does not affect instances sharing the model
+  matcher->reset();
+  EXPECT_DOUBLE_EQ(0.0, matcher->scoreScan(queries[0]));
+  ndt_2d::Pose2d correction;
+  Eigen::Matrix3d covariance;
+  EXPECT_DOUBLE_EQ(expected_scores[0], view->matchScan(queries[0], correction, covariance));
+  EXPECT_DOUBLE_EQ(expected_scores[0], clone->matchScan(queries[0], correction, covariance));
+}
+
+TEST(ScanMatcherTests, test_ndt_reinitialize)
+{
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests");
+  ndt_2d::ScanMatcherNDT matcher;
+  matcher.initialize("matcher", node.get(), 5.0);
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, makeCorner(), ndt_2d::Pose2d()));
+  matcher.addScans(scans.begin(), scans.end());
+  size_t fine_memory = matcher.memoryUsage();
+
+  // Parameters are already declared, initializing again picks up changes
+  node->set_parameter(rclcpp::Parameter("matcher.ndt_resolution", 1.0));
+  matcher.initialize("matcher", node.get(), 5.0);
+  matcher.reset();
+  matcher.addScans(scans.begin(), scans.end());
+  EXPECT_LT(matcher.memoryUsage(), fine_memory);
+}
+
+TEST(ScanMatcherTests, test_ndt_d2d_match)
+{
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests",
+    rclcpp::NodeOptions().parameter_overrides({rclcpp::Parameter("matcher.mode", "d2d")}));
+  ndt_2d::ScanMatcherNDT matcher;
+  matcher.initialize("matcher", node.get(), 5.0);
+
+  // A corner and a third wall, so that all three dimensions are constrained
+  std::vector<ndt_2d::Point> points = makeCorner();
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(-2.0, t);
+  }
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, points, ndt_2d::Pose2d()));
+  matcher.addScans(scans.begin(), scans.end());
+
+  // Query is actually at the origin, but starts with an error
+  ndt_2d::ScanPtr query = makeScan(1, points, ndt_2d::Pose2d(0.03, -0.02, 0.02));
+  double initial_score = matcher.scoreScan(query);
+
+  ndt_2d::Pose2d correction;
+  Eigen::Matrix3d covariance;
+  double score = matcher.matchScan(query, correction, covariance);
+  EXPECT_NEAR(-0.03, correction.x, 0.005);
+  EXPECT_NEAR(0.02, correction.y, 0.005);
+  EXPECT_NEAR(-0.02, correction.theta, 0.0025);
+
+  // Score is the mean likelihood of the query cells
+  EXPECT_LT(score, initial_score);
+  EXPECT_LT(score, -0.8);
+  EXPECT_GE(score, -1.0);
+}
+
+TEST(ScanMatcherTests, test_icp_match)
+{
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests");
+  ndt_2d::ScanMatcherICP matcher;
+  matcher.initialize("matcher", node.get(), 5.0);
+
+  // A corner and a third wall, so that all three dimensions are constrained
+  std::vector<ndt_2d::Point> points = makeCorner();
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(-2.0, t);
+  }
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, points, ndt_2d::Pose2d()));
+  matcher.addScans(scans.begin(), scans.end());
+
+  // Query is actually at the origin, but starts with an error
+  ndt_2d::ScanPtr query = makeScan(1, points, ndt_2d::Pose2d(0.05, -0.03, 0.02));
+  double initial_score = matcher.scoreScan(query);
+
+  ndt_2d::Pose2d correction;
+  Eigen::Matrix3d covariance;
+  double score = matcher.matchScan(query, correction, covariance);
+  EXPECT_NEAR(-0.05, correction.x, 0.005);
+  EXPECT_NEAR(0.03, correction.y, 0.005);
+  EXPECT_NEAR(-0.02, correction.theta, 0.002);
+
+  // Aligned scan explains almost every point
+  EXPECT_LT(score, initial_score);
+  EXPECT_LT(score, -0.9);
+  EXPECT_LT(matcher.novelty(scans[0]), 0.1);
+
+  // Covariance is positive definite, and small with this many points
+  Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+  EXPECT_GT(solver.eigenvalues()(0), 0.0);
+  EXPECT_LT(solver.eigenvalues()(2), 0.001);
+
+  // Memory is released on reset
+  size_t memory = matcher.memoryUsage();
+  matcher.reset();
+  EXPECT_LT(matcher.memoryUsage(), memory);
+  EXPECT_DOUBLE_EQ(0.0, matcher.matchScan(query, correction, covariance));
+}
+
+TEST(ScanMatcherTests, test_psm_match)
+{
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests");
+  ndt_2d::ScanMatcherPSM matcher;
+  matcher.initialize("matcher", node.get(), 5.0);
+
+  // A corner and a third wall, so that all three dimensions are constrained
+  std::vector<ndt_2d::Point> points = makeCorner();
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    points.emplace_back(-2.0, t);
+  }
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, points, ndt_2d::Pose2d()));
+  matcher.addScans(scans.begin(), scans.end());
+
+  // Query is actually at the origin, but starts with an error
+  ndt_2d::ScanPtr query = makeScan(1, points, ndt_2d::Pose2d(0.05, -0.03, 0.02));
+  double initial_score = matcher.scoreScan(query);
+
+  ndt_2d::Pose2d correction;
+  Eigen::Matrix3d covariance;
+  double score = matcher.matchScan(query, correction, covariance);
+  EXPECT_NEAR(-0.05, correction.x, 0.01);
+  EXPECT_NEAR(0.03, correction.y, 0.01);
+  EXPECT_NEAR(-0.02, correction.theta, 0.005);
+
+  // Aligned scan explains almost every bin
+  EXPECT_LT(score, initial_score);
+  EXPECT_LT(score, -0.8);
+  EXPECT_GE(score, -1.0);
+  EXPECT_LT(matcher.novelty(scans[0]), 0.1);
+  EXPECT_GT(matcher.novelty(query), matcher.novelty(scans[0]));
+
+  // Memory is released on reset
+  size_t memory = matcher.memoryUsage();
+  matcher.reset();
+  EXPECT_LT(matcher.memoryUsage(), memory);
+  EXPECT_DOUBLE_EQ(0.0, matcher.matchScan(query, correction, covariance));
+}
+
+TEST(ScanMatcherTests, test_psm_score_poses)
+{
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests");
+  ndt_2d::ScanMatcherPSM matcher;
+  matcher.initialize("matcher", node.get(), 5.0);
+
+  std::vector<ndt_2d::Point> points = makeCorner();
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, points, ndt_2d::Pose2d()));
+  matcher.addScans(scans.begin(), scans.end());
+
+  std::vector<ndt_2d::Pose2d> poses;
+  for (double x = -0.2; x < 0.2; x += 0.05)
+  {
+    poses.emplace_back(x, -0.5 * x, x);
+  }
+  // Far outside of the map
+  poses.emplace_back(1e6, -1e6, 0.0);
+
+  std::vector<double> scores;
+  matcher.scorePoints(points, poses, scores);
+  ASSERT_EQ(poses.size(), scores.size());
+  for (size_t i = 0; i < poses.size(); ++i)
+  {
+    EXPECT_DOUBLE_EQ(matcher.scorePoints(points, poses[i]), scores[i]);
+  }
+  EXPECT_LT(scores[4], -0.8);
+  EXPECT_DOUBLE_EQ(0.0, scores.back());
+
+  // Points beyond the range of the laser do not change scores or novelty
+  double novelty = matcher.novelty(scans[0]);
+  std::vector<ndt_2d::Point> far_points;
+  for (double t = -2.0; t < 2.0; t += 0.02)
+  {
+    far_points.emplace_back(20.0, t);
+  }
+  scans.push_back(makeScan(1, far_points, ndt_2d::Pose2d()));
+  matcher.addScans(scans.begin(), scans.end());
+  std::vector<double> far_scores;
+  matcher.scorePoints(points, poses, far_scores);
+  EXPECT_EQ(scores, far_scores);
+  EXPECT_DOUBLE_EQ(novelty, matcher.novelty(scans[0]));
+}
+
+TEST(ScanMatcherTests, test_match_deadline)
+{
+  auto node = std::make_shared<rclcpp::Node>("scan_matcher_tests");
+  std::vector<std::shared_ptr<ndt_2d::ScanMatcher>> matchers =
+  {
+    std::make_shared<ndt_2d::ScanMatcherNDT>(),
+    std::make_shared<ndt_2d::ScanMatcherICP>(),
+    std::make_shared<ndt_2d::ScanMatcherPSM>()
+  };
+
+  std::vector<ndt_2d::ScanPtr> scans;
+  scans.push_back(makeScan(0, makeCorner(), ndt_2d::Pose2d()));
+  ndt_2d::ScanPtr query = makeScan(1, makeCorner(), ndt_2d::Pose2d(0.05, -0.03, 0.02));
+
+  for (size_t i = 0; i < matchers.size(); ++i)
+  {
+    matchers[i]->initialize("matcher" + std::to_string(i), node.get(), 5.0);
+    matchers[i]->addScans(scans.begin(), scans.end());
+
+    // Matches that run past their deadline are abandoned
+    ndt_2d::Pose2d correction;
+    Eigen::Matrix3d covariance;
+    auto past = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+    EXPECT_TRUE(std::isnan(matchers[i]->matchScan(query, correction, covariance, past)));
+
+    // Otherwise the result is the same as without a deadline
+    ndt_2d::Pose2d expected;
+    auto future = std::chrono::steady_clock::now() + std::chrono::hours(1);
+    double score = matchers[i]->matchScan(query, correction, covariance, future);
+    EXPECT_DOUBLE_EQ(matchers[i]->matchScan(query, expected, covariance), score);
+    EXPECT_DOUBLE_EQ(expected.x, correction.x);
+    EXPECT_DOUBLE_EQ(expected.theta, correction.theta);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  rclcpp::init(argc, argv);
+  testing::InitGoogleTest(&argc, argv);
+  int result = RUN_ALL_TESTS();
+  rclcpp::shutdown();
+  return result;
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2023 Michael Ferguson
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the opyright holder nor the names of its
+ *       contributors may be used to endorse or promote products derived from
+ *       this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include <ndt_2d/shared_map.hpp>
+
+TEST(SharedMapTests, read_write_test)
+{
+  const std::string FILENAME = "test_shared_map.ndtshm";
+
+  // Two walls, so that the NDT has many valid cells
+  std::vector<ndt_2d::ScanPtr> scans;
+  for (size_t i = 0; i < 3; ++i)
+  {
+    std::vector<ndt_2d::Point> points;
+    for (double t = -2.0; t < 2.0; t += 0.01 * (i + 1))
+    {
+      points.emplace_back(2.0, t);
+      points.emplace_back(t, 2.0);
+    }
+    ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(i);
+    scan->setPose(ndt_2d::Pose2d(0.1 * i, -0.1 * i, 0.01 * i));
+    scan->setPoints(points);
+    scans.push_back(scan);
+  }
+
+  Eigen::Matrix3d covariance = Eigen::Matrix3d::Identity() * 0.1;
+  std::vector<ndt_2d::ConstraintPtr> constraints;
+  constraints.push_back(ndt_2d::makeConstraint(scans[0], scans[1], covariance));
+  constraints.push_back(ndt_2d::makeConstraint(scans[1], scans[2], covariance));
+  constraints.back()->switchable = true;
+
+  ndt_2d::NDT ndt(0.25, 6.0, 6.0, -3.0, -3.0);
+  for (auto & scan : scans)
+  {
+    ndt.addScan(scan);
+  }
+  ndt.compute();
+
+  ASSERT_TRUE(ndt_2d::SharedMap::write(FILENAME, scans, constraints, &ndt));
+  ndt_2d::SharedMapPtr map = ndt_2d::SharedMap::open(FILENAME);
+  ASSERT_TRUE(map);
+
+  ASSERT_EQ(3u, map->getNumScans());
+  for (size_t i = 0; i < scans.size(); ++i)
+  {
+    EXPECT_EQ(i, map->getScanId(i));
+    EXPECT_DOUBLE_EQ(scans[i]->getPose().x, map->getScanPose(i).x);
+    EXPECT_DOUBLE_EQ(scans[i]->getPose().y, map->getScanPose(i).y);
+    EXPECT_DOUBLE_EQ(scans[i]->getPose().theta, map->getScanPose(i).theta);
+
+    std::vector<ndt_2d::Point> points = scans[i]->getPoints();
+    size_t size;
+    const ndt_2d::Point * shared_points = map->getScanPoints(i, size);
+    ASSERT_EQ(points.size(), size);
+    EXPECT_DOUBLE_EQ(points.back().x, shared_points[size - 1].x);
+    EXPECT_DOUBLE_EQ(points.back().y, shared_points[size - 1].y);
+  }
+
+  ASSERT_EQ(2u, map->getNumConstraints());
+  ndt_2d::Constraint constraint = map->getConstraint(1);
+  EXPECT_EQ(constraints[1]->begin, constraint.begin);
+  EXPECT_EQ(constraints[1]->end, constraint.end);
+  EXPECT_TRUE(constraint.transform.isApprox(constraints[1]->transform));
+  EXPECT_TRUE(constraint.information.isApprox(constraints[1]->information));
+  EXPECT_TRUE(constraint.switchable);
+  EXPECT_FALSE(map->getConstraint(0).switchable);
+
+  // View scores identically, without a copy of the cells
+  std::shared_ptr<const ndt_2d::NDT> view = map->getNDT();
+  ASSERT_TRUE(view);
+  EXPECT_EQ(ndt.getNumCells(), view->getNumCells());
+  EXPECT_EQ(sizeof(ndt_2d::NDT), view->memoryUsage());
+  for (double t = -2.5; t < 2.5; t += 0.13)
+  {
+    Eigen::Vector2d p(1.95 + 0.01 * t, t);
+    EXPECT_DOUBLE_EQ(ndt.likelihood(p), view->likelihood(p));
+  }
+  EXPECT_GT(view->likelihood(Eigen::Vector2d(2.0, 0.0)), 0.0);
+
+  // Rewriting does not affect attached maps
+  ASSERT_TRUE(ndt_2d::SharedMap::write(FILENAME, {scans[0]}, {}, nullptr));
+  EXPECT_EQ(3u, map->getNumScans());
+  ndt_2d::SharedMapPtr rewritten = ndt_2d::SharedMap::open(FILENAME);
+  ASSERT_TRUE(rewritten);
+  EXPECT_EQ(1u, rewritten->getNumScans());
+  EXPECT_EQ(0u, rewritten->getNumConstraints());
+  EXPECT_FALSE(rewritten->getNDT());
+
+  // View keeps the map attached
+  map.reset();
+  EXPECT_DOUBLE_EQ(ndt.likelihood(Eigen::Vector2d(2.0, 0.0)),
+                   view->likelihood(Eigen::Vector2d(2.0, 0.0)));
+
+  std::remove(FILENAME.c_str());
+}
+
+TEST(SharedMapTests, invalid_file_test)
+{
+  const std::string FILENAME = "test_shared_map_invalid.ndtshm";
+
+  EXPECT_FALSE(ndt_2d::SharedMap::open(FILENAME));
+
+  {
+    std::ofstream file(FILENAME, std::ios::binary);
+    file << "not a shared map, but long enough to hold a header of the right size......"
+            "................................................................";
+  }
+  EXPECT_FALSE(ndt_2d::SharedMap::open(FILENAME));
+
+  // Truncated file should be rejected, not read past the end
+  std::vector<ndt_2d::Point> points(100, ndt_2d::Point(1.0, 1.0));
+  ndt_2d::ScanPtr scan = std::make_shared<ndt_2d::Scan>(0);
+  scan->setPoints(points);
+  ASSERT_TRUE(ndt_2d::SharedMap::write(FILENAME, {scan}, {}, nullptr));
+  ASSERT_TRUE(ndt_2d::SharedMap::open(FILENAME));
+  {
+    std::ifstream in(FILENAME, std::ios::binary);
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream out(FILENAME, std::ios::binary | std::ios::trunc);
+    out.write(data.data(), data.size() / 2);
+  }
+  EXPECT_FALSE(ndt_2d::SharedMap::open(FILENAME));
+
+  std::remove(FILENAME.c_str());
+}
+
+int main(int argc, char** argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}